@@ -16,6 +16,9 @@ SET cFLAGS=-g3 -Wall -Wextra -Werror -fsanitize=undefined -fsanitize-trap -pedan
 SET iFLAGS=-Isrc/
 SET lFLAGS=-fuse-ld=lld -Wl,--pdb=
 SET DEFINES=-DDEBUG
+REM gzip output (--gzip) needs zlib:
+REM SET DEFINES=%DEFINES% -DMDT_ZLIB
+REM SET lFLAGS=%lFLAGS% -lz
 
 ECHO "Building %assembly%%..."
 clang %cFilenames% %cFLAGS% -o ./build/%assembly%.%ext% %DEFINES% %iFLAGS% %lFLAGS%
\ No newline at end of file
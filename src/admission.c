@@ -0,0 +1,98 @@
+#include "admission.h"
+
+#include "tokenizer.h"
+#include "parser.h"
+#include "lib/mem.h"
+
+static b8 admission_fits(const admission_t* a, u64 estimate);
+static void admission_admit(admission_t* a, u64 estimate);
+
+b8 admission_init(admission_t* a, u64 budget) {
+    mem_set(a, 0, sizeof(admission_t));
+    a->budget = budget;
+
+    if (!mutex_create(&a->lock)) {
+        return false;
+    }
+    if (!condvar_create(&a->released)) {
+        mutex_destroy(&a->lock);
+        return false;
+    }
+
+    return true;
+}
+
+void admission_shutdown(admission_t* a) {
+    condvar_destroy(&a->released);
+    mutex_destroy(&a->lock);
+}
+
+u64 admission_estimate(u64 source_size) {
+    // The token array and the node chunks double as they grow, so they
+    // can be twice what's used, and the token array is copied when it
+    // grows. The output buffer doubles too, and a batch write holds a
+    // copy of it.
+    u64 tokens = source_size * ADMISSION_TOKENS_PER_1000 / 1000 * sizeof(token_t) * 3;
+    u64 nodes = source_size * ADMISSION_NODES_PER_1000 / 1000 * sizeof(node_t) * 2;
+    u64 output = source_size * ADMISSION_OUTPUT_PER_1000 / 1000 * 3;
+
+    return ADMISSION_OVERHEAD + source_size + tokens + nodes + output;
+}
+
+b8 admission_alone(const admission_t* a, u64 estimate) {
+    return a->budget > 0 && estimate > a->budget;
+}
+
+b8 admission_try(admission_t* a, u64 estimate) {
+    mutex_lock(&a->lock);
+    b8 fits = admission_fits(a, estimate);
+    if (fits) {
+        admission_admit(a, estimate);
+    }
+    mutex_unlock(&a->lock);
+
+    return fits;
+}
+
+void admission_acquire(admission_t* a, u64 estimate) {
+    mutex_lock(&a->lock);
+    if (!admission_fits(a, estimate)) {
+        a->stats.waited++;
+        while (!admission_fits(a, estimate)) {
+            condvar_wait(&a->released, &a->lock);
+        }
+    }
+    admission_admit(a, estimate);
+    mutex_unlock(&a->lock);
+}
+
+void admission_release(admission_t* a, u64 estimate) {
+    mutex_lock(&a->lock);
+    a->in_use -= estimate;
+    a->running--;
+    // Waiters of every size, any of them could fit now
+    condvar_broadcast(&a->released);
+    mutex_unlock(&a->lock);
+}
+
+admission_stats_t admission_stats(admission_t* a) {
+    mutex_lock(&a->lock);
+    admission_stats_t stats = a->stats;
+    mutex_unlock(&a->lock);
+
+    return stats;
+}
+
+static b8 admission_fits(const admission_t* a, u64 estimate) {
+    // With nothing running everything goes, even over the budget,
+    // or it would never run at all
+    return a->budget == 0 || a->running == 0 || a->in_use + estimate <= a->budget;
+}
+
+static void admission_admit(admission_t* a, u64 estimate) {
+    a->in_use += estimate;
+    a->running++;
+    a->stats.admitted++;
+    if (admission_alone(a, estimate)) a->stats.alone++;
+    if (a->in_use > a->stats.peak) a->stats.peak = a->in_use;
+}
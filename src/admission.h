@@ -0,0 +1,62 @@
+#pragma once
+
+#include "types.h"
+#include "platform.h"
+
+// Admission control for renders that are in memory at the same time
+// (batch documents between their read and their writes, daemon
+// requests). Each is admitted with an estimate of its peak memory, and
+// only while the estimates of everything admitted stay under the
+// budget. A job bigger than the whole budget is admitted once nothing
+// else is running, so it runs alone.
+//
+// The estimate is the source, its tokens and nodes and the output, from
+// ratios measured over the sample documents (prose, lists, tables,
+// code, links), the high end of each: tokens and nodes per 1000 source
+// bytes, HTML bytes per 1000 source bytes.
+#define ADMISSION_TOKENS_PER_1000 330
+#define ADMISSION_NODES_PER_1000 190
+#define ADMISSION_OUTPUT_PER_1000 1650
+// What every render has whatever its size (context, block list, sinks)
+#define ADMISSION_OVERHEAD (64 * 1024)
+
+typedef struct admission_stats {
+    u64 admitted;
+    // Had to wait for others to finish first
+    u64 waited;
+    // Bigger than the budget, ran alone
+    u64 alone;
+    // Most bytes admitted at once
+    u64 peak;
+} admission_stats_t;
+
+typedef struct admission {
+    // 0 admits everything
+    u64 budget;
+    u64 in_use;
+    u32 running;
+
+    mutex_t lock;
+    condvar_t released;
+    admission_stats_t stats;
+} admission_t;
+
+b8 admission_init(admission_t* a, u64 budget);
+void admission_shutdown(admission_t* a);
+
+// Peak bytes the render of a `source_size` byte document is expected
+// to need.
+u64 admission_estimate(u64 source_size);
+
+// True if a job this big is only admitted alone.
+b8 admission_alone(const admission_t* a, u64 estimate);
+
+// Admits the job if it fits now, for callers with other work to do.
+b8 admission_try(admission_t* a, u64 estimate);
+
+// Waits until the job fits.
+void admission_acquire(admission_t* a, u64 estimate);
+
+void admission_release(admission_t* a, u64 estimate);
+
+admission_stats_t admission_stats(admission_t* a);
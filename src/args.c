@@ -1,17 +1,45 @@
 #include "args.h"
 
+#include "blocks.h"
 #include "lib/str.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 
 config_t parse_args(i32 argc, char** argv) {
     config_t config = {
         .input_file = nullptr,
-        .output_file = "out.html",
+        .inputs = nullptr,
+        .input_count = 0,
+        .output_file = nullptr,
         .title = "Markdown",
-        .css = nullptr
+        .css = nullptr,
+        .template_file = nullptr,
+        .output_mode = SINK_BUFFERED,
+        .output_format = FORMAT_HTML,
+        .bench_iterations = 0,
+        .perf = false,
+        .watch = false,
+        .cache = false,
+        .block_cache_mb = 0,
+        .memory_budget_mb = 0,
+        .book = false,
+        .check_links = false,
+        .search_index = nullptr,
+        .gzip = { 0, false },
+        .daemon_socket = nullptr,
+        .threads = 0,
+        .io_backend = IO_BACKEND_URING
     };
 
+    budget_init(&config.budget);
+
+    config.inputs = malloc(sizeof(char*) * argc);
+    if (config.inputs == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for inputs.\n");
+        return config;
+    }
+
     for (i32 i = 1; i < argc; ++i) {
         // Output file (optional)
         // Usage: -o [filename] || --output=[filename]
@@ -34,18 +62,165 @@ config_t parse_args(i32 argc, char** argv) {
         } else if (str_cmp(argv[i], "-t") == 0) {
             config.title = argv[++i];
 
+        // HTML page template (optional)
+        // Usage: --template=[filename]
+        } else if (str_ncmp(argv[i], "--template=", 11) == 0) {
+            config.template_file = argv[i] + 11;
+
+        // Gather-write output (optional)
+        // Usage: -g || --gather
+        } else if (str_cmp(argv[i], "--gather") == 0 || str_cmp(argv[i], "-g") == 0) {
+            config.output_mode = SINK_GATHER;
+
+        // Output format (optional)
+        // Usage: --format=html || --format=text || --format=json
+        } else if (str_ncmp(argv[i], "--format=", 9) == 0) {
+            if (!renderer_find(argv[i] + 9, &config.output_format)) {
+                // Rendering some other format instead isn't what was asked for
+                fprintf(stderr, "Unknown format: %s\nUsage: --format=html || --format=text || --format=json\n",
+                    argv[i] + 9);
+                config.input_file = nullptr;
+                config.input_count = 0;
+                config.daemon_socket = nullptr;
+                return config;
+            }
+
+        // Benchmark the renderer (optional)
+        // Usage: --bench || --bench=[iterations]
+        } else if (str_ncmp(argv[i], "--bench=", 8) == 0) {
+            config.bench_iterations = (u32)atoi(argv[i] + 8);
+        } else if (str_cmp(argv[i], "--bench") == 0) {
+            config.bench_iterations = 100;
+
+        // Report hardware counters per stage, on Linux (optional)
+        // Usage: --perf
+        } else if (str_cmp(argv[i], "--perf") == 0) {
+            config.perf = true;
+
+        // Watch the input file or directory and re-render on change (optional)
+        // Usage: -w || --watch
+        } else if (str_cmp(argv[i], "--watch") == 0 || str_cmp(argv[i], "-w") == 0) {
+            config.watch = true;
+
+        // Reuse parsed trees saved next to the inputs (optional)
+        // Usage: --cache
+        } else if (str_cmp(argv[i], "--cache") == 0) {
+            config.cache = true;
+
+        // Reuse rendered blocks across documents, in MB (optional)
+        // Usage: --block-cache || --block-cache=[MB]
+        } else if (str_ncmp(argv[i], "--block-cache=", 14) == 0) {
+            config.block_cache_mb = (u32)atoi(argv[i] + 14);
+        } else if (str_cmp(argv[i], "--block-cache") == 0) {
+            config.block_cache_mb = BLOCK_CACHE_DEFAULT_MB;
+
+        // Memory the batch documents or daemon requests in flight can
+        // take together, in MB (optional). One bigger than all of it is
+        // rendered alone, written out as it goes.
+        // Usage: --memory-budget=[MB]
+        } else if (str_ncmp(argv[i], "--memory-budget=", 16) == 0) {
+            config.memory_budget_mb = (u32)atoi(argv[i] + 16);
+
+        // Render the inputs as chapters of a single output (optional)
+        // Usage: --book
+        } else if (str_cmp(argv[i], "--book") == 0) {
+            config.book = true;
+
+        // Check links and anchors between the inputs of a batch (optional)
+        // Usage: --check-links
+        } else if (str_cmp(argv[i], "--check-links") == 0) {
+            config.check_links = true;
+
+        // Write a full-text index of the inputs (optional)
+        // Usage: --search-index=[filename]
+        } else if (str_ncmp(argv[i], "--search-index=", 15) == 0) {
+            config.search_index = argv[i] + 15;
+
+        // Also write a gzip compressed copy next to the output (optional)
+        // Usage: --gzip || --gzip=[level] || --gzip-only || --gzip-only=[level]
+        } else if (str_ncmp(argv[i], "--gzip", 6) == 0) {
+            const char* rest = argv[i] + 6;
+            config.gzip.only = str_ncmp(rest, "-only", 5) == 0;
+            if (config.gzip.only) rest += 5;
+
+            if (rest[0] == '=') {
+                config.gzip.level = atoi(rest + 1);
+                if (config.gzip.level < 1 || config.gzip.level > 9) {
+                    fprintf(stderr, "Gzip level must be between 1 and 9: %s\n", rest + 1);
+                    config.gzip.level = 6;
+                }
+            } else if (rest[0] == '\0') {
+                config.gzip.level = 6;
+            } else {
+                fprintf(stderr, "Unknown options: %s\n", argv[i]);
+            }
+
+        // Per-render limits, 0 is no limit (optional)
+        // Usage: --deadline=[ms] --max-tokens=[count] --max-nodes=[count] --max-output=[bytes]
+        } else if (str_ncmp(argv[i], "--deadline=", 11) == 0) {
+            config.budget.timeout_ns = strtoull(argv[i] + 11, nullptr, 10) * 1000000ULL;
+        } else if (str_ncmp(argv[i], "--max-tokens=", 13) == 0) {
+            config.budget.max_tokens = strtoull(argv[i] + 13, nullptr, 10);
+        } else if (str_ncmp(argv[i], "--max-nodes=", 12) == 0) {
+            config.budget.max_nodes = strtoull(argv[i] + 12, nullptr, 10);
+        } else if (str_ncmp(argv[i], "--max-output=", 13) == 0) {
+            config.budget.max_output = strtoull(argv[i] + 13, nullptr, 10);
+
+        // Keep the output of a render a limit stopped (optional)
+        // Usage: --partial
+        } else if (str_cmp(argv[i], "--partial") == 0) {
+            config.budget.partial = true;
+
+        // Run as a render daemon on a Unix socket (optional)
+        // Usage: -d [socket] || --daemon=[socket]
+        } else if (str_ncmp(argv[i], "--daemon=", 9) == 0) {
+            config.daemon_socket = argv[i] + 9;
+        } else if (str_cmp(argv[i], "-d") == 0) {
+            config.daemon_socket = argv[++i];
+
+        // Worker thread count, defaults to the core count (optional)
+        // Usage: --threads=[count]
+        } else if (str_ncmp(argv[i], "--threads=", 10) == 0) {
+            config.threads = (u32)atoi(argv[i] + 10);
+
+        // I/O backend for batch mode (optional)
+        // Usage: --io=uring || --io=threads
+        } else if (str_cmp(argv[i], "--io=uring") == 0) {
+            config.io_backend = IO_BACKEND_URING;
+        } else if (str_cmp(argv[i], "--io=threads") == 0) {
+            config.io_backend = IO_BACKEND_THREADS;
+
         // Unknown option!
         } else if (argv[i][0] == '-') {
             fprintf(stderr, "Unknown options: %s\n", argv[i]);
 
-        // Input file*
-        // Usage: [filename]
+        // Input file(s)*
+        // Usage: [filename] [filename]...
         } else {
-            config.input_file = argv[i];
+            if (config.input_file == nullptr) {
+                config.input_file = argv[i];
+            }
+            config.inputs[config.input_count++] = argv[i];
         }
     }
 
-    if (config.input_file == nullptr) {
+    // Batch outputs are named after their inputs, there's no one file
+    // for -o to name. Leaving the input out stops the run.
+    if (config.output_file != nullptr && config.input_count > 1 &&
+        !config.book && !config.watch && config.bench_iterations == 0) {
+        fprintf(stderr, "-o/--output takes a single input (or --book), batch outputs are named after their inputs.\n");
+        config.input_file = nullptr;
+        config.input_count = 0;
+        return config;
+    }
+
+    // The default output is named after the format
+    if (config.output_file == nullptr) {
+        config.output_file = (char*)renderer_get(config.output_format)->default_output;
+    }
+
+    // The daemon gets its input over the socket
+    if (config.input_file == nullptr && config.daemon_socket == nullptr) {
         fprintf(stderr, "Input file is required. Use --help or -h to get more information.\n");
     }
 
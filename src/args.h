@@ -1,12 +1,42 @@
 #pragma once
 
 #include "types.h"
+#include "sink.h"
+#include "io.h"
+#include "renderer.h"
+#include "budget.h"
 
 typedef struct config {
     char* input_file;
+    // Every input given, more than one means batch mode
+    char** inputs;
+    u32 input_count;
     char* output_file;
     char* title;
     char* css;
+    char* template_file;
+    sink_mode_t output_mode;
+    output_format_t output_format;
+    u32 bench_iterations;
+    // Hardware counters around the pipeline stages
+    b8 perf;
+    b8 watch;
+    b8 cache;
+    // Rendered blocks kept across documents, 0 is off
+    u32 block_cache_mb;
+    // Renders in memory at once are kept under it, 0 is no limit
+    u32 memory_budget_mb;
+    // Every input goes into the one output, in order
+    b8 book;
+    // Batch runs check the links between their documents
+    b8 check_links;
+    // Where the search index of the inputs goes (optional)
+    char* search_index;
+    gzip_options_t gzip;
+    budget_t budget;
+    char* daemon_socket;
+    u32 threads;
+    io_backend_t io_backend;
 } config_t;
 
 config_t parse_args(i32  argc, char** argv);
@@ -0,0 +1,464 @@
+#include "batch.h"
+
+#include "admission.h"
+#include "io.h"
+#include "gzip.h"
+#include "render.h"
+#include "search.h"
+#include "site.h"
+#include "platform.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// An input in the order it's rendered, and what it holds of the memory
+// budget from its read until its writes are out
+typedef struct batch_job {
+    u64 estimate;
+    u32 index;
+    u32 writes;
+} batch_job_t;
+
+static batch_job_t* batch_jobs(config_t* cfg);
+static char* batch_load(render_context_t* ctx, const char* path, u64* size, u64* read);
+static i32 compare_jobs(const void* a, const void* b);
+
+i32 run_batch(config_t* cfg) {
+    batch_job_t* jobs = batch_jobs(cfg);
+    if (jobs == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for the inputs.\n");
+        return -1;
+    }
+
+    admission_t admit;
+    if (!admission_init(&admit, (u64)cfg->memory_budget_mb * 1024 * 1024)) {
+        free(jobs);
+        return -1;
+    }
+
+    io_t io;
+    if (!io_init(&io, cfg->io_backend, IO_DEFAULT_DEPTH)) {
+        admission_shutdown(&admit);
+        free(jobs);
+        return -1;
+    }
+
+    // Compiled once, every document reuses it
+    page_t page;
+    template_t template;
+    if (!page_init(&page, &template, cfg->title, cfg->css, cfg->template_file)) {
+        io_shutdown(&io);
+        admission_shutdown(&admit);
+        free(jobs);
+        return -1;
+    }
+
+    render_context_t ctx;
+    sink_t out;
+    if (!render_context_init(&ctx, SINK_BUFFERED)) {
+        template_shutdown(&template);
+        io_shutdown(&io);
+        admission_shutdown(&admit);
+        free(jobs);
+        return -1;
+    }
+    ctx.renderer = renderer_get(cfg->output_format);
+    ctx.use_cache = cfg->cache;
+    ctx.budget = cfg->budget;
+    if (!sink_init_memory(&out)) {
+        render_context_shutdown(&ctx);
+        template_shutdown(&template);
+        io_shutdown(&io);
+        admission_shutdown(&admit);
+        free(jobs);
+        return -1;
+    }
+    if (budget_enabled(&ctx.budget)) {
+        out.budget = &ctx.budget;
+    }
+
+    // Anchors only exist in HTML
+    site_index_t site;
+    b8 check_links = cfg->check_links && cfg->output_format == FORMAT_HTML;
+    if (cfg->check_links && !check_links) {
+        fprintf(stderr, "Links are only checked in HTML output.\n");
+    }
+    if (check_links && !site_index_init(&site, cfg->inputs, cfg->input_count, ctx.renderer->extension)) {
+        fprintf(stderr, "Failed to allocate memory for the link index.\n");
+        sink_shutdown(&out);
+        render_context_shutdown(&ctx);
+        template_shutdown(&template);
+        io_shutdown(&io);
+        admission_shutdown(&admit);
+        free(jobs);
+        return -1;
+    }
+
+    // Each document goes out as the plain file, the .gz or both
+    b8 compress = cfg->gzip.level > 0;
+    u32 outputs = (cfg->gzip.only ? 0 : 1) + (compress ? 1 : 0);
+    if (compress && !sink_gzip_begin(&out, nullptr, cfg->gzip.level)) {
+        if (check_links) site_index_shutdown(&site);
+        sink_shutdown(&out);
+        render_context_shutdown(&ctx);
+        template_shutdown(&template);
+        io_shutdown(&io);
+        admission_shutdown(&admit);
+        free(jobs);
+        return -1;
+    }
+
+    // Terms of every document, written once they're all in
+    search_index_t search;
+    b8 indexing = cfg->search_index != nullptr;
+    search_index_init(&search);
+
+    // Blocks that repeat between documents are rendered once. Pages
+    // with limits render whole, and the indexes need every tree.
+    block_cache_t blocks;
+    b8 use_blocks = cfg->block_cache_mb > 0 && cfg->output_format == FORMAT_HTML && !budget_enabled(&ctx.budget) &&
+                    !check_links && !indexing;
+    if (use_blocks && block_cache_init(&blocks, (u64)cfg->block_cache_mb * 1024 * 1024)) {
+        if (!render_context_use_blocks(&ctx, &blocks)) {
+            block_cache_shutdown(&blocks);
+            use_blocks = false;
+        }
+    } else {
+        use_blocks = false;
+    }
+    if (cfg->block_cache_mb > 0 && !use_blocks) {
+        fprintf(stderr, "Rendering without the block cache (HTML without limits, link checks or a search index only).\n");
+    }
+
+    u64 start = platform_time_ns();
+    u64 bytes_in = 0;
+    u64 bytes_out = 0;
+    u32 failed = 0;
+    u32 next = 0;
+    u32 finished = 0;
+    // Reads in flight, each holds back the extra slots its writes need
+    u32 reading = 0;
+    char out_file[IO_PATH_MAX];
+
+    while (finished < cfg->input_count * outputs) {
+        // Keep the queue full of upcoming inputs as far as the memory
+        // budget goes, but leave the slots every pending document needs
+        // for its writes beyond the one its read frees
+        u32 alone = cfg->input_count;
+        while (next < cfg->input_count && io.free_count > (reading + 1) * (outputs - 1) &&
+               admission_try(&admit, jobs[next].estimate)) {
+            // Only admitted once nothing else is in flight
+            if (admission_alone(&admit, jobs[next].estimate)) {
+                alone = next++;
+                break;
+            }
+
+            if (io_read(&io, cfg->inputs[jobs[next].index], next)) {
+                reading++;
+            } else {
+                admission_release(&admit, jobs[next].estimate);
+                failed++;
+                finished += outputs;
+            }
+            next++;
+        }
+
+        u32 at;
+        char* source;
+        u64 size;
+        io_request_t* r = nullptr;
+        if (alone < cfg->input_count) {
+            // Too big to share the budget: read into the context, and
+            // written further down as it renders
+            at = alone;
+            u64 read = 0;
+            source = batch_load(&ctx, cfg->inputs[jobs[at].index], &size, &read);
+            bytes_in += read;
+            if (source == nullptr) {
+                fprintf(stderr, "Failed to read: %s\n", cfg->inputs[jobs[at].index]);
+                admission_release(&admit, jobs[at].estimate);
+                failed++;
+                finished += outputs;
+                continue;
+            }
+        } else {
+            r = io_wait(&io);
+            if (r == nullptr) {
+                continue;
+            }
+
+            at = r->tag;
+            if (r->op == IO_OP_WRITE) {
+                if (r->failed) {
+                    fprintf(stderr, "Failed to write: %s\n", r->path);
+                    failed++;
+                }
+                bytes_out += r->done;
+                finished++;
+                if (--jobs[at].writes == 0) {
+                    admission_release(&admit, jobs[at].estimate);
+                }
+                io_release(&io, r);
+                continue;
+            }
+            reading--;
+
+            if (r->failed) {
+                admission_release(&admit, jobs[at].estimate);
+                failed++;
+                finished += outputs;
+                io_release(&io, r);
+                continue;
+            }
+
+            // Render straight out of the read buffer, or inflate compressed
+            // inputs into the context's source buffer first
+            bytes_in += r->size;
+            source = r->buffer;
+            size = r->size;
+            if (gzip_detect(r->buffer, r->size)) {
+                i64 inflated = gzip_read_buffer(r->buffer, r->size, &ctx.source, &ctx.source_capacity);
+                source = ctx.source;
+
+                if (inflated == -1) {
+                    fprintf(stderr, "Failed to read: %s\n", cfg->inputs[jobs[at].index]);
+                    admission_release(&admit, jobs[at].estimate);
+                    failed++;
+                    finished += outputs;
+                    io_release(&io, r);
+                    continue;
+                }
+                size = (u64)inflated;
+            }
+        }
+        u32 index = jobs[at].index;
+        node_t* root = use_blocks ? nullptr : render_parse_cached(&ctx, source, size, cfg->inputs[index]);
+        if (!use_blocks && root == nullptr) {
+            fprintf(stderr, "Failed to render: %s\n", cfg->inputs[index]);
+            admission_release(&admit, jobs[at].estimate);
+            failed++;
+            finished += outputs;
+            if (r) io_release(&io, r);
+            continue;
+        }
+
+        // Collected while the source is still around, checked once all are in
+        if (check_links && !site_index_add(&site, index, root, &ctx.tokenizer)) {
+            fprintf(stderr, "Failed to allocate memory for the link index.\n");
+            site_index_shutdown(&site);
+            check_links = false;
+            failed++;
+        }
+        if (indexing && batch_output_path(cfg->inputs[index], ctx.renderer->extension, out_file, sizeof(out_file)) &&
+            !search_index_add(&search, out_file, root)) {
+            fprintf(stderr, "Failed to allocate memory for the search index.\n");
+            indexing = false;
+            failed++;
+        }
+
+        if (r == nullptr) {
+            // Through the context's file sink, so the output goes out as
+            // it's rendered instead of whole through a write
+            b8 written = batch_output_path(cfg->inputs[index], ctx.renderer->extension, out_file, sizeof(out_file)) &&
+                         sink_open(&ctx.sink, out_file, &cfg->gzip);
+            if (written) {
+                if (use_blocks) {
+                    render_write_blocks(&ctx, source, size, cfg->inputs[index], &ctx.sink, &page);
+                } else {
+                    ctx.renderer->write_document(root, &ctx.sink, &page);
+                }
+                written = sink_close(&ctx.sink);
+                bytes_out += ctx.sink.bytes_written;
+            }
+
+            if (ctx.budget.status != BUDGET_OK) {
+                fprintf(stderr, "%s: render stopped at the %s\n", cfg->inputs[index], budget_status_str(ctx.budget.status));
+                if (!ctx.budget.partial) renderer_remove_file(out_file, &cfg->gzip);
+                failed++;
+            } else if (!written) {
+                fprintf(stderr, "Failed to render: %s\n", cfg->inputs[index]);
+                failed++;
+            }
+
+            admission_release(&admit, jobs[at].estimate);
+            finished += outputs;
+            continue;
+        }
+
+        sink_reset(&out, nullptr);
+        if (compress) sink_gzip_begin(&out, nullptr, cfg->gzip.level);
+        if (use_blocks) {
+            render_write_blocks(&ctx, source, size, cfg->inputs[index], &out, &page);
+        } else {
+            ctx.renderer->write_document(root, &out, &page);
+        }
+        if (compress) sink_gzip_end(&out);
+
+        // The read's slot is what the first write goes out through
+        io_release(&io, r);
+
+        // A render a limit stopped only goes out if partial output is wanted
+        b8 stopped = ctx.budget.status != BUDGET_OK;
+        if (stopped) {
+            fprintf(stderr, "%s: render stopped at the %s\n", cfg->inputs[index], budget_status_str(ctx.budget.status));
+            failed++;
+            if (!ctx.budget.partial) {
+                admission_release(&admit, jobs[at].estimate);
+                finished += outputs;
+                continue;
+            }
+        }
+
+        u32 submitted = 0;
+        if (!out.failed && batch_output_path(cfg->inputs[index], ctx.renderer->extension, out_file, sizeof(out_file))) {
+            if (!cfg->gzip.only && io_write(&io, out_file, out.buffer, out.length, at)) {
+                submitted++;
+            }
+            if (compress && submitted + 1 == outputs) {
+                u64 length;
+                const char* data = sink_gzip_data(&out, &length);
+                if (str_len(out_file) + 4 <= sizeof(out_file)) {
+                    str_cat(out_file, ".gz");
+                    if (io_write(&io, out_file, data, length, at)) submitted++;
+                }
+            }
+        }
+
+        if (submitted < outputs) {
+            fprintf(stderr, "Failed to render: %s\n", cfg->inputs[index]);
+            if (!stopped) failed++;
+            finished += outputs - submitted;
+        }
+
+        // Held until the last write is out
+        jobs[at].writes = submitted;
+        if (submitted == 0) {
+            admission_release(&admit, jobs[at].estimate);
+        }
+    }
+
+    // Every document is in, so every link can be checked
+    u64 broken = 0;
+    if (check_links) {
+        broken = site_index_check(&site);
+        printf("Checked %llu links to other documents and anchors, %llu broken\n", site.link_count, broken);
+        site_index_shutdown(&site);
+    }
+
+    b8 indexed = true;
+    if (indexing) {
+        indexed = search_index_write(&search, cfg->search_index);
+        if (indexed) {
+            printf("Indexed %llu terms in %llu sections of %llu documents into %s\n",
+                search.term_count, search.section_count, search.document_count, cfg->search_index);
+        } else {
+            fprintf(stderr, "Couldn't write search index: %s\n", cfg->search_index);
+        }
+    }
+    search_index_shutdown(&search);
+
+    u64 elapsed = platform_time_ns() - start;
+    f64 seconds = elapsed / 1e9;
+    printf("Rendered %u files (%u failed) in %.3f ms with %s I/O: %.0f files/s, %.2f MB/s in, %.2f MB/s out\n",
+        cfg->input_count - failed,
+        failed,
+        elapsed / 1e6,
+        io_backend_str(io.backend),
+        seconds > 0.0 ? cfg->input_count / seconds : 0.0,
+        seconds > 0.0 ? (bytes_in / 1e6) / seconds : 0.0,
+        seconds > 0.0 ? (bytes_out / 1e6) / seconds : 0.0);
+
+    if (use_blocks) {
+        block_cache_stats_t stats = block_cache_stats(&blocks);
+        printf("Block cache: %llu hits, %llu misses (%.1f%% hit), %llu stored, %llu evicted, %.2f MB\n",
+            stats.hits, stats.misses, block_cache_hit_rate(&stats), stats.stored, stats.evicted, stats.bytes / 1e6);
+    }
+
+    if (admit.budget > 0) {
+        admission_stats_t stats = admission_stats(&admit);
+        printf("Memory budget: %u MB, at most %.2f MB estimated in flight, %llu rendered alone\n",
+            cfg->memory_budget_mb, stats.peak / 1e6, stats.alone);
+    }
+
+    sink_shutdown(&out);
+    render_context_shutdown(&ctx);
+    if (use_blocks) block_cache_shutdown(&blocks);
+    template_shutdown(&template);
+    io_shutdown(&io);
+    admission_shutdown(&admit);
+    free(jobs);
+
+    return failed == 0 && broken == 0 && indexed ? 0 : -1;
+}
+
+b8 batch_output_path(const char* input, const char* extension, char* out, u64 size) {
+    u64 length = str_len(input);
+
+    // Drop the .md (or .md.gz) extension if there is one
+    if (length > 6 && str_cmp(input + length - 6, ".md.gz") == 0) {
+        length -= 6;
+    } else if (length > 3 && str_cmp(input + length - 3, ".md") == 0) {
+        length -= 3;
+    }
+
+    if (length + str_len(extension) + 1 > size) {
+        return false;
+    }
+
+    str_ncpy(out, input, length);
+    str_cat(out, extension);
+
+    return true;
+}
+
+static batch_job_t* batch_jobs(config_t* cfg) {
+    batch_job_t* jobs = malloc(sizeof(batch_job_t) * (cfg->input_count ? cfg->input_count : 1));
+    if (jobs == nullptr) {
+        return nullptr;
+    }
+
+    for (u32 i = 0; i < cfg->input_count; ++i) {
+        jobs[i] = (batch_job_t){ .estimate = 0, .index = i, .writes = 0 };
+    }
+    if (cfg->memory_budget_mb == 0) {
+        return jobs;
+    }
+
+    // Under a budget the largest go first, so the run doesn't end on
+    // one big document rendering by itself. Compressed inputs count at
+    // their size on disk, inputs that can't be read at nothing.
+    for (u32 i = 0; i < cfg->input_count; ++i) {
+        i64 size = source_file_size(cfg->inputs[i]);
+        jobs[i].estimate = size == -1 ? 0 : admission_estimate((u64)size);
+    }
+    qsort(jobs, cfg->input_count, sizeof(batch_job_t), compare_jobs);
+
+    return jobs;
+}
+
+static char* batch_load(render_context_t* ctx, const char* path, u64* size, u64* read) {
+    // What was read counts what's on disk, compressed or not
+    i64 file_size = source_file_size(path);
+    if (file_size == -1) {
+        return nullptr;
+    }
+
+    i64 loaded = load_source(path, &ctx->source, &ctx->source_capacity);
+    if (loaded == -1) {
+        return nullptr;
+    }
+    *read = (u64)file_size;
+    *size = (u64)loaded;
+
+    return ctx->source;
+}
+
+static i32 compare_jobs(const void* a, const void* b) {
+    const batch_job_t* x = a;
+    const batch_job_t* y = b;
+    if (x->estimate != y->estimate) {
+        return x->estimate < y->estimate ? 1 : -1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "types.h"
+#include "args.h"
+
+// Renders every input to its own output (`name.md` -> `name.html`,
+// or the extension of the selected format),
+// overlapping file I/O with tokenizing, parsing and rendering.
+// With a memory budget the largest inputs go first, only as many are
+// in flight as the budget allows, and inputs bigger than all of it are
+// rendered alone, straight to their output files.
+i32 run_batch(config_t* cfg);
+
+// Output path for an input in batch mode. Returns false if it doesn't fit.
+b8 batch_output_path(const char* input, const char* extension, char* out, u64 size);
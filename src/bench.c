@@ -0,0 +1,616 @@
+#include "bench.h"
+
+#include "tokenizer.h"
+#include "parser.h"
+#include "renderer.h"
+#include "sink.h"
+#include "document.h"
+#include "platform.h"
+#include "cache.h"
+#include "io.h"
+#include "html.h"
+#include "parallel.h"
+#include "perf.h"
+#include "lib/mem.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_NESTING_SIZE (4 * 1024 * 1024)
+#define BENCH_NESTING_DEPTH 32
+#define BENCH_TOKENIZE_SIZE (4 * 1024 * 1024)
+
+static b8 bench_render(node_t* root, const renderer_t* r, const char* out_file, sink_mode_t mode, u32 iterations, u64 source_size);
+static b8 bench_edit(tokenizer_t* t, u32 iterations);
+static b8 bench_cache(tokenizer_t* t, node_t* root, const char* out_file, u32 iterations);
+static b8 bench_nesting(u32 iterations);
+static u64 nesting_corpus(char* out, u64 size, u32 kind);
+static b8 bench_tokenize(tokenizer_t* input, u32 iterations);
+static b8 bench_parallel(node_t* root, tokenizer_t* t, u32 threads, u32 iterations);
+static b8 tokenize_compare(char* source, u64 size, const char* name, tokenizer_t* table, tokenizer_t* reference, u32 iterations);
+static u64 branchy_corpus(char* out, u64 size, u32 kind);
+static b8 reference_next_token(tokenizer_t* t);
+static token_type_t reference_char_to_token(char c, tokenizer_t* t);
+
+i32 run_bench(config_t* cfg) {
+    // Hardware counters around the first pass through each stage (optional)
+    perf_t perf;
+    perf_sample_t samples[4];
+    b8 counting = cfg->perf && perf_init(&perf);
+
+    u64 start = platform_time_ns();
+    if (counting) perf_start(&perf);
+
+    tokenizer_t tokenizer;
+    if (!tokenizer_init(&tokenizer, cfg->input_file)) {
+        fprintf(stderr, "Failed to initialize tokenizer!\n");
+        if (counting) perf_shutdown(&perf);
+        return -1;
+    }
+    if (counting) perf_stop(&perf, &samples[0]);
+    u64 loaded = platform_time_ns();
+
+    if (counting) perf_start(&perf);
+    while (next_token(&tokenizer));
+    if (counting) perf_stop(&perf, &samples[1]);
+    u64 tokenized = platform_time_ns();
+
+    node_pool_t pool;
+    node_pool_init(&pool);
+    link_table_t links;
+    link_table_init(&links);
+    if (counting) perf_start(&perf);
+    node_t* root = parse_md(&tokenizer, &pool, &links);
+    if (counting) perf_stop(&perf, &samples[2]);
+    u64 parsed = platform_time_ns();
+    if (root == nullptr) {
+        if (counting) perf_shutdown(&perf);
+        link_table_shutdown(&links);
+        node_pool_shutdown(&pool);
+        tokenizer_shutdown(&tokenizer);
+        return -1;
+    }
+
+    printf("Input: %s (%llu bytes, %llu tokens)\n",
+        cfg->input_file,
+        tokenizer.source_size,
+        tokenizer.token_array.count);
+    printf("  load:     %10.3f ms\n", (loaded - start) / 1e6);
+    printf("  tokenize: %10.3f ms\n", (tokenized - loaded) / 1e6);
+    printf("  parse:    %10.3f ms\n", (parsed - tokenized) / 1e6);
+
+    if (counting) {
+        // One HTML page into memory, so the disk isn't part of it
+        sink_t page_sink;
+        page_t page = { "Bench", nullptr, nullptr };
+        if (sink_init_memory(&page_sink)) {
+            perf_start(&perf);
+            html_write_document(root, &page_sink, &page);
+            perf_stop(&perf, &samples[3]);
+            sink_shutdown(&page_sink);
+        } else {
+            mem_set(&samples[3], 0, sizeof(perf_sample_t));
+        }
+
+        perf_print("load", &samples[0], tokenizer.source_size, 0);
+        perf_print("tokenize", &samples[1], tokenizer.source_size, 0);
+        perf_print("parse", &samples[2], tokenizer.source_size, pool.count);
+        perf_print("render", &samples[3], tokenizer.source_size, pool.count);
+        perf_shutdown(&perf);
+    }
+
+    // Render the same tree with every sink mode, then every other backend
+    const renderer_t* html = renderer_get(FORMAT_HTML);
+    const renderer_t* text = renderer_get(FORMAT_TEXT);
+    const renderer_t* json = renderer_get(FORMAT_JSON);
+    b8 ok = bench_render(root, html, cfg->output_file, SINK_BUFFERED, cfg->bench_iterations, tokenizer.source_size) &&
+            bench_render(root, html, cfg->output_file, SINK_GATHER, cfg->bench_iterations, tokenizer.source_size) &&
+            bench_render(root, text, cfg->output_file, SINK_BUFFERED, cfg->bench_iterations, tokenizer.source_size) &&
+            bench_render(root, json, cfg->output_file, SINK_BUFFERED, cfg->bench_iterations, tokenizer.source_size) &&
+            bench_edit(&tokenizer, cfg->bench_iterations) &&
+            bench_cache(&tokenizer, root, cfg->output_file, cfg->bench_iterations) &&
+            bench_nesting(cfg->bench_iterations) &&
+            bench_tokenize(&tokenizer, cfg->bench_iterations) &&
+            bench_parallel(root, &tokenizer, cfg->threads, cfg->bench_iterations);
+
+    link_table_shutdown(&links);
+    node_pool_shutdown(&pool);
+    tokenizer_shutdown(&tokenizer);
+
+    return ok ? 0 : -1;
+}
+
+static b8 bench_render(node_t* root, const renderer_t* r, const char* out_file, sink_mode_t mode, u32 iterations, u64 source_size) {
+    u64 total_ns = 0;
+    u64 bytes = 0;
+    u64 calls = 0;
+
+    for (u32 i = 0; i < iterations; ++i) {
+        FILE* file = fopen(out_file, "wb");
+        if (!file) {
+            fprintf(stderr, "Couldn't open file for writing: %s\n", out_file);
+            return false;
+        }
+
+        u64 start = platform_time_ns();
+
+        sink_t sink;
+        if (!sink_init(&sink, mode, file)) {
+            fclose(file);
+            return false;
+        }
+        r->write_node(root, &sink);
+        sink_shutdown(&sink);
+        fflush(file);
+
+        total_ns += platform_time_ns() - start;
+        bytes = sink.bytes_written;
+        calls = sink.write_calls;
+
+        fclose(file);
+    }
+
+    f64 per_iteration = iterations ? (f64)total_ns / iterations : 0.0;
+    printf("  render (%s, %s): %10.3f ms/iter, %8.2f MB/s in, %llu bytes out, %llu write calls\n",
+        r->name,
+        sink_mode_str(mode),
+        per_iteration / 1e6,
+        per_iteration > 0.0 ? (source_size / 1e6) / (per_iteration / 1e9) : 0.0,
+        bytes,
+        calls);
+
+    return true;
+}
+
+static b8 bench_edit(tokenizer_t* t, u32 iterations) {
+    u64 start = platform_time_ns();
+
+    document_t document;
+    if (!document_init(&document, t->source, t->source_size)) {
+        return false;
+    }
+    u64 built = platform_time_ns();
+
+    // Type and delete a character in the middle of the document
+    u64 offset = document.size / 2;
+    u64 edit_ns = 0;
+    u64 reparsed = 0;
+    for (u32 i = 0; i < iterations; ++i) {
+        document_change_t change;
+
+        u64 edit_start = platform_time_ns();
+        b8 ok = (i % 2 == 0) ?
+            document_edit(&document, offset, offset, "x", 1, &change) :
+            document_edit(&document, offset, offset + 1, "", 0, &change);
+        edit_ns += platform_time_ns() - edit_start;
+
+        if (!ok) {
+            document_shutdown(&document);
+            return false;
+        }
+        reparsed += change.inserted_count;
+    }
+
+    printf("  document: %10.3f ms to build %llu blocks, %10.3f us/edit, %.2f blocks re-parsed/edit\n",
+        (built - start) / 1e6,
+        document.block_count,
+        iterations ? (edit_ns / 1e3) / iterations : 0.0,
+        iterations ? (f64)reparsed / iterations : 0.0);
+
+    document_shutdown(&document);
+
+    return true;
+}
+
+static b8 bench_cache(tokenizer_t* t, node_t* root, const char* out_file, u32 iterations) {
+    // Next to the output, so the bench doesn't leave files by the input
+    char path[IO_PATH_MAX];
+    if (str_len(out_file) + 5 > sizeof(path)) {
+        return false;
+    }
+    str_cpy(path, out_file);
+    str_cat(path, ".mdc");
+
+    u64 start = platform_time_ns();
+    if (!cache_save(path, root, t->source, t->source_size)) {
+        fprintf(stderr, "Couldn't write cache: %s\n", path);
+        return false;
+    }
+    u64 saved = platform_time_ns();
+
+    node_pool_t pool;
+    node_pool_init(&pool);
+
+    u64 load_ns = 0;
+    b8 ok = true;
+    for (u32 i = 0; i < iterations && ok; ++i) {
+        u64 load_start = platform_time_ns();
+        node_pool_reset(&pool);
+        ok = cache_load(path, t->source, t->source_size, &pool) != nullptr;
+        load_ns += platform_time_ns() - load_start;
+    }
+
+    if (ok) {
+        printf("  cache:    %10.3f ms to save, %10.3f ms/load, %llu nodes\n",
+            (saved - start) / 1e6,
+            iterations ? (load_ns / 1e6) / iterations : 0.0,
+            pool.count);
+    } else {
+        fprintf(stderr, "Couldn't load cache: %s\n", path);
+    }
+
+    node_pool_shutdown(&pool);
+    remove(path);
+
+    return ok;
+}
+
+static b8 bench_nesting(u32 iterations) {
+    // Synthetic corpora that keep the container stack deep
+    static const char* names[] = { "lists", "quotes", "mixed" };
+
+    char* source = malloc(BENCH_NESTING_SIZE + 1);
+    if (source == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for source.\n");
+        return false;
+    }
+
+    tokenizer_t tokenizer;
+    if (!tokenizer_init_source(&tokenizer, source, 0)) {
+        free(source);
+        return false;
+    }
+
+    node_pool_t pool;
+    node_pool_init(&pool);
+    link_table_t links;
+    link_table_init(&links);
+
+    for (u32 kind = 0; kind < 3; ++kind) {
+        u64 size = nesting_corpus(source, BENCH_NESTING_SIZE, kind);
+        u64 parse_ns = 0;
+
+        for (u32 i = 0; i < iterations; ++i) {
+            tokenizer_reset(&tokenizer, source, size);
+            while (next_token(&tokenizer));
+
+            u64 start = platform_time_ns();
+            node_pool_reset(&pool);
+            parse_md(&tokenizer, &pool, &links);
+            parse_ns += platform_time_ns() - start;
+        }
+
+        f64 per_iteration = iterations ? (f64)parse_ns / iterations : 0.0;
+        printf("  nesting (%s): %10.3f ms/iter, %8.2f MB/s, %llu tokens, %llu nodes\n",
+            names[kind],
+            per_iteration / 1e6,
+            per_iteration > 0.0 ? (size / 1e6) / (per_iteration / 1e9) : 0.0,
+            tokenizer.token_array.count,
+            pool.count);
+    }
+
+    link_table_shutdown(&links);
+    node_pool_shutdown(&pool);
+    tokenizer_shutdown(&tokenizer);
+
+    return true;
+}
+
+static u64 nesting_corpus(char* out, u64 size, u32 kind) {
+    // Staircases down to BENCH_NESTING_DEPTH and back, until `size` is full
+    u64 length = 0;
+    u64 line_max = BENCH_NESTING_DEPTH * 4 + 64;
+    u64 staircase_max = line_max * BENCH_NESTING_DEPTH * 2 + 1;
+
+    while (length + staircase_max < size) {
+        for (u32 d = 0; d < BENCH_NESTING_DEPTH * 2; ++d) {
+            u32 level = d < BENCH_NESTING_DEPTH ? d : BENCH_NESTING_DEPTH * 2 - 1 - d;
+
+            for (u32 l = 0; l < level; ++l) {
+                switch (kind) {
+                    // Nested list items
+                    case 0: length += sprintf(out + length, "  "); break;
+                    // Nested quotes
+                    case 1: length += sprintf(out + length, "> "); break;
+                    // Lists inside quotes inside lists
+                    default: length += sprintf(out + length, l % 2 ? "> " : "   "); break;
+                }
+            }
+
+            length += sprintf(out + length, kind == 1 ? "quoted *text* at %u\n" : "- item *text* at %u\n", level);
+        }
+        out[length++] = '\n';
+    }
+    out[length] = '\0';
+
+    return length;
+}
+
+static b8 bench_tokenize(tokenizer_t* input, u32 iterations) {
+    // Corpora heavy on the bytes whose type depends on context, the last
+    // one is nothing but those bytes in random order
+    static const char* names[] = { "lists", "emphasis", "brackets", "random" };
+
+    char* source = malloc(BENCH_TOKENIZE_SIZE + 1);
+    if (source == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for source.\n");
+        return false;
+    }
+
+    // Both tokenize the same buffers, the table one owns `source`
+    tokenizer_t table, reference;
+    if (!tokenizer_init_source(&table, source, 0)) {
+        free(source);
+        return false;
+    }
+    if (!tokenizer_init_source(&reference, source, 0)) {
+        tokenizer_shutdown(&table);
+        return false;
+    }
+
+    b8 ok = tokenize_compare(input->source, input->source_size, "input", &table, &reference, iterations);
+    for (u32 kind = 0; ok && kind < 4; ++kind) {
+        u64 size = branchy_corpus(source, BENCH_TOKENIZE_SIZE, kind);
+        ok = tokenize_compare(source, size, names[kind], &table, &reference, iterations);
+    }
+
+    reference.source = nullptr;
+    tokenizer_shutdown(&reference);
+    tokenizer_shutdown(&table);
+
+    return ok;
+}
+
+static b8 tokenize_compare(char* source, u64 size, const char* name, tokenizer_t* table, tokenizer_t* reference, u32 iterations) {
+    u64 table_ns = 0;
+    u64 reference_ns = 0;
+
+    // At least once, the comparison needs both token arrays
+    for (u32 i = 0; i < iterations || i == 0; ++i) {
+        u64 start = platform_time_ns();
+        tokenizer_reset(table, source, size);
+        while (next_token(table));
+        u64 tabled = platform_time_ns();
+
+        tokenizer_reset(reference, source, size);
+        while (reference_next_token(reference));
+        reference_ns += platform_time_ns() - tabled;
+        table_ns += tabled - start;
+    }
+
+    // Differential check: the same tokens, over the same bytes
+    token_array_t* a = &table->token_array;
+    token_array_t* b = &reference->token_array;
+    for (u64 i = 0; i < a->count || i < b->count; ++i) {
+        if (i < a->count && i < b->count &&
+            a->tokens[i].type == b->tokens[i].type &&
+            a->tokens[i].value.data == b->tokens[i].value.data &&
+            a->tokens[i].value.length == b->tokens[i].value.length) {
+            continue;
+        }
+
+        const token_t* at = i < a->count ? &a->tokens[i] : &b->tokens[i];
+        u64 line = 0, column = 0;
+        tokenizer_locate(table, at->value.data, &line, &column);
+        fprintf(stderr, "tokenize (%s): token %llu at %llu:%llu differs from the reference tokenizer\n",
+            name, i, line, column);
+        return false;
+    }
+
+    f64 per_iteration = iterations ? (f64)table_ns / iterations : 0.0;
+    f64 reference_per_iteration = iterations ? (f64)reference_ns / iterations : 0.0;
+    printf("  tokenize (%s): %10.3f ms/iter, %8.2f MB/s, %.2fx the switch, %llu tokens\n",
+        name,
+        per_iteration / 1e6,
+        per_iteration > 0.0 ? (size / 1e6) / (per_iteration / 1e9) : 0.0,
+        per_iteration > 0.0 ? reference_per_iteration / per_iteration : 0.0,
+        a->count);
+
+    return true;
+}
+
+static u64 branchy_corpus(char* out, u64 size, u32 kind) {
+    static const char* lines[][4] = {
+        {
+            "- item *one* and _two_ at %u\n",
+            "  + nested 1. item with [a](b) at %u\n",
+            "    - deeper > not a quote # not a header %u\n",
+            "1. numbered - item + text at %u.5\n",
+        },
+        {
+            "**bold** and _it_ and *a*b*c* at %u\n",
+            "__strong__ ***both*** _a_b_c_ x*y*z %u\n",
+            "* not a list* but ** emphasis ** %u\n",
+            "_*_*_*_ mixed * _ runs _ * at %u\n",
+        },
+        {
+            "[link](url) and ![image](src) at %u\n",
+            "[a]b(c) ](x) (y) [[z]] ((w)) at %u\n",
+            "![not] !image [x]!(y) ![](%u)\n",
+            "[one](two)(three) [four]](five) %u)\n",
+        },
+    };
+
+    u64 length = 0;
+    u64 line_max = 64;
+
+    if (kind < 3) {
+        for (u32 n = 0; length + line_max < size; ++n) {
+            length += sprintf(out + length, lines[kind][n % 4], n);
+        }
+    } else {
+        // The same sequence every run, so timings compare
+        static const char alphabet[] = "#-+*_[]()!> 1.a\n";
+        u32 seed = 0x2545F491u;
+        for (; length < size; ++length) {
+            seed = seed * 1664525u + 1013904223u;
+            out[length] = alphabet[(seed >> 24) % (sizeof(alphabet) - 1)];
+        }
+    }
+    out[length] = '\0';
+
+    return length;
+}
+
+// The tokenizer as it was before the transition table, a `switch` per
+// byte, kept to check the table against
+static b8 reference_next_token(tokenizer_t* t) {
+    if (*t->cursor == '\0' || (t->cursor - t->source) >= (i64)t->source_size) {
+        flush_token(t);
+        return false;
+    }
+
+    if (*t->cursor == '\t') {
+        t->cursor++;
+        if ((t->cursor - t->source) >= (i64)t->source_size) {
+            flush_token(t);
+            return false;
+        }
+    }
+
+    token_type_t type = reference_char_to_token(*t->cursor, t);
+    if (type != t->current_type && t->current_type != TOKEN_NONE) {
+        flush_token(t);
+    }
+    if (t->current_type == TOKEN_NONE) {
+        t->current_type = type;
+        t->start = t->cursor;
+        t->current_length = 0;
+    }
+
+    t->current_length++;
+    t->cursor++;
+
+    while ((t->cursor - t->source) < (i64)t->source_size && reference_char_to_token(*t->cursor, t) == type) {
+        t->current_length++;
+        t->cursor++;
+    }
+
+    if (type == TOKEN_PAREN_OPEN || type == TOKEN_SQBR_OPEN) {
+        t->open_type = type;
+    } else if (type == TOKEN_PAREN_CLOSE || type == TOKEN_SQBR_CLOSE) {
+        t->open_type = TOKEN_NONE;
+    }
+    if (type == TOKEN_LINEBREAK) {
+        t->open_type = TOKEN_NONE;
+    }
+
+    t->line_start = type == TOKEN_LINEBREAK ||
+        (t->line_start && (type == TOKEN_WHITESPACE ||
+                           type == TOKEN_BLOCKQUOTE ||
+                           type == TOKEN_LIST));
+    t->previous_type = type;
+
+    return true;
+}
+
+static token_type_t reference_char_to_token(char c, tokenizer_t* t) {
+    switch (c) {
+        case '\n':
+            return TOKEN_LINEBREAK;
+
+        case '#':
+            return t->line_start ? TOKEN_HEADER : TOKEN_TEXT;
+
+        case '-':
+        case '+':
+            return t->line_start ? TOKEN_LIST : TOKEN_TEXT;
+
+        case '*':
+        case '_':
+            return TOKEN_EMPHASIS;
+
+        case '[':
+            return TOKEN_SQBR_OPEN;
+        case ']': {
+            t->open_type = TOKEN_SQBR_CLOSE;
+            return TOKEN_SQBR_CLOSE;
+        }
+
+        case '(': {
+            if (t->previous_type == TOKEN_SQBR_CLOSE) {
+                t->open_type = TOKEN_PAREN_OPEN;
+                return TOKEN_PAREN_OPEN;
+            }
+            return TOKEN_TEXT;
+        }
+
+        case ')': {
+            if (t->open_type == TOKEN_PAREN_OPEN) {
+                return TOKEN_PAREN_CLOSE;
+            }
+            return TOKEN_TEXT;
+        }
+
+        case '!': {
+            if (((t->cursor + 1) - t->source) <= (i64)t->source_size && *(t->cursor + 1) == '[') {
+                return TOKEN_EXCLAMATION;
+            }
+            return TOKEN_TEXT;
+        }
+
+        case '>':
+            return t->line_start ? TOKEN_BLOCKQUOTE : TOKEN_TEXT;
+
+        case ' ':
+            return (t->previous_type != TOKEN_TEXT) ? TOKEN_WHITESPACE : TOKEN_TEXT;
+
+        default:
+            if ((is_char_digit(c) || c == '.') && t->line_start) {
+                return TOKEN_NUMERICAL;
+            }
+            return TOKEN_TEXT;
+    }
+}
+
+static b8 bench_parallel(node_t* root, tokenizer_t* t, u32 threads, u32 iterations) {
+    page_t page = { "Bench", nullptr, nullptr };
+
+    // The serial page is what every thread count has to match
+    sink_t serial, out;
+    if (!sink_init_memory(&serial)) {
+        return false;
+    }
+    if (!sink_init_memory(&out)) {
+        sink_shutdown(&serial);
+        return false;
+    }
+    html_write_document(root, &serial, &page);
+
+    // Powers of two up to twice the cores (or --threads), to see past them
+    u32 most = threads ? threads : platform_core_count() * 2;
+    if (most < 4) most = 4;
+
+    b8 ok = !serial.failed;
+    f64 base = 0.0;
+    for (u32 n = 1; ok && n <= most; n *= 2) {
+        u64 total_ns = 0;
+        for (u32 i = 0; i < iterations || i == 0; ++i) {
+            sink_reset(&out, nullptr);
+
+            u64 start = platform_time_ns();
+            parallel_write_html(root, t->source, t->source_size, &out, &page, n);
+            total_ns += platform_time_ns() - start;
+        }
+
+        if (out.failed || out.length != serial.length || !mem_equal(out.buffer, serial.buffer, serial.length)) {
+            fprintf(stderr, "render (html, %u threads): output differs from the serial render\n", n);
+            ok = false;
+            break;
+        }
+
+        f64 per_iteration = (f64)total_ns / (iterations ? iterations : 1);
+        if (n == 1) base = per_iteration;
+        printf("  render (html, %2u threads): %10.3f ms/iter, %8.2f MB/s in, %.2fx\n",
+            n,
+            per_iteration / 1e6,
+            per_iteration > 0.0 ? (t->source_size / 1e6) / (per_iteration / 1e9) : 0.0,
+            per_iteration > 0.0 ? base / per_iteration : 0.0);
+    }
+
+    sink_shutdown(&out);
+    sink_shutdown(&serial);
+
+    return ok;
+}
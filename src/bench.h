@@ -0,0 +1,7 @@
+#pragma once
+
+#include "types.h"
+#include "args.h"
+
+// Runs the pipeline on the configured input and reports timings.
+i32 run_bench(config_t* cfg);
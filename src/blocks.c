@@ -0,0 +1,223 @@
+#include "blocks.h"
+
+#include "lib/mem.h"
+
+#include <stdlib.h>
+
+#define BLOCK_CACHE_MIN_BUCKETS 256
+
+static block_entry_t* block_cache_find(block_cache_t* c, u64 hash, const char* key, u64 length);
+static void block_cache_unlink(block_cache_t* c, block_entry_t* e);
+static void block_cache_push(block_cache_t* c, block_entry_t* e);
+static void block_cache_evict(block_cache_t* c);
+static void block_cache_grow(block_cache_t* c);
+static u64 block_load(const char* data);
+static u64 block_mix(u64 hash, u64 word);
+
+b8 block_cache_init(block_cache_t* c, u64 max_bytes) {
+    mem_set(c, 0, sizeof(block_cache_t));
+    c->max_bytes = max_bytes;
+
+    c->buckets = calloc(BLOCK_CACHE_MIN_BUCKETS, sizeof(block_entry_t*));
+    if (c->buckets == nullptr) {
+        return false;
+    }
+    c->bucket_count = BLOCK_CACHE_MIN_BUCKETS;
+
+    if (!mutex_create(&c->lock)) {
+        free(c->buckets);
+        return false;
+    }
+
+    return true;
+}
+
+void block_cache_shutdown(block_cache_t* c) {
+    block_entry_t* e = c->newest;
+    while (e) {
+        block_entry_t* older = e->older;
+        free(e);
+        e = older;
+    }
+    free(c->buckets);
+    mutex_destroy(&c->lock);
+
+    c->buckets = nullptr;
+    c->newest = nullptr;
+    c->oldest = nullptr;
+}
+
+u64 block_cache_hash(const char* data, u64 length, u64 seed) {
+    // Eight bytes at a time: fold each word in with a multiply, and
+    // finish with a full avalanche so the low bits pick good buckets
+    u64 hash = seed ^ (length * 0x9e3779b97f4a7c15ULL);
+
+    u64 i = 0;
+    for (; i + 8 <= length; i += 8) {
+        hash = block_mix(hash, block_load(data + i));
+    }
+
+    u64 tail = 0;
+    for (u64 shift = 0; i < length; ++i, shift += 8) {
+        tail |= (u64)(u8)data[i] << shift;
+    }
+    hash = block_mix(hash, tail);
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+b8 block_cache_get(block_cache_t* c, u64 hash, const char* key, u64 length, sink_t* out) {
+    mutex_lock(&c->lock);
+
+    block_entry_t* e = block_cache_find(c, hash, key, length);
+    if (e) {
+        block_cache_unlink(c, e);
+        block_cache_push(c, e);
+        c->stats.hits++;
+
+        // Copied while it's locked, another context could evict it next
+        sink_copy(out, e->data + e->key_length, e->html_length);
+    } else {
+        c->stats.misses++;
+    }
+
+    mutex_unlock(&c->lock);
+
+    return e != nullptr;
+}
+
+void block_cache_put(block_cache_t* c, u64 hash, const char* key, u64 length, const char* html, u64 html_length) {
+    u64 size = sizeof(block_entry_t) + length + html_length;
+    if (size > c->max_bytes) {
+        return;
+    }
+
+    block_entry_t* e = malloc(size);
+    if (e == nullptr) {
+        return;
+    }
+    e->hash = hash;
+    e->key_length = length;
+    e->html_length = html_length;
+    mem_copy(e->data, (void*)key, length);
+    mem_copy(e->data + length, (void*)html, html_length);
+
+    mutex_lock(&c->lock);
+
+    // Another context may have rendered the same block meanwhile
+    if (block_cache_find(c, hash, key, length)) {
+        mutex_unlock(&c->lock);
+        free(e);
+        return;
+    }
+
+    while (c->oldest && c->stats.bytes + size > c->max_bytes) {
+        block_cache_evict(c);
+    }
+
+    u64 bucket = hash & (c->bucket_count - 1);
+    e->bucket_next = c->buckets[bucket];
+    c->buckets[bucket] = e;
+    block_cache_push(c, e);
+    c->count++;
+    c->stats.bytes += size;
+    c->stats.stored++;
+
+    // Keep chains about one entry long
+    if (c->count > c->bucket_count) {
+        block_cache_grow(c);
+    }
+
+    mutex_unlock(&c->lock);
+}
+
+block_cache_stats_t block_cache_stats(block_cache_t* c) {
+    mutex_lock(&c->lock);
+    block_cache_stats_t stats = c->stats;
+    mutex_unlock(&c->lock);
+
+    return stats;
+}
+
+f64 block_cache_hit_rate(const block_cache_stats_t* s) {
+    u64 lookups = s->hits + s->misses;
+    return lookups ? 100.0 * s->hits / lookups : 0.0;
+}
+
+static block_entry_t* block_cache_find(block_cache_t* c, u64 hash, const char* key, u64 length) {
+    // The source is compared too, a hash collision mustn't render the wrong block
+    for (block_entry_t* e = c->buckets[hash & (c->bucket_count - 1)]; e; e = e->bucket_next) {
+        if (e->hash == hash && e->key_length == length && mem_equal(e->data, key, length)) {
+            return e;
+        }
+    }
+
+    return nullptr;
+}
+
+static void block_cache_unlink(block_cache_t* c, block_entry_t* e) {
+    if (e->newer) e->newer->older = e->older;
+    else c->newest = e->older;
+
+    if (e->older) e->older->newer = e->newer;
+    else c->oldest = e->newer;
+}
+
+static void block_cache_push(block_cache_t* c, block_entry_t* e) {
+    e->newer = nullptr;
+    e->older = c->newest;
+    if (c->newest) c->newest->newer = e;
+    c->newest = e;
+    if (c->oldest == nullptr) c->oldest = e;
+}
+
+static void block_cache_evict(block_cache_t* c) {
+    block_entry_t* e = c->oldest;
+    block_cache_unlink(c, e);
+
+    block_entry_t** link = &c->buckets[e->hash & (c->bucket_count - 1)];
+    while (*link != e) link = &(*link)->bucket_next;
+    *link = e->bucket_next;
+
+    c->count--;
+    c->stats.bytes -= sizeof(block_entry_t) + e->key_length + e->html_length;
+    c->stats.evicted++;
+    free(e);
+}
+
+static void block_cache_grow(block_cache_t* c) {
+    // A failed grow only makes the chains longer
+    u64 count = c->bucket_count * 2;
+    block_entry_t** buckets = calloc(count, sizeof(block_entry_t*));
+    if (buckets == nullptr) {
+        return;
+    }
+
+    for (block_entry_t* e = c->newest; e; e = e->older) {
+        u64 bucket = e->hash & (count - 1);
+        e->bucket_next = buckets[bucket];
+        buckets[bucket] = e;
+    }
+
+    free(c->buckets);
+    c->buckets = buckets;
+    c->bucket_count = count;
+}
+
+static u64 block_load(const char* data) {
+    // Little endian, compilers turn this into a single load
+    const u8* p = (const u8*)data;
+    return (u64)p[0] | (u64)p[1] << 8 | (u64)p[2] << 16 | (u64)p[3] << 24 |
+           (u64)p[4] << 32 | (u64)p[5] << 40 | (u64)p[6] << 48 | (u64)p[7] << 56;
+}
+
+static u64 block_mix(u64 hash, u64 word) {
+    hash = (hash ^ word) * 0x87c37b91114253d5ULL;
+    return hash ^ (hash >> 29);
+}
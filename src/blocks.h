@@ -0,0 +1,71 @@
+#pragma once
+
+#include "types.h"
+#include "platform.h"
+#include "sink.h"
+
+// Rendered HTML of top-level blocks (see document.h), keyed on the
+// block's source bytes, kept across documents so boilerplate that
+// repeats between pages (license footers, notices) is tokenized,
+// parsed and rendered once. Bounded by the bytes it holds, the least
+// recently used blocks go first. One cache can be shared by several
+// render contexts (daemon workers), it has its own lock.
+//
+// Only blocks that render the same wherever they are go in: no
+// headers (the table of contents needs them in the tree), no link
+// definitions and no references to one.
+
+#define BLOCK_CACHE_DEFAULT_MB 64
+
+typedef struct block_entry {
+    u64 hash;
+    struct block_entry* bucket_next;
+    // Least recently used list, newest first
+    struct block_entry* newer;
+    struct block_entry* older;
+
+    // The source bytes, then the HTML
+    u64 key_length;
+    u64 html_length;
+    char data[];
+} block_entry_t;
+
+typedef struct block_cache_stats {
+    u64 hits;
+    u64 misses;
+    u64 stored;
+    u64 evicted;
+    u64 bytes;
+} block_cache_stats_t;
+
+typedef struct block_cache {
+    // Chained, power of two bucket count
+    block_entry_t** buckets;
+    u64 bucket_count;
+    u64 count;
+
+    block_entry_t* newest;
+    block_entry_t* oldest;
+    u64 max_bytes;
+
+    mutex_t lock;
+    block_cache_stats_t stats;
+} block_cache_t;
+
+b8 block_cache_init(block_cache_t* c, u64 max_bytes);
+void block_cache_shutdown(block_cache_t* c);
+
+// Hash of a block's source. `seed` stands for the render options.
+u64 block_cache_hash(const char* data, u64 length, u64 seed);
+
+// Appends the block's HTML to `out` and returns true if it's cached.
+b8 block_cache_get(block_cache_t* c, u64 hash, const char* key, u64 length, sink_t* out);
+
+// Adds a block, evicting the least recently used ones to make room.
+// Blocks bigger than the whole cache are left out.
+void block_cache_put(block_cache_t* c, u64 hash, const char* key, u64 length, const char* html, u64 html_length);
+
+block_cache_stats_t block_cache_stats(block_cache_t* c);
+
+// Percentage of blocks found in the cache, 0 if none were looked up.
+f64 block_cache_hit_rate(const block_cache_stats_t* s);
@@ -0,0 +1,331 @@
+#include "book.h"
+
+#include "render.h"
+#include "html.h"
+#include "links.h"
+#include "platform.h"
+#include "lib/mem.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct chapter {
+    const char* path;
+    // Both live until the page is written, the tree points into them
+    char* source;
+    node_pool_t pool;
+    node_t* root;
+
+    // The rendered chapter, a memory sink
+    sink_t out;
+    b8 failed;
+} chapter_t;
+
+typedef struct book {
+    chapter_t* chapters;
+    u32 count;
+    const renderer_t* renderer;
+
+    // Next chapter to hand out in the current phase
+    mutex_t lock;
+    u32 next;
+
+    // Anchors given to the headers, freed with the book
+    char** anchors;
+    u64 anchor_count;
+    u64 anchor_capacity;
+} book_t;
+
+typedef struct book_worker {
+    book_t* book;
+    render_context_t ctx;
+    thread_t thread;
+} book_worker_t;
+
+static void book_run_phase(book_t* b, book_worker_t* workers, u32 count, thread_fn fn);
+static chapter_t* book_claim(book_t* b);
+static u32 book_parse_worker(void* arg);
+static u32 book_render_worker(void* arg);
+static b8 book_anchor_headers(book_t* b, node_t* node, link_table_t* used);
+static b8 book_keep_anchor(book_t* b, char* anchor);
+static void book_write_content(sink_t* sink, void* arg);
+static void book_shutdown(book_t* b, book_worker_t* workers, u32 worker_count);
+
+i32 run_book(config_t* cfg) {
+    if (cfg->output_format != FORMAT_HTML) {
+        fprintf(stderr, "Book mode only writes HTML.\n");
+        return -1;
+    }
+
+    page_t page;
+    template_t template;
+    if (!page_init(&page, &template, cfg->title, cfg->css, cfg->template_file)) {
+        return -1;
+    }
+
+    book_t b;
+    mem_set(&b, 0, sizeof(book_t));
+    b.count = cfg->input_count;
+    b.renderer = renderer_get(cfg->output_format);
+
+    u32 worker_count = cfg->threads ? cfg->threads : platform_core_count();
+    if (worker_count > b.count) worker_count = b.count;
+
+    b.chapters = calloc(b.count, sizeof(chapter_t));
+    book_worker_t* workers = calloc(worker_count, sizeof(book_worker_t));
+    if (b.chapters == nullptr || workers == nullptr || !mutex_create(&b.lock)) {
+        fprintf(stderr, "Failed to allocate memory for the book.\n");
+        free(b.chapters);
+        free(workers);
+        template_shutdown(&template);
+        return -1;
+    }
+
+    b8 ok = true;
+    for (u32 i = 0; i < b.count; ++i) {
+        chapter_t* c = &b.chapters[i];
+        c->path = cfg->inputs[i];
+        node_pool_init(&c->pool);
+        ok = ok && sink_init_memory(&c->out);
+    }
+
+    u32 started = 0;
+    for (; ok && started < worker_count; ++started) {
+        workers[started].book = &b;
+        if (!render_context_init(&workers[started].ctx, SINK_BUFFERED)) break;
+    }
+    if (started == 0) ok = false;
+
+    u64 start = platform_time_ns();
+
+    // Parse every chapter, then hand out the anchors in chapter order
+    // (the only part that has to see the chapters one after another),
+    // then render every chapter into its own buffer
+    link_table_t used;
+    link_table_init(&used);
+    if (ok) {
+        book_run_phase(&b, workers, started, book_parse_worker);
+
+        for (u32 i = 0; i < b.count; ++i) {
+            chapter_t* c = &b.chapters[i];
+            if (c->failed) {
+                fprintf(stderr, "Failed to render: %s\n", c->path);
+                ok = false;
+            } else if (!book_anchor_headers(&b, c->root, &used)) {
+                fprintf(stderr, "Failed to allocate memory for anchors.\n");
+                ok = false;
+            }
+        }
+    }
+    if (ok) {
+        book_run_phase(&b, workers, started, book_render_worker);
+
+        for (u32 i = 0; i < b.count; ++i) {
+            if (b.chapters[i].failed) {
+                fprintf(stderr, "Failed to render: %s\n", b.chapters[i].path);
+                ok = false;
+            }
+        }
+    }
+    link_table_shutdown(&used);
+
+    // One page around all of it, the table of contents walks every chapter
+    if (ok) {
+        node_t root;
+        mem_set(&root, 0, sizeof(node_t));
+        root.type = NODE_ROOT;
+        for (u32 i = b.count; i > 0; --i) {
+            b.chapters[i - 1].root->next = root.children;
+            root.children = b.chapters[i - 1].root;
+        }
+
+        sink_t out;
+        ok = sink_init(&out, cfg->output_mode, nullptr);
+        if (ok && sink_open(&out, cfg->output_file, &cfg->gzip)) {
+            const template_t* t = page.template ? page.template : template_default();
+            template_write_with(t, &root, &out, page.title, page.css, book_write_content, &b);
+            ok = sink_close(&out);
+        } else {
+            ok = false;
+        }
+        sink_shutdown(&out);
+    }
+
+    if (ok) {
+        u64 elapsed = platform_time_ns() - start;
+        printf("Rendered %u chapters into %s in %.3f ms with %u threads\n",
+            b.count,
+            cfg->output_file,
+            elapsed / 1e6,
+            started);
+    }
+
+    book_shutdown(&b, workers, started);
+    template_shutdown(&template);
+
+    return ok ? 0 : -1;
+}
+
+static void book_run_phase(book_t* b, book_worker_t* workers, u32 count, thread_fn fn) {
+    b->next = 0;
+
+    u32 started = 0;
+    while (started < count && thread_create(fn, &workers[started], &workers[started].thread)) {
+        started++;
+    }
+
+    // Without threads the chapters are all done right here
+    if (started == 0) {
+        fn(&workers[0]);
+    }
+
+    for (u32 i = 0; i < started; ++i) {
+        thread_join(&workers[i].thread);
+    }
+}
+
+static chapter_t* book_claim(book_t* b) {
+    mutex_lock(&b->lock);
+    chapter_t* c = b->next < b->count ? &b->chapters[b->next++] : nullptr;
+    mutex_unlock(&b->lock);
+
+    return c;
+}
+
+static u32 book_parse_worker(void* arg) {
+    book_worker_t* w = arg;
+
+    for (chapter_t* c = book_claim(w->book); c; c = book_claim(w->book)) {
+        u64 capacity = 0;
+        i64 size = load_source(c->path, &c->source, &capacity);
+
+        if (size == -1) {
+            c->failed = true;
+            continue;
+        }
+
+        c->root = render_parse_into(&w->ctx, c->source, (u64)size, c->path, &c->pool);
+        c->failed = c->root == nullptr;
+    }
+
+    return 0;
+}
+
+static u32 book_render_worker(void* arg) {
+    book_worker_t* w = arg;
+
+    for (chapter_t* c = book_claim(w->book); c; c = book_claim(w->book)) {
+        w->book->renderer->write_node(c->root, &c->out);
+        c->failed = c->out.failed;
+    }
+
+    return 0;
+}
+
+static b8 book_anchor_headers(book_t* b, node_t* node, link_table_t* used) {
+    // The same walk as the table of contents, so both agree on the order
+    for (node_t* child = node->children; child; child = child->next) {
+        switch (child->type) {
+            case NODE_BLOCKQUOTE:
+            case NODE_ORDERED_LIST:
+            case NODE_UNORDERED_LIST:
+            case NODE_LIST_ITEM: {
+                if (!book_anchor_headers(b, child, used)) return false;
+            } break;
+
+            case NODE_HEADER: {
+                if (child->children == nullptr) break;
+
+                char* copy = nullptr;
+                str_view_t text = html_header_text(child, &copy);
+                char* base = slugifyn((char*)text.data, text.length);
+                if (base == text.data) {
+                    free(copy);
+                    return false;
+                }
+                free(copy);
+
+                // Empty slugs can't be told apart anyway, leave them be
+                u64 base_length = str_len(base);
+                if (base_length == 0) {
+                    free(base);
+                    break;
+                }
+
+                // The link table doubles as a set of the anchors taken so far
+                char* anchor = base;
+                u64 length = base_length;
+                for (u32 n = 1; link_table_find(used, string_view(anchor, length)) != nullptr; ++n) {
+                    if (anchor != base) free(anchor);
+                    anchor = malloc(base_length + 12);
+                    if (anchor == nullptr) {
+                        free(base);
+                        return false;
+                    }
+                    length = (u64)sprintf(anchor, "%s-%u", base, n);
+                }
+                if (anchor != base) free(base);
+
+                str_view_t none = string_view(nullptr, 0);
+                if (!book_keep_anchor(b, anchor) ||
+                    !link_table_define(used, string_view(anchor, length), none, none)) {
+                    return false;
+                }
+                child->value = string_view(anchor, length);
+            } break;
+
+            default: break;
+        }
+    }
+
+    return true;
+}
+
+static b8 book_keep_anchor(book_t* b, char* anchor) {
+    if (b->anchor_count == b->anchor_capacity) {
+        u64 capacity = b->anchor_capacity ? b->anchor_capacity * 2 : 64;
+        char** anchors = realloc(b->anchors, sizeof(char*) * capacity);
+        if (anchors == nullptr) {
+            free(anchor);
+            return false;
+        }
+        b->anchors = anchors;
+        b->anchor_capacity = capacity;
+    }
+
+    b->anchors[b->anchor_count++] = anchor;
+    return true;
+}
+
+static void book_write_content(sink_t* sink, void* arg) {
+    book_t* b = arg;
+
+    // The chapter buffers stay alive until the page is closed, so a
+    // gather sink references them instead of copying
+    for (u32 i = 0; i < b->count; ++i) {
+        sink_write(sink, b->chapters[i].out.buffer, b->chapters[i].out.length);
+    }
+}
+
+static void book_shutdown(book_t* b, book_worker_t* workers, u32 worker_count) {
+    for (u32 i = 0; i < worker_count; ++i) {
+        render_context_shutdown(&workers[i].ctx);
+    }
+    free(workers);
+
+    for (u32 i = 0; i < b->count; ++i) {
+        chapter_t* c = &b->chapters[i];
+        sink_shutdown(&c->out);
+        node_pool_shutdown(&c->pool);
+        free(c->source);
+    }
+    free(b->chapters);
+
+    for (u64 i = 0; i < b->anchor_count; ++i) {
+        free(b->anchors[i]);
+    }
+    free(b->anchors);
+
+    mutex_destroy(&b->lock);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "types.h"
+#include "args.h"
+
+// Renders every input, in order, as a chapter of one HTML page (`-o`).
+// Chapters are parsed and rendered on worker threads into buffers of
+// their own, then written inside the page in the order they were
+// given. Header anchors are unique across the whole book: a repeated
+// one gets `-1`, `-2`, ... in chapter order, so the output doesn't
+// depend on which worker finished first.
+i32 run_book(config_t* cfg);
@@ -0,0 +1,78 @@
+#include "budget.h"
+
+#include "platform.h"
+
+// Reading the clock costs more than everything else in a check, so
+// the deadline is only looked at every this many checks
+#define BUDGET_CLOCK_STRIDE 16
+
+static b8 budget_hit(budget_t* b, budget_status_t kind);
+
+void budget_init(budget_t* b) {
+    b->timeout_ns = 0;
+    b->max_tokens = 0;
+    b->max_nodes = 0;
+    b->max_output = 0;
+    b->partial = false;
+
+    b->deadline_ns = 0;
+    b->countdown = BUDGET_CLOCK_STRIDE;
+    b->status = BUDGET_OK;
+    b->hit = 0;
+}
+
+b8 budget_enabled(const budget_t* b) {
+    return b->timeout_ns > 0 || b->max_tokens > 0 || b->max_nodes > 0 || b->max_output > 0;
+}
+
+void budget_start(budget_t* b) {
+    b->deadline_ns = b->timeout_ns > 0 ? platform_time_ns() + b->timeout_ns : 0;
+    b->countdown = BUDGET_CLOCK_STRIDE;
+    b->status = BUDGET_OK;
+    b->hit = 0;
+}
+
+b8 budget_check(budget_t* b, budget_status_t kind, u64 used) {
+    if (b->hit & ((1u << kind) | (1u << BUDGET_DEADLINE))) {
+        return false;
+    }
+
+    u64 limit = 0;
+    switch (kind) {
+        case BUDGET_TOKENS: limit = b->max_tokens; break;
+        case BUDGET_NODES: limit = b->max_nodes; break;
+        case BUDGET_OUTPUT: limit = b->max_output; break;
+        default: break;
+    }
+    if (limit > 0 && used > limit) {
+        return budget_hit(b, kind);
+    }
+
+    if (b->deadline_ns > 0 && --b->countdown == 0) {
+        b->countdown = BUDGET_CLOCK_STRIDE;
+        if (platform_time_ns() > b->deadline_ns) {
+            return budget_hit(b, BUDGET_DEADLINE);
+        }
+    }
+
+    return true;
+}
+
+const char* budget_status_str(budget_status_t status) {
+    switch (status) {
+        case BUDGET_DEADLINE: return "deadline";
+        case BUDGET_TOKENS: return "token limit";
+        case BUDGET_NODES: return "node limit";
+        case BUDGET_OUTPUT: return "output limit";
+        default: return "ok";
+    }
+}
+
+static b8 budget_hit(budget_t* b, budget_status_t kind) {
+    if (b->status == BUDGET_OK) {
+        b->status = kind;
+    }
+    b->hit |= 1u << kind;
+
+    return false;
+}
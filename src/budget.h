@@ -0,0 +1,53 @@
+#pragma once
+
+#include "types.h"
+
+// Per-render limits, for input that can't be trusted to finish in
+// reasonable time (the daemon, user submitted documents). They're
+// checked once per line while tokenizing and parsing and once per
+// block while rendering HTML, so a render can run a line or a block
+// past a limit before it stops. Every limit left at 0 is off.
+
+// What the command line exits with when a limit stopped the render
+#define BUDGET_EXIT_CODE 2
+
+typedef enum {
+    BUDGET_OK,
+    BUDGET_DEADLINE,
+    BUDGET_TOKENS,
+    BUDGET_NODES,
+    BUDGET_OUTPUT
+} budget_status_t;
+
+typedef struct budget {
+    u64 timeout_ns;
+    u64 max_tokens;
+    u64 max_nodes;
+    // Bytes handed to the sink
+    u64 max_output;
+    // Keep what was rendered before a limit stopped it
+    b8 partial;
+
+    // Per render, set by budget_start
+    u64 deadline_ns;
+    u32 countdown;
+    // The first limit that was hit, and a bit for every one so far.
+    // A limit only stops the stages that check it (and the deadline
+    // stops all of them), so a tree a token limit cut short still renders.
+    budget_status_t status;
+    u32 hit;
+} budget_t;
+
+// All limits off.
+void budget_init(budget_t* b);
+b8 budget_enabled(const budget_t* b);
+
+// Starts a render, the deadline counts from here.
+void budget_start(budget_t* b);
+
+// Checks `used` against the limit for `kind` (tokens, nodes or output),
+// and the deadline every few calls. Returns false once over either,
+// and from then on for that kind.
+b8 budget_check(budget_t* b, budget_status_t kind, u64 used);
+
+const char* budget_status_str(budget_status_t status);
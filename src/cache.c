@@ -0,0 +1,241 @@
+#include "cache.h"
+
+#include "batch.h"
+#include "io.h"
+#include "platform.h"
+#include "lib/str.h"
+#include "lib/mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CACHE_EXTENSION ".mdc"
+#define CACHE_MAX_NODES 0xFFFFFFFFULL
+// Offset of a value that doesn't point anywhere
+#define CACHE_NO_VALUE 0xFFFFFFFFFFFFFFFFULL
+
+// Native byte order, the cache isn't meant to move between machines
+typedef struct cache_header {
+    char magic[4];
+    u32 version;
+    u64 node_count;
+    u64 source_size;
+    // Over the node array, the source is compared instead
+    u64 checksum;
+} cache_header_t;
+
+typedef struct cache_node {
+    u64 offset;
+    u64 length;
+    u32 type;
+    u32 depth;
+    // Indices into the node array. The root is 0, so 0 means none.
+    u32 next;
+    u32 children;
+    u32 last_child;
+    u32 reserved;
+} cache_node_t;
+
+static node_t* cache_build(const mapped_file_t* file, const char* source, u64 size, node_pool_t* pool);
+static u64 cache_checksum(const void* data, u64 size);
+
+b8 cache_path(const char* input, char* out, u64 size) {
+    return batch_output_path(input, CACHE_EXTENSION, out, size);
+}
+
+node_t* cache_load(const char* path, const char* source, u64 size, node_pool_t* pool) {
+    mapped_file_t file;
+    if (!platform_map_file(path, &file)) {
+        return nullptr;
+    }
+
+    // The tree points into `source`, so nothing outlives the mapping
+    node_t* root = cache_build(&file, source, size, pool);
+    platform_unmap_file(&file);
+
+    return root;
+}
+
+b8 cache_save(const char* path, node_t* root, const char* source, u64 size) {
+    u64 capacity = NODE_CHUNK_MIN;
+    u64 count = 1;
+    node_t** order = malloc(sizeof(node_t*) * capacity);
+    cache_node_t* nodes = malloc(sizeof(cache_node_t) * capacity);
+    if (order == nullptr || nodes == nullptr) {
+        goto fail;
+    }
+
+    // Breadth first, each node's children are queued as one run, so
+    // a sibling is always the next index
+    order[0] = root;
+    for (u64 i = 0; i < count; ++i) {
+        node_t* node = order[i];
+        cache_node_t* n = &nodes[i];
+
+        n->type = node->type;
+        n->depth = node->depth;
+        n->reserved = 0;
+
+        if (node->value.data == nullptr) {
+            n->offset = CACHE_NO_VALUE;
+            n->length = 0;
+        } else if (node->value.data >= source && node->value.length <= size - (u64)(node->value.data - source)) {
+            n->offset = node->value.data - source;
+            n->length = node->value.length;
+        } else {
+            // Text that isn't in the source can't be referenced
+            goto fail;
+        }
+
+        n->next = (i > 0 && node->next) ? (u32)(i + 1) : 0;
+        n->children = 0;
+        n->last_child = 0;
+
+        for (node_t* child = node->children; child; child = child->next) {
+            if (count == capacity) {
+                if (capacity * 2 > CACHE_MAX_NODES) goto fail;
+                capacity *= 2;
+
+                node_t** new_order = realloc(order, sizeof(node_t*) * capacity);
+                if (new_order == nullptr) goto fail;
+                order = new_order;
+
+                cache_node_t* new_nodes = realloc(nodes, sizeof(cache_node_t) * capacity);
+                if (new_nodes == nullptr) goto fail;
+                nodes = new_nodes;
+                n = &nodes[i];
+            }
+
+            if (n->children == 0) n->children = (u32)count;
+            n->last_child = (u32)count;
+            order[count++] = child;
+        }
+    }
+
+    cache_header_t header = {
+        .magic = { CACHE_MAGIC[0], CACHE_MAGIC[1], CACHE_MAGIC[2], CACHE_MAGIC[3] },
+        .version = CACHE_VERSION,
+        .node_count = count,
+        .source_size = size,
+        .checksum = cache_checksum(nodes, sizeof(cache_node_t) * count)
+    };
+
+    // Written next to the real one and moved over it, so a reader
+    // never maps a half written file
+    char temp_path[IO_PATH_MAX];
+    if (str_len(path) + 5 > sizeof(temp_path)) {
+        goto fail;
+    }
+    str_cpy(temp_path, path);
+    str_cat(temp_path, ".tmp");
+
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        goto fail;
+    }
+
+    b8 ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(nodes, sizeof(cache_node_t), count, file) == count &&
+        fwrite(source, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+    // rename doesn't replace an existing file here
+    if (ok) remove(path);
+#endif
+    if (!ok || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        goto fail;
+    }
+
+    free(order);
+    free(nodes);
+    return true;
+
+fail:
+    free(order);
+    free(nodes);
+    return false;
+}
+
+static node_t* cache_build(const mapped_file_t* file, const char* source, u64 size, node_pool_t* pool) {
+    if (file->size < sizeof(cache_header_t)) {
+        return nullptr;
+    }
+
+    // Mappings are page aligned, the header and nodes can be read in place
+    const cache_header_t* header = (const cache_header_t*)file->data;
+    if (!mem_equal(header->magic, CACHE_MAGIC, 4) || header->version != CACHE_VERSION) {
+        return nullptr;
+    }
+
+    u64 count = header->node_count;
+    if (count == 0 || count > CACHE_MAX_NODES || header->source_size != size) {
+        return nullptr;
+    }
+
+    u64 nodes_size = sizeof(cache_node_t) * count;
+    if (file->size != sizeof(cache_header_t) + nodes_size + size) {
+        return nullptr;
+    }
+
+    const cache_node_t* nodes = (const cache_node_t*)(header + 1);
+    if (cache_checksum(nodes, nodes_size) != header->checksum) {
+        return nullptr;
+    }
+
+    // Stale if the source changed since it was saved
+    if (!mem_equal((const char*)nodes + nodes_size, source, size)) {
+        return nullptr;
+    }
+
+    // Indices turn into pointers into one run of nodes
+    node_t* out = node_pool_alloc_array(pool, count);
+    if (out == nullptr) {
+        return nullptr;
+    }
+    for (u64 i = 0; i < count; ++i) {
+        const cache_node_t* n = &nodes[i];
+        node_t* node = &out[i];
+
+        // Links only ever point forward, so a damaged file can't make a loop
+        if (n->type > NODE_ROOT ||
+            (n->next != 0 && n->next != i + 1) ||
+            (n->children != 0 && (n->children <= i || n->last_child < n->children || n->last_child >= count)) ||
+            (n->children == 0 && n->last_child != 0)) {
+            return nullptr;
+        }
+
+        if (n->offset == CACHE_NO_VALUE) {
+            node->value = string_view(nullptr, 0);
+        } else if (n->offset <= size && n->length <= size - n->offset) {
+            node->value = string_view(source + n->offset, n->length);
+        } else {
+            return nullptr;
+        }
+
+        node->type = (node_type_t)n->type;
+        node->depth = (u8)n->depth;
+        node->next = n->next ? &out[n->next] : nullptr;
+        node->children = n->children ? &out[n->children] : nullptr;
+        node->last_child = n->children ? &out[n->last_child] : nullptr;
+    }
+
+    return out;
+}
+
+static u64 cache_checksum(const void* data, u64 size) {
+    // FNV-1a a word at a time, folded so high bits reach the low ones
+    const u8* bytes = data;
+    u64 hash = 14695981039346656037ULL;
+
+    for (u64 i = 0; i + 8 <= size; i += 8) {
+        u64 word;
+        mem_copy(&word, (void*)(bytes + i), 8);
+        hash ^= word;
+        hash *= 1099511628211ULL;
+        hash ^= hash >> 32;
+    }
+
+    return hash;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.h"
+#include "parser.h"
+
+// Parsed trees saved next to their source, so re-rendering an
+// unchanged document (another title, another css, another format)
+// skips tokenizing and parsing.
+//
+// The file is a header, the nodes in breadth-first order (so every
+// node's children sit next to each other) and a copy of the source.
+// Nodes refer to each other by index and to their text by offset
+// into the source, so the file is used as mapped, nothing in it
+// needs fixing up before it's read.
+
+#define CACHE_MAGIC "MDTC"
+#define CACHE_VERSION 1
+
+// Where the cache for `input` lives.
+b8 cache_path(const char* input, char* out, u64 size);
+
+// Builds the tree from the cache at `path` if it was made from exactly
+// `source`. Returns nullptr if it's missing, stale or damaged, and the
+// caller parses instead. The tree's text points into `source`.
+node_t* cache_load(const char* path, const char* source, u64 size, node_pool_t* pool);
+
+// Returns false (and leaves no file behind) if the tree can't be saved.
+b8 cache_save(const char* path, node_t* root, const char* source, u64 size);
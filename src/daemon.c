@@ -0,0 +1,826 @@
+#include "daemon.h"
+
+#include "admission.h"
+#include "render.h"
+#include "platform.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define DAEMON_MAX_CONNECTIONS 1024
+#define DAEMON_MAX_REQUEST (256 * 1024 * 1024)
+
+// Small requests a client sent back to back are served together: once
+// one is done, every complete one already waiting behind it on the
+// socket is too, up to DAEMON_BATCH_MAX, and they're answered with one
+// write
+#define DAEMON_BATCH_MAX 16
+#define DAEMON_BATCH_SMALL (16 * 1024)
+
+// A client that stops sending (or reading) halfway through a message
+// gets dropped after this long, so it can't hold on to a worker
+#define DAEMON_IO_TIMEOUT_MS 5000
+
+// Latency percentiles are computed over the most recent requests
+#define DAEMON_LATENCY_SAMPLES 8192
+
+typedef enum {
+    CONNECTION_FREE,
+    // Waiting for the next request, polled by the main thread
+    CONNECTION_IDLE,
+    // Has a request ready, owned by the queue or a worker
+    CONNECTION_BUSY
+} connection_state_t;
+
+typedef struct connection {
+    i32 fd;
+    connection_state_t state;
+    u64 ready_ns;
+} connection_t;
+
+typedef struct daemon {
+    i32 listen_fd;
+    i32 wake[2];
+    volatile b8 running;
+
+    connection_t connections[DAEMON_MAX_CONNECTIONS];
+
+    // With a template, replies are whole pages. Compiled once and
+    // only read by the workers.
+    page_t page;
+    template_t template;
+
+    // Rendered blocks every worker shares (--block-cache)
+    block_cache_t blocks;
+    b8 use_blocks;
+
+    // Requests wait for room under the memory budget (--memory-budget).
+    // A worker that rendered more than its share of it gives its
+    // buffers back, so what they keep stays under it too.
+    admission_t admit;
+    u64 worker_share;
+
+    // Connections with a pending request (ring buffer of indices)
+    u32 queue[DAEMON_MAX_CONNECTIONS];
+    u32 queue_head;
+    u32 queue_count;
+
+    mutex_t lock;
+    condvar_t ready;
+
+    // Stats, under their own lock
+    mutex_t stats_lock;
+    u64 latencies[DAEMON_LATENCY_SAMPLES];
+    u64 requests;
+    // Writes that answered more than one request, and those requests
+    u64 batches;
+    u64 batched;
+    u64 errors;
+    // Renders a limit stopped
+    u64 limited;
+    u64 bytes_in;
+    u64 bytes_out;
+    u64 start_ns;
+} daemon_t;
+
+typedef struct worker {
+    daemon_t* daemon;
+    render_context_t ctx;
+    sink_t out;
+    thread_t thread;
+
+    // The reply to the request just handled, if it got one, and the
+    // size of that request
+    b8 replied;
+    u8 status;
+    const char* reply;
+    u64 reply_length;
+    u32 length;
+    char stats[1024];
+
+    // Replies held back until the last request of a batch
+    sink_t replies;
+} worker_t;
+
+static volatile sig_atomic_t daemon_signaled = 0;
+
+static void daemon_on_signal(i32 signal);
+static u32 daemon_worker(void* arg);
+static b8 daemon_handle(worker_t* w, connection_t* c);
+static void daemon_reply(worker_t* w, u8 status, const char* data, u64 length);
+static b8 daemon_pending(i32 fd);
+static b8 daemon_stream(worker_t* w, i32 fd, u8 status, FILE* file, u64 length);
+static void daemon_release(daemon_t* d, connection_t* c, b8 keep);
+static void daemon_trim(worker_t* w);
+static void daemon_record(daemon_t* d, u64 latency_ns, u64 bytes_in, u64 bytes_out, b8 ok);
+static u64 daemon_stats(daemon_t* d, char* out, u64 size);
+static b8 read_full(i32 fd, void* data, u64 length, u64 deadline_ns);
+static b8 write_full(i32 fd, const void* data, u64 length);
+static u32 read_length(const u8* header);
+static void write_header(u8* header, u8 status, u64 length);
+static b8 write_replies(i32 fd, sink_t* held, worker_t* w);
+static i32 compare_u64(const void* a, const void* b);
+
+i32 run_daemon(config_t* cfg) {
+    daemon_t* d = calloc(1, sizeof(daemon_t));
+    if (d == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for the daemon.\n");
+        return -1;
+    }
+
+    if (!page_init(&d->page, &d->template, cfg->title, cfg->css, cfg->template_file)) {
+        free(d);
+        return -1;
+    }
+
+    d->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (d->listen_fd < 0) {
+        fprintf(stderr, "Failed to create socket.\n");
+        template_shutdown(&d->template);
+        free(d);
+        return -1;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (str_len(cfg->daemon_socket) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path is too long: %s\n", cfg->daemon_socket);
+        close(d->listen_fd);
+        template_shutdown(&d->template);
+        free(d);
+        return -1;
+    }
+    str_cpy(addr.sun_path, cfg->daemon_socket);
+
+    // A stale socket from a previous run would make bind fail
+    unlink(cfg->daemon_socket);
+    if (bind(d->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(d->listen_fd, 128) != 0) {
+        fprintf(stderr, "Couldn't listen on socket: %s\n", cfg->daemon_socket);
+        close(d->listen_fd);
+        template_shutdown(&d->template);
+        free(d);
+        return -1;
+    }
+
+    if (pipe(d->wake) != 0 || !mutex_create(&d->lock) || !mutex_create(&d->stats_lock) || !condvar_create(&d->ready) ||
+        !admission_init(&d->admit, (u64)cfg->memory_budget_mb * 1024 * 1024)) {
+        fprintf(stderr, "Failed to set up the daemon.\n");
+        close(d->listen_fd);
+        template_shutdown(&d->template);
+        free(d);
+        return -1;
+    }
+
+    // Requests with limits need the whole tree
+    d->use_blocks = cfg->block_cache_mb > 0 && cfg->output_format == FORMAT_HTML && !budget_enabled(&cfg->budget);
+    if (d->use_blocks && !block_cache_init(&d->blocks, (u64)cfg->block_cache_mb * 1024 * 1024)) {
+        d->use_blocks = false;
+    }
+    if (cfg->block_cache_mb > 0 && !d->use_blocks) {
+        fprintf(stderr, "Rendering without the block cache (HTML without limits only).\n");
+    }
+
+    signal(SIGINT, daemon_on_signal);
+    signal(SIGTERM, daemon_on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    d->running = true;
+    d->start_ns = platform_time_ns();
+
+    // Fixed pool of workers, each with its own render context
+    u32 worker_count = cfg->threads ? cfg->threads : platform_core_count();
+    worker_t* workers = calloc(worker_count, sizeof(worker_t));
+    u32 started = 0;
+    for (; workers && started < worker_count; ++started) {
+        worker_t* w = &workers[started];
+        w->daemon = d;
+        if (!render_context_init(&w->ctx, SINK_BUFFERED)) break;
+        w->ctx.renderer = renderer_get(cfg->output_format);
+        w->ctx.budget = cfg->budget;
+        if (!sink_init_memory(&w->out)) {
+            render_context_shutdown(&w->ctx);
+            break;
+        }
+        if (!sink_init_memory(&w->replies)) {
+            sink_shutdown(&w->out);
+            render_context_shutdown(&w->ctx);
+            break;
+        }
+        if (budget_enabled(&w->ctx.budget)) {
+            w->out.budget = &w->ctx.budget;
+        }
+        if (d->use_blocks && !render_context_use_blocks(&w->ctx, &d->blocks)) {
+            sink_shutdown(&w->replies);
+            sink_shutdown(&w->out);
+            render_context_shutdown(&w->ctx);
+            break;
+        }
+        if (!thread_create(daemon_worker, w, &w->thread)) {
+            sink_shutdown(&w->replies);
+            sink_shutdown(&w->out);
+            render_context_shutdown(&w->ctx);
+            break;
+        }
+    }
+
+    d->worker_share = started > 0 ? d->admit.budget / started : 0;
+    if (started > 0) {
+        printf("Listening on %s with %u workers (Ctrl+C to stop)\n", cfg->daemon_socket, started);
+    }
+
+    struct pollfd* fds = malloc(sizeof(struct pollfd) * (DAEMON_MAX_CONNECTIONS + 2));
+    u32* fd_connection = malloc(sizeof(u32) * (DAEMON_MAX_CONNECTIONS + 2));
+
+    while (started > 0 && fds && fd_connection && !daemon_signaled) {
+        // Listen socket, wake pipe and every idle connection
+        u32 fd_count = 0;
+        fds[fd_count++] = (struct pollfd){ .fd = d->listen_fd, .events = POLLIN };
+        fds[fd_count++] = (struct pollfd){ .fd = d->wake[0], .events = POLLIN };
+
+        mutex_lock(&d->lock);
+        for (u32 i = 0; i < DAEMON_MAX_CONNECTIONS; ++i) {
+            if (d->connections[i].state == CONNECTION_IDLE) {
+                fd_connection[fd_count] = i;
+                fds[fd_count++] = (struct pollfd){ .fd = d->connections[i].fd, .events = POLLIN };
+            }
+        }
+        mutex_unlock(&d->lock);
+
+        if (poll(fds, fd_count, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            i32 fd = accept(d->listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                struct timeval timeout = { DAEMON_IO_TIMEOUT_MS / 1000, (DAEMON_IO_TIMEOUT_MS % 1000) * 1000 };
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+                mutex_lock(&d->lock);
+                u32 slot = 0;
+                while (slot < DAEMON_MAX_CONNECTIONS && d->connections[slot].state != CONNECTION_FREE) slot++;
+                if (slot < DAEMON_MAX_CONNECTIONS) {
+                    d->connections[slot].fd = fd;
+                    d->connections[slot].state = CONNECTION_IDLE;
+                } else {
+                    close(fd);
+                }
+                mutex_unlock(&d->lock);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            // A worker handed a connection back, nothing else to do
+            char drain[64];
+            while (read(d->wake[0], drain, sizeof(drain)) == sizeof(drain));
+        }
+
+        // Hand readable connections to the workers
+        u64 now = platform_time_ns();
+        mutex_lock(&d->lock);
+        for (u32 i = 2; i < fd_count; ++i) {
+            if (fds[i].revents == 0) continue;
+
+            connection_t* c = &d->connections[fd_connection[i]];
+            c->state = CONNECTION_BUSY;
+            c->ready_ns = now;
+
+            d->queue[(d->queue_head + d->queue_count) % DAEMON_MAX_CONNECTIONS] = fd_connection[i];
+            d->queue_count++;
+            condvar_signal(&d->ready);
+        }
+        mutex_unlock(&d->lock);
+    }
+
+    // Shut down the workers
+    mutex_lock(&d->lock);
+    d->running = false;
+    condvar_broadcast(&d->ready);
+    mutex_unlock(&d->lock);
+
+    for (u32 i = 0; i < started; ++i) {
+        thread_join(&workers[i].thread);
+        sink_shutdown(&workers[i].replies);
+        sink_shutdown(&workers[i].out);
+        render_context_shutdown(&workers[i].ctx);
+    }
+
+    for (u32 i = 0; i < DAEMON_MAX_CONNECTIONS; ++i) {
+        if (d->connections[i].state != CONNECTION_FREE) close(d->connections[i].fd);
+    }
+    if (d->use_blocks) block_cache_shutdown(&d->blocks);
+
+    close(d->listen_fd);
+    close(d->wake[0]);
+    close(d->wake[1]);
+    unlink(cfg->daemon_socket);
+
+    admission_shutdown(&d->admit);
+    condvar_destroy(&d->ready);
+    mutex_destroy(&d->stats_lock);
+    mutex_destroy(&d->lock);
+
+    free(fd_connection);
+    free(fds);
+    free(workers);
+    template_shutdown(&d->template);
+    free(d);
+
+    return started > 0 ? 0 : -1;
+}
+
+static void daemon_on_signal(i32 signal) {
+    (void)signal;
+    daemon_signaled = 1;
+}
+
+static u32 daemon_worker(void* arg) {
+    worker_t* w = arg;
+    daemon_t* d = w->daemon;
+
+    for (;;) {
+        mutex_lock(&d->lock);
+        while (d->running && d->queue_count == 0) {
+            condvar_wait(&d->ready, &d->lock);
+        }
+        if (!d->running) {
+            mutex_unlock(&d->lock);
+            break;
+        }
+
+        // One connection at a time, the next one goes to whichever
+        // worker is free
+        connection_t* c = &d->connections[d->queue[d->queue_head]];
+        d->queue_head = (d->queue_head + 1) % DAEMON_MAX_CONNECTIONS;
+        d->queue_count--;
+        mutex_unlock(&d->lock);
+
+        // Small requests the client already sent behind this one go
+        // in the same batch, without waiting for more to arrive
+        sink_reset(&w->replies, nullptr);
+        u32 answered = 0;
+        b8 keep;
+        for (;;) {
+            keep = daemon_handle(w, c);
+            if (w->replied) answered++;
+            if (!keep || answered == DAEMON_BATCH_MAX || w->length > DAEMON_BATCH_SMALL || !daemon_pending(c->fd)) {
+                break;
+            }
+
+            // Held back, so the replies go out together and in order
+            u8 header[DAEMON_HEADER_SIZE];
+            write_header(header, w->status, w->reply_length);
+            sink_copy(&w->replies, (const char*)header, DAEMON_HEADER_SIZE);
+            sink_copy(&w->replies, w->reply, w->reply_length);
+            if (w->replies.failed) {
+                // Nothing can go out in order any more
+                w->replied = false;
+                keep = false;
+                break;
+            }
+            c->ready_ns = platform_time_ns();
+        }
+
+        if (!w->replies.failed && !write_replies(c->fd, &w->replies, w)) {
+            keep = false;
+            mutex_lock(&d->stats_lock);
+            d->errors++;
+            mutex_unlock(&d->stats_lock);
+        }
+        if (answered > 1) {
+            mutex_lock(&d->stats_lock);
+            d->batches++;
+            d->batched += answered;
+            mutex_unlock(&d->stats_lock);
+        }
+
+        daemon_release(d, c, keep);
+    }
+
+    return 0;
+}
+
+static b8 daemon_handle(worker_t* w, connection_t* c) {
+    daemon_t* d = w->daemon;
+    w->replied = false;
+    w->length = 0;
+
+    u8 header[DAEMON_HEADER_SIZE];
+    if (!read_full(c->fd, header, DAEMON_HEADER_SIZE, platform_time_ns() + DAEMON_IO_TIMEOUT_MS * 1000000ull)) {
+        // Client hung up
+        return false;
+    }
+    u32 length = read_length(header);
+    w->length = length;
+
+    b8 ok = false;
+    u64 bytes_out = 0;
+
+    switch (header[0]) {
+        case DAEMON_REQUEST_RENDER: {
+            if (length > DAEMON_MAX_REQUEST) {
+                daemon_reply(w, DAEMON_STATUS_ERROR, "request too large", 17);
+                daemon_record(d, platform_time_ns() - c->ready_ns, 0, 0, false);
+                return false;
+            }
+
+            // Charged to the budget before anything is allocated for it.
+            // One the budget can never fit waits until nothing else is
+            // running, and its output goes to a temporary file instead of
+            // memory.
+            u64 estimate = admission_estimate(length);
+            b8 alone = admission_alone(&d->admit, estimate);
+            admission_acquire(&d->admit, estimate);
+
+            // Read straight into the context's source buffer. A client
+            // that stalls halfway only has until the deadline to send the
+            // rest.
+            char* source = render_reserve(&w->ctx, length);
+            if (source == nullptr ||
+                !read_full(c->fd, source, length, platform_time_ns() + DAEMON_IO_TIMEOUT_MS * 1000000ull)) {
+                if (d->admit.budget > 0 && estimate > d->worker_share) {
+                    daemon_trim(w);
+                }
+                admission_release(&d->admit, estimate);
+                return false;
+            }
+
+            sink_t* out = &w->out;
+            FILE* spill = nullptr;
+            if (alone) {
+                spill = tmpfile();
+                out = &w->ctx.sink;
+                sink_reset(out, spill);
+                out->budget = w->out.budget;
+                out->failed = spill == nullptr;
+            } else {
+                sink_reset(out, nullptr);
+            }
+
+            if (out->failed) {
+                // No file to spill to
+            } else if (d->use_blocks) {
+                render_write_blocks(&w->ctx, source, length, nullptr, out, d->page.template ? &d->page : nullptr);
+            } else {
+                node_t* root = render_parse(&w->ctx, length);
+                if (root == nullptr) {
+                    out->failed = true;
+                } else if (d->page.template) {
+                    w->ctx.renderer->write_document(root, out, &d->page);
+                } else {
+                    w->ctx.renderer->write_node(root, out);
+                }
+            }
+            if (spill) {
+                sink_flush(out);
+            }
+
+            ok = !out->failed;
+            bytes_out = spill ? (u64)ftell(spill) : out->length;
+            u8 status = DAEMON_STATUS_OK;
+            const char* message = nullptr;
+            if (ok && w->ctx.budget.status != BUDGET_OK) {
+                // Whatever was rendered if that's wanted, otherwise which limit it was
+                status = DAEMON_STATUS_LIMIT;
+                if (!w->ctx.budget.partial) {
+                    message = budget_status_str(w->ctx.budget.status);
+                    bytes_out = str_len(message);
+                }
+
+                mutex_lock(&d->stats_lock);
+                d->limited++;
+                mutex_unlock(&d->stats_lock);
+            } else if (!ok) {
+                status = DAEMON_STATUS_ERROR;
+                message = "render failed";
+            }
+
+            if (message) {
+                daemon_reply(w, status, message, str_len(message));
+            } else if (spill) {
+                ok = daemon_stream(w, c->fd, status, spill, bytes_out);
+            } else {
+                daemon_reply(w, status, out->buffer, out->length);
+            }
+            if (spill) {
+                sink_reset(out, nullptr);
+                fclose(spill);
+            }
+
+            if (d->admit.budget > 0 && estimate > d->worker_share) {
+                daemon_trim(w);
+            }
+            admission_release(&d->admit, estimate);
+        } break;
+
+        case DAEMON_REQUEST_STATS: {
+            // The stream can't be trusted past a payload nobody reads
+            if (length != 0) {
+                daemon_reply(w, DAEMON_STATUS_ERROR, "unexpected payload", 18);
+                daemon_record(d, platform_time_ns() - c->ready_ns, 0, 0, false);
+                return false;
+            }
+
+            bytes_out = daemon_stats(d, w->stats, sizeof(w->stats));
+            daemon_reply(w, DAEMON_STATUS_OK, w->stats, bytes_out);
+            ok = true;
+        } break;
+
+        default: {
+            daemon_reply(w, DAEMON_STATUS_ERROR, "unknown request", 15);
+            daemon_record(d, platform_time_ns() - c->ready_ns, 0, 0, false);
+            return false;
+        }
+    }
+
+    daemon_record(d, platform_time_ns() - c->ready_ns, length, bytes_out, ok);
+
+    return ok;
+}
+
+static void daemon_reply(worker_t* w, u8 status, const char* data, u64 length) {
+    // Written by the worker, once it knows whether more are batched behind it
+    w->replied = true;
+    w->status = status;
+    w->reply = data;
+    w->reply_length = length;
+}
+
+static b8 daemon_stream(worker_t* w, i32 fd, u8 status, FILE* file, u64 length) {
+    // Replies held back for the batch go first, then this one straight
+    // from the file
+    if (!write_replies(fd, &w->replies, w)) {
+        return false;
+    }
+    sink_reset(&w->replies, nullptr);
+
+    u8 header[DAEMON_HEADER_SIZE];
+    write_header(header, status, length);
+    if (!write_full(fd, header, DAEMON_HEADER_SIZE)) {
+        return false;
+    }
+
+    char chunk[SINK_BUFFER_SIZE];
+    rewind(file);
+    while (length > 0) {
+        u64 got = fread(chunk, 1, length < sizeof(chunk) ? length : sizeof(chunk), file);
+        if (got == 0 || !write_full(fd, chunk, got)) {
+            return false;
+        }
+        length -= got;
+    }
+
+    return true;
+}
+
+static b8 daemon_pending(i32 fd) {
+    // A whole small request already waiting on the socket, looked at
+    // without reading or blocking
+    u8 header[DAEMON_HEADER_SIZE];
+    if (recv(fd, header, DAEMON_HEADER_SIZE, MSG_PEEK | MSG_DONTWAIT) != DAEMON_HEADER_SIZE) {
+        return false;
+    }
+
+    u32 length = read_length(header);
+    i32 available = 0;
+    return length <= DAEMON_BATCH_SMALL && ioctl(fd, FIONREAD, &available) == 0 &&
+           (u64)available >= DAEMON_HEADER_SIZE + length;
+}
+
+static void daemon_release(daemon_t* d, connection_t* c, b8 keep) {
+    mutex_lock(&d->lock);
+    if (keep) {
+        c->state = CONNECTION_IDLE;
+    } else {
+        close(c->fd);
+        c->state = CONNECTION_FREE;
+    }
+    mutex_unlock(&d->lock);
+
+    // Wake the main thread, so it polls the connection again
+    if (keep) {
+        char byte = 0;
+        if (write(d->wake[1], &byte, 1) < 0) {
+            fprintf(stderr, "Failed to wake the main thread.\n");
+        }
+    }
+}
+
+static void daemon_trim(worker_t* w) {
+    // Fresh buffers first, the worker keeps the old ones if there's no
+    // memory for them
+    render_context_t ctx;
+    sink_t out;
+    if (!render_context_init(&ctx, SINK_BUFFERED)) {
+        return;
+    }
+    if (!sink_init_memory(&out)) {
+        render_context_shutdown(&ctx);
+        return;
+    }
+    if (w->ctx.blocks && !render_context_use_blocks(&ctx, w->ctx.blocks)) {
+        sink_shutdown(&out);
+        render_context_shutdown(&ctx);
+        return;
+    }
+    ctx.renderer = w->ctx.renderer;
+    ctx.budget = w->ctx.budget;
+    // Points at the worker's context, which stays where it is
+    out.budget = w->out.budget;
+
+    sink_shutdown(&w->out);
+    render_context_shutdown(&w->ctx);
+    w->ctx = ctx;
+    w->out = out;
+}
+
+static void daemon_record(daemon_t* d, u64 latency_ns, u64 bytes_in, u64 bytes_out, b8 ok) {
+    mutex_lock(&d->stats_lock);
+    d->latencies[d->requests % DAEMON_LATENCY_SAMPLES] = latency_ns;
+    d->requests++;
+    d->bytes_in += bytes_in;
+    d->bytes_out += bytes_out;
+    if (!ok) d->errors++;
+    mutex_unlock(&d->stats_lock);
+}
+
+static u64 daemon_stats(daemon_t* d, char* out, u64 size) {
+    u64* sorted = malloc(sizeof(u64) * DAEMON_LATENCY_SAMPLES);
+    if (sorted == nullptr) {
+        return 0;
+    }
+
+    mutex_lock(&d->stats_lock);
+    u64 requests = d->requests;
+    u64 batches = d->batches;
+    u64 batched = d->batched;
+    u64 errors = d->errors;
+    u64 limited = d->limited;
+    u64 bytes_in = d->bytes_in;
+    u64 bytes_out = d->bytes_out;
+    u64 samples = requests < DAEMON_LATENCY_SAMPLES ? requests : DAEMON_LATENCY_SAMPLES;
+    for (u64 i = 0; i < samples; ++i) sorted[i] = d->latencies[i];
+    mutex_unlock(&d->stats_lock);
+
+    qsort(sorted, samples, sizeof(u64), compare_u64);
+    f64 p50 = samples ? sorted[(samples - 1) * 50 / 100] / 1e3 : 0.0;
+    f64 p99 = samples ? sorted[(samples - 1) * 99 / 100] / 1e3 : 0.0;
+    free(sorted);
+
+    f64 uptime = (platform_time_ns() - d->start_ns) / 1e9;
+
+    block_cache_stats_t blocks = { 0 };
+    if (d->use_blocks) blocks = block_cache_stats(&d->blocks);
+    admission_stats_t admitted = admission_stats(&d->admit);
+
+    i32 length = snprintf(out, size,
+        "requests %llu\n"
+        "batches %llu\n"
+        "batched %llu\n"
+        "errors %llu\n"
+        "limited %llu\n"
+        "bytes_in %llu\n"
+        "bytes_out %llu\n"
+        "uptime_s %.3f\n"
+        "requests_per_s %.1f\n"
+        "mb_in_per_s %.3f\n"
+        "latency_p50_us %.1f\n"
+        "latency_p99_us %.1f\n"
+        "block_hits %llu\n"
+        "block_misses %llu\n"
+        "block_hit_rate %.1f\n"
+        "block_bytes %llu\n"
+        "memory_waited %llu\n"
+        "memory_alone %llu\n"
+        "memory_peak %llu\n",
+        requests,
+        batches,
+        batched,
+        errors,
+        limited,
+        bytes_in,
+        bytes_out,
+        uptime,
+        uptime > 0.0 ? requests / uptime : 0.0,
+        uptime > 0.0 ? (bytes_in / 1e6) / uptime : 0.0,
+        p50,
+        p99,
+        blocks.hits,
+        blocks.misses,
+        block_cache_hit_rate(&blocks),
+        blocks.bytes,
+        admitted.waited,
+        admitted.alone,
+        admitted.peak);
+
+    return length < 0 ? 0 : ((u64)length < size ? (u64)length : size - 1);
+}
+
+static b8 read_full(i32 fd, void* data, u64 length, u64 deadline_ns) {
+    u8* cursor = data;
+    while (length > 0) {
+        // Each read is bounded by the receive timeout, the whole of it
+        // by the deadline
+        if (platform_time_ns() > deadline_ns) return false;
+
+        ssize_t got = read(fd, cursor, length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+
+        cursor += got;
+        length -= got;
+    }
+    return true;
+}
+
+static b8 write_full(i32 fd, const void* data, u64 length) {
+    const u8* cursor = data;
+    while (length > 0) {
+        ssize_t written = write(fd, cursor, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+
+        cursor += written;
+        length -= written;
+    }
+    return true;
+}
+
+static u32 read_length(const u8* header) {
+    return header[4] | (header[5] << 8) | (header[6] << 16) | ((u32)header[7] << 24);
+}
+
+static void write_header(u8* header, u8 status, u64 length) {
+    header[0] = status;
+    header[1] = header[2] = header[3] = 0;
+    header[4] = length & 0xff;
+    header[5] = (length >> 8) & 0xff;
+    header[6] = (length >> 16) & 0xff;
+    header[7] = (length >> 24) & 0xff;
+}
+
+static b8 write_replies(i32 fd, sink_t* held, worker_t* w) {
+    u8 header[DAEMON_HEADER_SIZE];
+    write_header(header, w->status, w->reply_length);
+
+    // The replies held back, then the last one's header and body, all
+    // in one go
+    struct iovec iov[3];
+    i32 count = 0;
+    if (held->length > 0) {
+        iov[count++] = (struct iovec){ .iov_base = held->buffer, .iov_len = held->length };
+    }
+    if (w->replied) {
+        iov[count++] = (struct iovec){ .iov_base = header, .iov_len = DAEMON_HEADER_SIZE };
+        iov[count++] = (struct iovec){ .iov_base = (void*)w->reply, .iov_len = w->reply_length };
+    }
+    struct iovec* cursor = iov;
+
+    while (count > 0) {
+        ssize_t written = writev(fd, cursor, count);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+
+        while (count > 0 && (u64)written >= cursor->iov_len) {
+            written -= cursor->iov_len;
+            cursor++;
+            count--;
+        }
+        if (count > 0) {
+            cursor->iov_base = (u8*)cursor->iov_base + written;
+            cursor->iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+static i32 compare_u64(const void* a, const void* b) {
+    u64 x = *(const u64*)a;
+    u64 y = *(const u64*)b;
+    return (x > y) - (x < y);
+}
+
+#else
+
+i32 run_daemon(config_t* cfg) {
+    (void)cfg;
+    fprintf(stderr, "Daemon mode is only supported on Linux.\n");
+    return -1;
+}
+
+#endif
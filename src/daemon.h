@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+#include "args.h"
+
+// Resident render service on a Unix domain socket.
+//
+// Every message is an 8 byte header followed by the payload:
+//   u8 type/status, 3 reserved bytes, u32 payload length (little endian)
+//
+// Requests are DAEMON_REQUEST_RENDER (payload is Markdown, the reply
+// is the HTML body, or the whole page if the daemon was started with
+// a --template) or DAEMON_REQUEST_STATS (no payload, the reply is
+// "name value" lines). Replies carry DAEMON_STATUS_OK or
+// DAEMON_STATUS_ERROR in the first byte, or DAEMON_STATUS_LIMIT when
+// one of the render limits (--deadline, --max-*) stopped it: the
+// payload is then the name of the limit, or the output so far with
+// --partial. With a --memory-budget, render requests wait until the
+// ones in progress leave room for them before their payload is read.
+// One the budget can never fit waits until nothing else is running and
+// is rendered to a temporary file instead of memory. Requests may be
+// sent without waiting for the replies, which come back in order.
+#define DAEMON_REQUEST_RENDER 'R'
+#define DAEMON_REQUEST_STATS 'S'
+
+#define DAEMON_STATUS_OK 0
+#define DAEMON_STATUS_ERROR 1
+#define DAEMON_STATUS_LIMIT 2
+
+#define DAEMON_HEADER_SIZE 8
+
+i32 run_daemon(config_t* cfg);
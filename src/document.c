@@ -0,0 +1,380 @@
+#include "document.h"
+
+#include "html.h"
+#include "lib/mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static b8 block_starts_fresh(char c);
+static b8 block_build(block_t* b, const char* source, u64 length, u64 offset);
+static void block_free(block_t* b);
+static b8 document_reserve(document_t* d, u64 count);
+static b8 document_link(document_t* d);
+
+b8 document_init(document_t* d, const char* source, u64 size) {
+    d->blocks = nullptr;
+    d->block_count = 0;
+    d->block_capacity = 0;
+    link_table_init(&d->links);
+
+    // Split on the same line endings edits produce, offsets count the
+    // normalized source
+    char* text = malloc(size + 1);
+    if (text == nullptr) {
+        return false;
+    }
+    mem_copy(text, (void*)source, size);
+    size = lines_normalize(text, size);
+    d->size = size;
+
+    u64 offset = 0;
+    while (offset < size) {
+        u64 length = document_block_split(text + offset, size - offset);
+
+        if (!document_reserve(d, d->block_count + 1) ||
+            !block_build(&d->blocks[d->block_count], text + offset, length, offset)) {
+            free(text);
+            document_shutdown(d);
+            return false;
+        }
+
+        d->block_count++;
+        offset += length;
+    }
+    free(text);
+
+    if (!document_link(d)) {
+        document_shutdown(d);
+        return false;
+    }
+
+    return true;
+}
+
+void document_shutdown(document_t* d) {
+    for (u64 i = 0; i < d->block_count; ++i) {
+        block_free(&d->blocks[i]);
+    }
+    free(d->blocks);
+    link_table_shutdown(&d->links);
+
+    d->blocks = nullptr;
+    d->block_count = 0;
+    d->block_capacity = 0;
+    d->size = 0;
+}
+
+b8 document_edit(document_t* d, u64 start, u64 end, const char* text, u64 length, document_change_t* change) {
+    if (start > end || end > d->size) {
+        fprintf(stderr, "Invalid edit range: %llu-%llu\n", start, end);
+        return false;
+    }
+
+    // Blocks touched by the edit. An edit right at the start of a block
+    // can join it with the previous one, so that one is included too.
+    u64 first = 0;
+    u64 last = 0;
+    if (d->block_count > 0) {
+        first = document_find_block(d, start);
+        if (first > 0 && start == d->blocks[first].offset) first--;
+
+        last = document_find_block(d, end > 0 ? end - 1 : 0);
+        if (last < first) last = first;
+    }
+
+    u64 region_start = d->block_count > 0 ? d->blocks[first].offset : 0;
+    u64 region_end = d->block_count > 0 ? d->blocks[last].offset + d->blocks[last].tokenizer.source_size : 0;
+
+    // Everything that follows the edit in the affected blocks
+    u64 tail_length = region_end - end;
+    u64 buffer_capacity = (start - region_start) + length + tail_length;
+    char* buffer = malloc(buffer_capacity + 1);
+    if (buffer == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for edit.\n");
+        return false;
+    }
+
+    // Build the new text of the region: head + inserted text + tail
+    u64 buffer_length = 0;
+    for (u64 b = first; d->block_count > 0 && b <= last; ++b) {
+        block_t* block = &d->blocks[b];
+        u64 block_end = block->offset + block->tokenizer.source_size;
+
+        // Head
+        if (block->offset < start) {
+            u64 to = block_end < start ? block_end : start;
+            mem_copy(buffer + buffer_length, block->tokenizer.source, to - block->offset);
+            buffer_length += to - block->offset;
+        }
+
+        // Inserted text goes right after the head
+        if (block_end >= start && buffer_length == start - region_start) {
+            mem_copy(buffer + buffer_length, (void*)text, length);
+            buffer_length += length;
+        }
+
+        // Tail
+        if (block_end > end) {
+            u64 from = block->offset > end ? block->offset : end;
+            mem_copy(buffer + buffer_length, block->tokenizer.source + (from - block->offset), block_end - from);
+            buffer_length += block_end - from;
+        }
+    }
+    if (d->block_count == 0) {
+        mem_copy(buffer, (void*)text, length);
+        buffer_length = length;
+    }
+
+    // If the region no longer ends in a blank line, it runs into the
+    // next block, which then has to be re-parsed along with it.
+    u64 removed_end = d->block_count > 0 ? last + 1 : 0;
+    while (removed_end < d->block_count &&
+           !(buffer_length >= 2 && buffer[buffer_length - 1] == '\n' && buffer[buffer_length - 2] == '\n')) {
+        block_t* next = &d->blocks[removed_end];
+        char* grown = realloc(buffer, buffer_length + next->tokenizer.source_size + 1);
+        if (grown == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for edit.\n");
+            free(buffer);
+            return false;
+        }
+        buffer = grown;
+        mem_copy(buffer + buffer_length, next->tokenizer.source, next->tokenizer.source_size);
+        buffer_length += next->tokenizer.source_size;
+        removed_end++;
+    }
+
+    // Line endings as a whole-file parse has them. The blocks are
+    // already normalized, but the inserted text may not be, and a `\r`
+    // at its end can meet a `\n` after it. The region is the size it
+    // normalized to, not head + text + tail.
+    u64 region_length = (removed_end < d->block_count ? d->blocks[removed_end].offset : d->size) - region_start;
+    buffer[buffer_length] = '\0';
+    buffer_length = lines_normalize(buffer, buffer_length);
+
+    // Split the new region into blocks
+    block_t* inserted = nullptr;
+    u64 inserted_count = 0;
+    u64 inserted_capacity = 0;
+    for (u64 offset = 0; offset < buffer_length;) {
+        u64 block_length = document_block_split(buffer + offset, buffer_length - offset);
+
+        if (inserted_count == inserted_capacity) {
+            inserted_capacity = inserted_capacity ? inserted_capacity * 2 : 4;
+            block_t* grown = realloc(inserted, sizeof(block_t) * inserted_capacity);
+            if (grown == nullptr) goto fail;
+            inserted = grown;
+        }
+
+        if (!block_build(&inserted[inserted_count], buffer + offset, block_length, region_start + offset)) goto fail;
+
+        inserted_count++;
+        offset += block_length;
+    }
+
+    u64 removed_count = removed_end - first;
+    u64 new_count = d->block_count - removed_count + inserted_count;
+    if (!document_reserve(d, new_count)) goto fail;
+
+    // Only a change in definitions affects blocks outside the edit
+    b8 links_changed = false;
+    for (u64 b = first; b < removed_end; ++b) {
+        if (d->blocks[b].links.count > 0) links_changed = true;
+    }
+    for (u64 b = 0; b < inserted_count; ++b) {
+        if (inserted[b].links.count > 0) links_changed = true;
+    }
+
+    // Replace the old blocks with the new ones
+    for (u64 b = first; b < removed_end; ++b) {
+        block_free(&d->blocks[b]);
+    }
+
+    u64 tail_count = d->block_count - removed_end;
+    if (tail_count > 0 && removed_count != inserted_count) {
+        // Overlapping move, so it's done by hand in the right direction
+        block_t* src = &d->blocks[removed_end];
+        block_t* dst = &d->blocks[first + inserted_count];
+        if (dst < src) {
+            for (u64 b = 0; b < tail_count; ++b) dst[b] = src[b];
+        } else {
+            for (u64 b = tail_count; b > 0; --b) dst[b - 1] = src[b - 1];
+        }
+    }
+
+    for (u64 b = 0; b < inserted_count; ++b) {
+        d->blocks[first + b] = inserted[b];
+    }
+
+    // Shift the offsets of every block after the edit
+    i64 delta = (i64)buffer_length - (i64)region_length;
+    for (u64 b = first + inserted_count; b < new_count; ++b) {
+        d->blocks[b].offset += delta;
+    }
+
+    d->block_count = new_count;
+    d->size += delta;
+
+    if (change) {
+        change->first_block = first;
+        change->removed_count = removed_count;
+        change->inserted_count = inserted_count;
+        change->links_changed = links_changed;
+    }
+
+    free(inserted);
+    free(buffer);
+
+    if (links_changed) {
+        return document_link(d);
+    }
+
+    // Same definitions, only the new references need to be looked up
+    for (u64 b = first; b < first + inserted_count; ++b) {
+        link_table_resolve(&d->blocks[b].links, &d->links);
+    }
+
+    return true;
+
+fail:
+    fprintf(stderr, "Failed to re-parse edited blocks.\n");
+    for (u64 b = 0; b < inserted_count; ++b) {
+        block_free(&inserted[b]);
+    }
+    free(inserted);
+    free(buffer);
+
+    return false;
+}
+
+u64 document_find_block(document_t* d, u64 offset) {
+    // Binary search for the last block starting at or before `offset`
+    u64 low = 0;
+    u64 high = d->block_count;
+    while (high - low > 1) {
+        u64 mid = low + (high - low) / 2;
+        if (d->blocks[mid].offset <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+void document_block_to_html(document_t* d, u64 index, sink_t* sink) {
+    if (index < d->block_count) {
+        node_to_html(d->blocks[index].root, sink);
+    }
+}
+
+void document_to_html(document_t* d, sink_t* sink) {
+    for (u64 i = 0; i < d->block_count; ++i) {
+        node_to_html(d->blocks[i].root, sink);
+    }
+}
+
+u64 document_block_split(const char* source, u64 size) {
+    // A block ends after a run of two or more linebreaks, unless the
+    // next line could still belong to a list item above it: then it
+    // is indented, or starts another item.
+    for (u64 i = 0; i < size; ++i) {
+        if (source[i] != '\n') continue;
+
+        u64 run = i;
+        while (run < size && source[run] == '\n') run++;
+
+        if (run - i >= 2 && (run == size || block_starts_fresh(source[run]))) {
+            return run;
+        }
+        i = run - 1;
+    }
+
+    return size;
+}
+
+static b8 block_starts_fresh(char c) {
+    return c != ' ' && c != '\t' && c != '-' && c != '+' && c != '*' && !is_char_digit(c);
+}
+
+static b8 block_build(block_t* b, const char* source, u64 length, u64 offset) {
+    char* copy = malloc(length + 1);
+    if (copy == nullptr) {
+        return false;
+    }
+    mem_copy(copy, (void*)source, length);
+    copy[length] = '\0';
+
+    if (!tokenizer_init_source(&b->tokenizer, copy, length)) {
+        free(copy);
+        return false;
+    }
+
+    while (next_token(&b->tokenizer));
+
+    // Most blocks are small, so give back the unused tokens
+    token_array_t* tokens = &b->tokenizer.token_array;
+    if (tokens->count > 0 && tokens->count < tokens->capacity) {
+        token_t* shrunk = realloc(tokens->tokens, sizeof(token_t) * tokens->count);
+        if (shrunk) {
+            tokens->tokens = shrunk;
+            tokens->capacity = tokens->count;
+        }
+    }
+
+    node_pool_init(&b->pool);
+    link_table_init(&b->links);
+    b->root = parse_md(&b->tokenizer, &b->pool, &b->links);
+    b->offset = offset;
+    if (b->root == nullptr) {
+        block_free(b);
+        return false;
+    }
+
+    return true;
+}
+
+static void block_free(block_t* b) {
+    link_table_shutdown(&b->links);
+    node_pool_shutdown(&b->pool);
+    tokenizer_shutdown(&b->tokenizer);
+    b->root = nullptr;
+}
+
+static b8 document_reserve(document_t* d, u64 count) {
+    if (count <= d->block_capacity) {
+        return true;
+    }
+
+    u64 capacity = d->block_capacity ? d->block_capacity : 16;
+    while (capacity < count) capacity *= 2;
+
+    block_t* blocks = realloc(d->blocks, sizeof(block_t) * capacity);
+    if (blocks == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for blocks.\n");
+        return false;
+    }
+
+    d->blocks = blocks;
+    d->block_capacity = capacity;
+
+    return true;
+}
+
+static b8 document_link(document_t* d) {
+    // Merge in block order so the first definition in the document wins
+    link_table_reset(&d->links);
+    for (u64 i = 0; i < d->block_count; ++i) {
+        if (!link_table_merge(&d->links, &d->blocks[i].links)) {
+            fprintf(stderr, "Failed to allocate memory for link definitions.\n");
+            return false;
+        }
+    }
+
+    for (u64 i = 0; i < d->block_count; ++i) {
+        link_table_resolve(&d->blocks[i].links, &d->links);
+    }
+
+    return true;
+}
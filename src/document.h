@@ -0,0 +1,62 @@
+#pragma once
+
+#include "types.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "sink.h"
+
+// A top-level block is a run of source ending in a blank line
+// (two or more consecutive linebreaks) that no list carries on past,
+// so it parses the same on its own. Each block owns a copy of its
+// source, its tokens and its subtree, so an edit only has to rebuild
+// the blocks it touches.
+typedef struct block {
+    // Position of the block in the whole document
+    u64 offset;
+
+    tokenizer_t tokenizer;
+    node_pool_t pool;
+    // The block's own definitions and references
+    link_table_t links;
+    node_t* root;
+} block_t;
+
+typedef struct document {
+    block_t* blocks;
+    u64 block_count;
+    u64 block_capacity;
+
+    // Definitions from every block, first one wins. References can
+    // point at a definition in any other block.
+    link_table_t links;
+
+    u64 size;
+} document_t;
+
+// Describes what an edit did to the block list: `removed_count`
+// blocks starting at `first_block` were replaced by `inserted_count`
+// new ones. Blocks after them are unchanged apart from their offset,
+// unless `links_changed` is set: then a definition was added or
+// removed, and any block with a reference may render differently.
+typedef struct document_change {
+    u64 first_block;
+    u64 removed_count;
+    u64 inserted_count;
+    b8 links_changed;
+} document_change_t;
+
+// Line endings are normalized first, the same as in edited text.
+b8 document_init(document_t* d, const char* source, u64 size);
+void document_shutdown(document_t* d);
+
+// Replaces the bytes [start, end) with `text` and re-parses only the
+// affected blocks. Line endings in `text` are normalized like the
+// source's, so the document can end up shorter than the edit says.
+b8 document_edit(document_t* d, u64 start, u64 end, const char* text, u64 length, document_change_t* change);
+
+u64 document_find_block(document_t* d, u64 offset);
+void document_block_to_html(document_t* d, u64 index, sink_t* sink);
+void document_to_html(document_t* d, sink_t* sink);
+
+// Length of the top-level block at the start of `source`.
+u64 document_block_split(const char* source, u64 size);
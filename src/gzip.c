@@ -0,0 +1,200 @@
+#include "gzip.h"
+
+#include "lib/mem.h"
+
+#include <stdlib.h>
+
+#ifdef MDT_ZLIB
+#include <zlib.h>
+#endif
+
+#define GZIP_CHUNK (64 * 1024)
+// zlib counts in uInt, big buffers go in pieces
+#define GZIP_PIECE (1u << 30)
+// 10 byte header and 8 byte trailer
+#define GZIP_MIN_SIZE 18
+// Deflate doesn't compress better than about 1032:1, a trailer that
+// says more than this is a lie and not worth allocating up front
+#define GZIP_MAX_RATIO 1032
+
+static i64 gzip_file_size(FILE* file, u64 size);
+static i64 gzip_buffer_size(const char* data, u64 size);
+static i64 gzip_isize(const u8* trailer, u64 size);
+#ifdef MDT_ZLIB
+static b8 gzip_reserve(char** out, u64* capacity, u64 size);
+#endif
+static i64 gzip_inflate(FILE* file, const char* data, u64 length, char** out, u64* capacity, i64 hint);
+
+b8 gzip_detect(const char* data, u64 size) {
+    return size >= 2 && (u8)data[0] == 0x1f && (u8)data[1] == 0x8b;
+}
+
+i64 gzip_read_file(FILE* file, u64 size, char** out, u64* capacity) {
+    i64 hint = gzip_file_size(file, size);
+    if (hint == -1) {
+        return -1;
+    }
+    return gzip_inflate(file, nullptr, 0, out, capacity, hint);
+}
+
+i64 gzip_read_buffer(const char* data, u64 length, char** out, u64* capacity) {
+    i64 hint = gzip_buffer_size(data, length);
+    if (hint == -1) {
+        return -1;
+    }
+    return gzip_inflate(nullptr, data, length, out, capacity, hint);
+}
+
+static i64 gzip_file_size(FILE* file, u64 size) {
+    u8 trailer[4];
+
+    long position = ftell(file);
+    b8 ok = size >= GZIP_MIN_SIZE &&
+        fseek(file, (long)(size - 4), SEEK_SET) == 0 &&
+        fread(trailer, 1, 4, file) == 4;
+    fseek(file, position, SEEK_SET);
+
+    if (!ok) {
+        fprintf(stderr, "Compressed source is truncated.\n");
+        return -1;
+    }
+
+    return gzip_isize(trailer, size);
+}
+
+static i64 gzip_buffer_size(const char* data, u64 size) {
+    if (size < GZIP_MIN_SIZE) {
+        fprintf(stderr, "Compressed source is truncated.\n");
+        return -1;
+    }
+
+    return gzip_isize((const u8*)data + size - 4, size);
+}
+
+static i64 gzip_isize(const u8* trailer, u64 size) {
+#ifdef MDT_ZLIB
+    u64 isize = (u32)trailer[0] | (u32)trailer[1] << 8 | (u32)trailer[2] << 16 | (u32)trailer[3] << 24;
+    return (i64)(isize / GZIP_MAX_RATIO > size ? size * GZIP_MAX_RATIO : isize);
+#else
+    (void)trailer;
+    (void)size;
+    fprintf(stderr, "Built without zlib (MDT_ZLIB), can't read compressed sources.\n");
+    return -1;
+#endif
+}
+
+#ifdef MDT_ZLIB
+static b8 gzip_reserve(char** out, u64* capacity, u64 size) {
+    // Only grow, never shrink
+    if (size <= *capacity) {
+        return true;
+    }
+
+    char* grown = realloc(*out, size);
+    if (grown == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for the decompressed source.\n");
+        return false;
+    }
+    *out = grown;
+    *capacity = size;
+
+    return true;
+}
+#endif
+
+static i64 gzip_inflate(FILE* file, const char* data, u64 length, char** out, u64* capacity, i64 hint) {
+#ifdef MDT_ZLIB
+    // The trailer's size and the terminator to start with
+    if (!gzip_reserve(out, capacity, (u64)hint + 1)) {
+        return -1;
+    }
+
+    z_stream stream;
+    mem_set(&stream, 0, sizeof(stream));
+
+    // 16 on top of the window bits expects a gzip header and trailer
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        fprintf(stderr, "Failed to set up the decompressor.\n");
+        return -1;
+    }
+
+    char* chunk = nullptr;
+    if (file) {
+        chunk = malloc(GZIP_CHUNK);
+        if (chunk == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for the decompressor.\n");
+            inflateEnd(&stream);
+            return -1;
+        }
+    }
+
+    u64 written = 0;
+    b8 ok = true;
+    b8 ended = false;
+
+    for (;;) {
+        if (stream.avail_in == 0) {
+            if (file) {
+                stream.next_in = (Bytef*)chunk;
+                stream.avail_in = (uInt)fread(chunk, 1, GZIP_CHUNK, file);
+            } else if (length > 0) {
+                uInt piece = length > GZIP_PIECE ? GZIP_PIECE : (uInt)length;
+                stream.next_in = (Bytef*)data;
+                stream.avail_in = piece;
+                data += piece;
+                length -= piece;
+            }
+            if (stream.avail_in == 0) break;
+        }
+
+        // Concatenated files carry on in the next member
+        if (ended) {
+            inflateReset(&stream);
+            ended = false;
+        }
+
+        // More than the trailer said, there are several members or
+        // it's over 4 GB
+        if (written + 1 == *capacity && !gzip_reserve(out, capacity, *capacity * 2)) {
+            ok = false;
+            break;
+        }
+
+        u64 room = *capacity - written - 1;
+        uInt piece = room > GZIP_PIECE ? GZIP_PIECE : (uInt)room;
+        stream.next_out = (Bytef*)(*out + written);
+        stream.avail_out = piece;
+
+        i32 result = inflate(&stream, Z_NO_FLUSH);
+        written += piece - stream.avail_out;
+
+        // Out of input or out of room, the next round gets more of either
+        if (result == Z_STREAM_END) {
+            ended = true;
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            fprintf(stderr, "Compressed source is corrupt: %s\n", stream.msg ? stream.msg : "bad data");
+            ok = false;
+            break;
+        }
+    }
+
+    if (ok && !ended) {
+        fprintf(stderr, "Compressed source ends early.\n");
+        ok = false;
+    }
+
+    free(chunk);
+    inflateEnd(&stream);
+
+    return ok ? (i64)written : -1;
+#else
+    (void)file;
+    (void)data;
+    (void)length;
+    (void)out;
+    (void)capacity;
+    (void)hint;
+    fprintf(stderr, "Built without zlib (MDT_ZLIB), can't read compressed sources.\n");
+    return -1;
+#endif
+}
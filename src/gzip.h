@@ -0,0 +1,21 @@
+#pragma once
+
+#include "types.h"
+
+#include <stdio.h>
+
+// gzip compressed sources (`.md.gz`), decompressed straight into the
+// caller's source buffer. Detection works in every build, reading
+// needs one with MDT_ZLIB.
+
+// True if `data` starts with the gzip magic bytes.
+b8 gzip_detect(const char* data, u64 size);
+
+// Inflate every member into `*out`, a malloc'd buffer of `*capacity`
+// bytes (nullptr and 0 to start), grown while there's more. The ISIZE
+// trailer is only the first guess: it's the size of the last member
+// mod 2^32. A byte is left after the output for a terminator. Returns
+// how many bytes were written, or -1 on an error. The file is `size`
+// bytes and read in chunks from its current position.
+i64 gzip_read_file(FILE* file, u64 size, char** out, u64* capacity);
+i64 gzip_read_buffer(const char* data, u64 length, char** out, u64* capacity);
@@ -1,9 +1,29 @@
 #include "html.h"
 
+#include "utf8.h"
+#include "lib/mem.h"
+#include "lib/str.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 
-void node_to_html(node_t* node, FILE* file) {
+// Single digit strings to reference for header levels
+static const char digits[] = "0123456789";
+
+// Lists opened so far by the table of contents, one per header level
+typedef struct toc_state {
+    u8 levels[7];
+    u32 open;
+} toc_state_t;
+
+static void html_write_link(node_t* node, sink_t* sink);
+static void html_write_alt(node_t* node, sink_t* sink);
+static void html_write_toc_node(node_t* node, sink_t* sink, toc_state_t* toc);
+static b8 html_within_budget(sink_t* sink);
+static u64 html_text_length(node_t* node);
+static char* html_text_copy(node_t* node, char* out);
+
+void node_to_html(node_t* node, sink_t* sink) {
     if (node == nullptr) {
         return;
     }
@@ -11,147 +31,351 @@ void node_to_html(node_t* node, FILE* file) {
     switch (node->type) {
         case NODE_ROOT: {
             node_t* child = node->children;
-            while (child) {
-                node_to_html(child, file);
+            while (child && html_within_budget(sink)) {
+                node_to_html(child, sink);
                 child = child->next;
             }
         } break;
         
         case NODE_HEADER: {
-            // For now, let's assume header can only have a single inner_text
-            node_t* inner_text = node->children;
-
-            fprintf(file,
-            "<h%d id=\"%s\">%.*s</h%d>",
-            node->depth,
-            slugifyn((char*)inner_text->value.data, inner_text->value.length),
-            (int)inner_text->value.length,
-            inner_text->value.data,
-            node->depth);
+            if (node->children == nullptr) break;
+
+            const char* level = &digits[node->depth <= 6 ? node->depth : 6];
+            char* slug = nullptr;
+            str_view_t anchor = html_header_anchor(node, &slug);
+
+            sink_write_str(sink, "<h");
+            sink_write(sink, level, 1);
+            sink_write_str(sink, " id=\"");
+            sink_copy(sink, anchor.data, anchor.length);
+            sink_write_str(sink, "\">");
+            node_t* child = node->children;
+            while (child) {
+                node_to_html(child, sink);
+                child = child->next;
+            }
+            sink_write_str(sink, "</h");
+            sink_write(sink, level, 1);
+            sink_write_str(sink, ">");
+
+            free(slug);
         } break;
 
         case NODE_UNORDERED_LIST: {
-            fprintf(file, "<ul>");
+            sink_write_str(sink, "<ul>");
             node_t* child = node->children;
-            while (child) {
-                node_to_html(child, file);
+            while (child && html_within_budget(sink)) {
+                node_to_html(child, sink);
                 child = child->next;
             }
-            fprintf(file, "</ul>");
+            sink_write_str(sink, "</ul>");
         } break;
         
+        case NODE_ORDERED_LIST: {
+            // The list's value is the first item's marker, e.g. `3.`
+            sink_write_str(sink, "<ol");
+            if (node->value.length > 1 && !(node->value.length == 2 && node->value.data[0] == '1')) {
+                sink_write_str(sink, " start=\"");
+                sink_write(sink, node->value.data, node->value.length - 1);
+                sink_write_str(sink, "\"");
+            }
+            sink_write_str(sink, ">");
+
+            node_t* child = node->children;
+            while (child && html_within_budget(sink)) {
+                node_to_html(child, sink);
+                child = child->next;
+            }
+            sink_write_str(sink, "</ol>");
+        } break;
+
+        case NODE_BLOCKQUOTE: {
+            sink_write_str(sink, "<blockquote>");
+            node_t* child = node->children;
+            while (child && html_within_budget(sink)) {
+                node_to_html(child, sink);
+                child = child->next;
+            }
+            sink_write_str(sink, "</blockquote>");
+        } break;
+
         case NODE_LIST_ITEM: {
-            fprintf(file, "<li>");
+            sink_write_str(sink, "<li>");
             node_t* child = node->children;
-            while (child) {
-                node_to_html(child, file);
+            while (child && html_within_budget(sink)) {
+                node_to_html(child, sink);
                 child = child->next;
             }
-            fprintf(file, "</li>");
+            sink_write_str(sink, "</li>");
         } break;
 
         case NODE_PARAGRAPH: {
-            fprintf(file, "<p>");
+            sink_write_str(sink, "<p>");
             node_t* child = node->children;
             while (child) {
-                node_to_html(child, file);
+                node_to_html(child, sink);
                 child = child->next;
             }
-            fprintf(file, "</p>");
+            sink_write_str(sink, "</p>");
         } break;
 
         case NODE_LINEBREAK: {
-            fprintf(file, "<br>");
+            sink_write_str(sink, "<br>");
         } break;
 
         case NODE_ITALIC: 
         case NODE_BOLD:
         case NODE_ITALIC_BOLD: {
-            char* open_tag;
-            char* close_tag;
+            const char* open_tag = "";
+            const char* close_tag = "";
             switch (node->depth) {
                 // italic
                 case 1: {
-                    const char open[] = "<em>";
-                    const char close[] = "</em> ";
-                    open_tag = str_dup(open);
-                    close_tag = str_dup(close);
+                    open_tag = "<em>";
+                    close_tag = "</em> ";
                 } break;
                 // bold
                 case 2: {
-                    const char open[] = "<strong>";
-                    const char close[] = "</strong> ";
-                    open_tag = str_dup(open);
-                    close_tag = str_dup(close);
+                    open_tag = "<strong>";
+                    close_tag = "</strong> ";
                 } break;
                 // italic-bold
                 case 3: {
-                    const char open[] = "<em><strong>";
-                    const char close[] = "</strong></em> ";
-                    open_tag = str_dup(open);
-                    close_tag = str_dup(close);
+                    open_tag = "<em><strong>";
+                    close_tag = "</strong></em> ";
                 }
             }
 
-            fprintf(file, "%s", open_tag);
+            sink_write_str(sink, open_tag);
             node_t* child = node->children;
             while (child) {
-                node_to_html(child, file);
+                node_to_html(child, sink);
                 child = child->next;
             }
-            fprintf(file, "%s", close_tag);
-
-            free(open_tag);
-            free(close_tag);
+            sink_write_str(sink, close_tag);
         } break;
 
         case NODE_INNER_TEXT: {
-            fprintf(file, "%.*s", (int)node->value.length, node->value.data);
+            sink_write_text(sink, node->value);
 
             node_t* child = node->children;
             while (child) {
-                node_to_html(child, file);
+                node_to_html(child, sink);
                 child = child->next;
             }
         } break;
 
+        case NODE_LINK:
+        case NODE_IMAGE: {
+            html_write_link(node, sink);
+        } break;
+
         default:
             fprintf(stderr, "Unknown node type: %d\n", node->type);
         break;
     }
 }
 
-void generate_html(node_t* root, const char* out_file, const char* title, const char* css) {
-    FILE* file = fopen(out_file, "w");
-    if (!file) {
-        fprintf(stderr, "Couldn't open file for writing: %s\n", out_file);
+static void html_write_link(node_t* node, sink_t* sink) {
+    // Url first, then an optional title, then the link text
+    node_t* url = node->children;
+    if (url == nullptr || url->type != NODE_URL) return;
+
+    node_t* title = nullptr;
+    node_t* child = url->next;
+    if (child && child->type == NODE_TITLE) {
+        title = child;
+        child = child->next;
+    }
+
+    sink_write_str(sink, node->type == NODE_IMAGE ? "<img src=\"" : "<a href=\"");
+    sink_write_text(sink, url->value);
+    sink_write_str(sink, "\"");
+
+    if (node->type == NODE_IMAGE) {
+        // Images can't hold markup, only the text of it
+        sink_write_str(sink, " alt=\"");
+        for (; child; child = child->next) {
+            html_write_alt(child, sink);
+        }
+        sink_write_str(sink, "\"");
+    }
+
+    if (title && title->value.length > 0) {
+        sink_write_str(sink, " title=\"");
+        sink_write_text(sink, title->value);
+        sink_write_str(sink, "\"");
+    }
+
+    if (node->type == NODE_IMAGE) {
+        sink_write_str(sink, ">");
         return;
     }
 
-    fprintf(file,
-    "<!DOCTYPE html>\n"
-    "<html lang=\"en\">\n"
-    "<head>\n"
-    "\t<meta charset=\"UTF-8\">\n"
-    "\t<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n"
-    "\t<title>%s</title>\n"
-    "\t<link rel=\"stylesheet\" href=\"%s\">\n"
-    "</head>\n"
-    "<body>\n",
-    title ? title : "Markdown",
-    css ? css : "");
+    sink_write_str(sink, ">");
+    for (; child; child = child->next) {
+        node_to_html(child, sink);
+    }
+    sink_write_str(sink, "</a>");
+}
 
-    node_to_html(root, file);
+static void html_write_alt(node_t* node, sink_t* sink) {
+    if (node->type == NODE_INNER_TEXT) {
+        sink_write_text(sink, node->value);
+    }
 
-    fprintf(file, "</body>\n</html>\n");
-    fclose(file);
+    // Nested links and images only add their text
+    node_t* child = node->children;
+    if (node->type == NODE_IMAGE || node->type == NODE_LINK) {
+        child = child ? child->next : nullptr;
+        if (child && child->type == NODE_TITLE) child = child->next;
+    }
+
+    for (; child; child = child->next) {
+        html_write_alt(child, sink);
+    }
+}
+
+void html_write_document(node_t* root, sink_t* sink, const page_t* page) {
+    const template_t* t = page->template ? page->template : template_default();
+    template_write(t, root, sink, page->title, page->css);
+}
+
+void html_write_toc(node_t* root, sink_t* sink) {
+    toc_state_t toc = { 0 };
+    html_write_toc_node(root, sink, &toc);
+
+    while (toc.open > 0) {
+        sink_write_str(sink, "</li></ul>");
+        toc.open--;
+    }
+}
+
+static void html_write_toc_node(node_t* node, sink_t* sink, toc_state_t* toc) {
+    for (node_t* child = node->children; child; child = child->next) {
+        switch (child->type) {
+            case NODE_ROOT:
+            case NODE_BLOCKQUOTE:
+            case NODE_ORDERED_LIST:
+            case NODE_UNORDERED_LIST:
+            case NODE_LIST_ITEM: {
+                html_write_toc_node(child, sink, toc);
+            } break;
+
+            case NODE_HEADER: {
+                if (child->children == nullptr) break;
+
+                // A deeper header opens a list inside the current item,
+                // a shallower one closes lists until it fits
+                u8 level = child->depth <= 6 ? child->depth : 6;
+                while (toc->open > 0 && toc->levels[toc->open - 1] > level) {
+                    sink_write_str(sink, "</li></ul>");
+                    toc->open--;
+                }
+                if (toc->open > 0 && toc->levels[toc->open - 1] == level) {
+                    sink_write_str(sink, "</li>");
+                } else {
+                    sink_write_str(sink, "<ul>");
+                    toc->levels[toc->open++] = level;
+                }
+
+                // Just the text, the entry is a link already
+                char* slug = nullptr;
+                char* copy = nullptr;
+                str_view_t anchor = html_header_anchor(child, &slug);
+                str_view_t text = html_header_text(child, &copy);
+                sink_write_str(sink, "<li><a href=\"#");
+                sink_copy(sink, anchor.data, anchor.length);
+                sink_write_str(sink, "\">");
+                sink_write_text(sink, text);
+                sink_write_str(sink, "</a>");
+                free(copy);
+                free(slug);
+            } break;
+
+            default: break;
+        }
+    }
+}
+
+static b8 html_within_budget(sink_t* sink) {
+    // Checked before every block, a render past a limit stops between two
+    return sink->budget == nullptr || budget_check(sink->budget, BUDGET_OUTPUT, sink->produced);
+}
+
+str_view_t html_header_anchor(node_t* header, char** slug) {
+    // Anchors given out ahead of time (unique across a book) are the
+    // header's value, everything else is slugged here and freed by the caller
+    if (header->value.length > 0) {
+        return header->value;
+    }
+
+    char* copy = nullptr;
+    str_view_t text = html_header_text(header, &copy);
+    *slug = slugifyn((char*)text.data, text.length);
+    if (*slug == text.data) {
+        // Out of memory, the text is the best there is
+        *slug = copy;
+        return text;
+    }
+    free(copy);
+    return string_view(*slug, str_len(*slug));
+}
+
+str_view_t html_header_text(node_t* header, char** copy) {
+    // A single run of text is the header's text as it is
+    node_t* first = header->children;
+    *copy = nullptr;
+    if (first == nullptr) {
+        return string_view("", 0);
+    }
+    if (first->type == NODE_INNER_TEXT && first->next == nullptr) {
+        return first->value;
+    }
+
+    u64 length = html_text_length(first);
+    *copy = malloc(length + 1);
+    if (*copy == nullptr) {
+        return first->type == NODE_INNER_TEXT ? first->value : string_view("", 0);
+    }
+
+    html_text_copy(first, *copy);
+    (*copy)[length] = '\0';
+    return string_view(*copy, length);
+}
+
+static u64 html_text_length(node_t* node) {
+    // The text of the nodes from `node` on and everything under them,
+    // except where links go
+    u64 length = 0;
+    for (; node; node = node->next) {
+        if (node->type == NODE_INNER_TEXT) {
+            length += node->value.length;
+        } else if (node->type != NODE_URL && node->type != NODE_TITLE) {
+            length += html_text_length(node->children);
+        }
+    }
+    return length;
+}
+
+static char* html_text_copy(node_t* node, char* out) {
+    for (; node; node = node->next) {
+        if (node->type == NODE_INNER_TEXT) {
+            mem_copy(out, (void*)node->value.data, node->value.length);
+            out += node->value.length;
+        } else if (node->type != NODE_URL && node->type != NODE_TITLE) {
+            out = html_text_copy(node->children, out);
+        }
+    }
+    return out;
 }
 
 char* slugifyn(char* input, u64 length) {
     // Same as the other one, except for strings
     // that do not have null terminators.
     
-    // Allocate memory for output string
+    // Allocate memory for output string. Lowercasing never makes
+    // a character longer, so the input's length is enough.
     char* out_str = malloc(length + 1);
     if (out_str == nullptr) {
         // Silent error
@@ -159,17 +383,28 @@ char* slugifyn(char* input, u64 length) {
     }
 
     i64 o = 0;
-    for (u64 i = 0; i < length; ++i) {
+    u64 i = 0;
+    while (i < length) {
         // Uppercase characters
         if (input[i] >= 'A' && input[i] <= 'Z') {
             // Shift them to the lower case counterpart
-            out_str[o++] = input[i] + 32;
+            out_str[o++] = input[i++] + 32;
         } else if (input[i] >= 'a' && input[i] <= 'z') {
             // Lowercase characters -- no need to change anything.
-            out_str[o++] = input[i];
+            out_str[o++] = input[i++];
         } else if (input[i] == ' ') {
             // Space becomes hyphen
             out_str[o++] = '-';
+            i++;
+        } else if ((u8)input[i] < 0x80) {
+            i++;
+        } else {
+            // Letters of other scripts are kept, lowercased where
+            // there's a mapping. Broken sequences are dropped.
+            i32 cp = utf8_decode(input, length, &i);
+            if (cp >= 0 && utf8_is_word((u32)cp)) {
+                o += utf8_encode(utf8_to_lower((u32)cp), out_str + o);
+            }
         }
     }
 
@@ -2,11 +2,26 @@
 
 #include "types.h"
 #include "parser.h"
+#include "sink.h"
+#include "template.h"
 
 #include <stdio.h>
 
-void node_to_html(node_t* node, FILE* file);
-void generate_html(node_t* root, const char* out_file, const char* title, const char* css);
+void node_to_html(node_t* node, sink_t* sink);
+void html_write_document(node_t* root, sink_t* sink, const page_t* page);
+
+// Nested lists of links to every header's anchor.
+void html_write_toc(node_t* root, sink_t* sink);
+
+// The id a header is written with, from all of its text. If it had to
+// be slugged, `slug` is set to the allocation the anchor points into,
+// for the caller to free.
+str_view_t html_header_anchor(node_t* header, char** slug);
+
+// The text of a header, every text node under it without where its
+// links go. If it spans several nodes it's copied, and `copy` is set to
+// the allocation for the caller to free.
+str_view_t html_header_text(node_t* header, char** copy);
 
 char* slugify(char* input);
 char* slugifyn(char* input, u64 length);
@@ -0,0 +1,649 @@
+#include "io.h"
+
+#include "platform.h"
+#include "lib/mem.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static io_request_t* io_acquire(io_t* io);
+static b8 io_threads_init(io_t* io);
+static void io_threads_shutdown(io_t* io);
+static void io_threads_submit(io_t* io, io_request_t* r);
+static io_request_t* io_threads_wait(io_t* io);
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef struct io_uring_ring {
+    i32 fd;
+    b8 registered;
+
+    // Submission queue
+    u32* sq_head;
+    u32* sq_tail;
+    u32* sq_mask;
+    u32* sq_array;
+    struct io_uring_sqe* sqes;
+    u32 to_submit;
+
+    // Completion queue
+    u32* cq_head;
+    u32* cq_tail;
+    u32* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // Mappings
+    void* sq_ring;
+    u64 sq_ring_size;
+    void* cq_ring;
+    u64 cq_ring_size;
+    u64 sqes_size;
+
+    // Per slot, for buffers that aren't registered
+    struct iovec* iovs;
+} io_uring_ring_t;
+
+static b8 io_uring_init(io_t* io);
+static void io_uring_shutdown(io_t* io);
+static void io_uring_submit(io_t* io, io_request_t* r);
+static io_request_t* io_uring_wait(io_t* io);
+
+#endif
+
+b8 io_init(io_t* io, io_backend_t backend, u32 depth) {
+    io->backend = backend;
+    io->depth = depth ? depth : IO_DEFAULT_DEPTH;
+    io->in_flight = 0;
+    io->internal = nullptr;
+
+    io->requests = malloc(sizeof(io_request_t) * io->depth);
+    io->slab = malloc((u64)io->depth * IO_SLOT_SIZE);
+    io->free_slots = malloc(sizeof(u32) * io->depth);
+    if (!io->requests || !io->slab || !io->free_slots) {
+        fprintf(stderr, "Failed to allocate memory for I/O slots.\n");
+        free(io->requests);
+        free(io->slab);
+        free(io->free_slots);
+        return false;
+    }
+
+    for (u32 i = 0; i < io->depth; ++i) {
+        io->requests[i].slot = i;
+        io->requests[i].op = IO_OP_NONE;
+        io->requests[i].owned = nullptr;
+        io->free_slots[i] = io->depth - 1 - i;
+    }
+    io->free_count = io->depth;
+
+#ifdef __linux__
+    if (backend == IO_BACKEND_URING) {
+        if (io_uring_init(io)) {
+            return true;
+        }
+        fprintf(stderr, "io_uring is not available, using threads for I/O.\n");
+    }
+#endif
+
+    io->backend = IO_BACKEND_THREADS;
+    if (!io_threads_init(io)) {
+        free(io->requests);
+        free(io->slab);
+        free(io->free_slots);
+        return false;
+    }
+
+    return true;
+}
+
+void io_shutdown(io_t* io) {
+    // Let whatever is still in flight land first
+    while (io->in_flight > 0) {
+        io_request_t* r = io_wait(io);
+        if (r == nullptr) break;
+        io_release(io, r);
+    }
+
+#ifdef __linux__
+    if (io->backend == IO_BACKEND_URING) {
+        io_uring_shutdown(io);
+    }
+#endif
+    if (io->backend == IO_BACKEND_THREADS) {
+        io_threads_shutdown(io);
+    }
+
+    free(io->requests);
+    free(io->slab);
+    free(io->free_slots);
+}
+
+b8 io_read(io_t* io, const char* path, u32 tag) {
+    if (str_len(path) >= IO_PATH_MAX) {
+        fprintf(stderr, "Path is too long: %s\n", path);
+        return false;
+    }
+
+    io_request_t* r = io_acquire(io);
+    if (r == nullptr) {
+        return false;
+    }
+    r->op = IO_OP_READ;
+    r->tag = tag;
+    str_cpy(r->path, path);
+
+#ifdef __linux__
+    if (io->backend == IO_BACKEND_URING) {
+        // Open and size the file here, only the read itself is queued
+        r->fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (r->fd < 0 || fstat(r->fd, &st) != 0) {
+            fprintf(stderr, "Couldn't open file: %s\n", path);
+            if (r->fd >= 0) close(r->fd);
+            io_release(io, r);
+            return false;
+        }
+        r->size = st.st_size;
+
+        // Files that don't fit in a slot get their own buffer
+        if (r->size + 1 > IO_SLOT_SIZE) {
+            r->owned = malloc(r->size + 1);
+            if (r->owned == nullptr) {
+                fprintf(stderr, "Failed to allocate memory for source.\n");
+                close(r->fd);
+                io_release(io, r);
+                return false;
+            }
+            r->buffer = r->owned;
+        }
+
+        io_uring_submit(io, r);
+        return true;
+    }
+#endif
+
+    io_threads_submit(io, r);
+    return true;
+}
+
+b8 io_write(io_t* io, const char* path, const char* data, u64 length, u32 tag) {
+    if (str_len(path) >= IO_PATH_MAX) {
+        fprintf(stderr, "Path is too long: %s\n", path);
+        return false;
+    }
+
+    io_request_t* r = io_acquire(io);
+    if (r == nullptr) {
+        return false;
+    }
+    r->op = IO_OP_WRITE;
+    r->tag = tag;
+    r->size = length;
+    str_cpy(r->path, path);
+
+    // The caller's buffer is free to reuse once this returns
+    if (length > IO_SLOT_SIZE) {
+        r->owned = malloc(length);
+        if (r->owned == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for output.\n");
+            io_release(io, r);
+            return false;
+        }
+        r->buffer = r->owned;
+    }
+    mem_copy(r->buffer, (void*)data, length);
+
+#ifdef __linux__
+    if (io->backend == IO_BACKEND_URING) {
+        r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (r->fd < 0) {
+            fprintf(stderr, "Couldn't open file for writing: %s\n", path);
+            io_release(io, r);
+            return false;
+        }
+
+        io_uring_submit(io, r);
+        return true;
+    }
+#endif
+
+    io_threads_submit(io, r);
+    return true;
+}
+
+io_request_t* io_wait(io_t* io) {
+    if (io->in_flight == 0) {
+        return nullptr;
+    }
+
+#ifdef __linux__
+    if (io->backend == IO_BACKEND_URING) {
+        return io_uring_wait(io);
+    }
+#endif
+
+    return io_threads_wait(io);
+}
+
+void io_release(io_t* io, io_request_t* r) {
+    free(r->owned);
+    r->owned = nullptr;
+    r->op = IO_OP_NONE;
+
+    io->free_slots[io->free_count++] = r->slot;
+}
+
+const char* io_backend_str(io_backend_t backend) {
+    return backend == IO_BACKEND_URING ? "io_uring" : "threads";
+}
+
+static io_request_t* io_acquire(io_t* io) {
+    if (io->free_count == 0) {
+        return nullptr;
+    }
+
+    io_request_t* r = &io->requests[io->free_slots[--io->free_count]];
+    r->buffer = io->slab + (u64)r->slot * IO_SLOT_SIZE;
+    r->size = 0;
+    r->done = 0;
+    r->failed = false;
+    r->fd = -1;
+    r->owned = nullptr;
+
+    return r;
+}
+
+// Thread pool backend
+
+#define IO_THREAD_COUNT 4
+
+typedef struct io_threads {
+    thread_t threads[IO_THREAD_COUNT];
+    u32 thread_count;
+    b8 running;
+
+    mutex_t lock;
+    condvar_t work;
+    condvar_t done;
+
+    // Rings of slot indices
+    u32* pending;
+    u32 pending_head;
+    u32 pending_count;
+
+    u32* completed;
+    u32 completed_head;
+    u32 completed_count;
+} io_threads_t;
+
+static u32 io_threads_worker(void* arg);
+static void io_threads_perform(io_t* io, io_request_t* r);
+
+static b8 io_threads_init(io_t* io) {
+    io_threads_t* t = calloc(1, sizeof(io_threads_t));
+    if (t == nullptr) {
+        return false;
+    }
+
+    t->pending = malloc(sizeof(u32) * io->depth);
+    t->completed = malloc(sizeof(u32) * io->depth);
+    if (!t->pending || !t->completed ||
+        !mutex_create(&t->lock) || !condvar_create(&t->work) || !condvar_create(&t->done)) {
+        fprintf(stderr, "Failed to set up I/O threads.\n");
+        free(t->pending);
+        free(t->completed);
+        free(t);
+        return false;
+    }
+
+    io->internal = t;
+    t->running = true;
+
+    for (; t->thread_count < IO_THREAD_COUNT; ++t->thread_count) {
+        if (!thread_create(io_threads_worker, io, &t->threads[t->thread_count])) break;
+    }
+
+    if (t->thread_count == 0) {
+        fprintf(stderr, "Failed to start I/O threads.\n");
+        io_threads_shutdown(io);
+        return false;
+    }
+
+    return true;
+}
+
+static void io_threads_shutdown(io_t* io) {
+    io_threads_t* t = io->internal;
+    if (t == nullptr) return;
+
+    mutex_lock(&t->lock);
+    t->running = false;
+    condvar_broadcast(&t->work);
+    mutex_unlock(&t->lock);
+
+    for (u32 i = 0; i < t->thread_count; ++i) {
+        thread_join(&t->threads[i]);
+    }
+
+    condvar_destroy(&t->done);
+    condvar_destroy(&t->work);
+    mutex_destroy(&t->lock);
+    free(t->pending);
+    free(t->completed);
+    free(t);
+
+    io->internal = nullptr;
+}
+
+static void io_threads_submit(io_t* io, io_request_t* r) {
+    io_threads_t* t = io->internal;
+
+    mutex_lock(&t->lock);
+    t->pending[(t->pending_head + t->pending_count) % io->depth] = r->slot;
+    t->pending_count++;
+    io->in_flight++;
+    condvar_signal(&t->work);
+    mutex_unlock(&t->lock);
+}
+
+static io_request_t* io_threads_wait(io_t* io) {
+    io_threads_t* t = io->internal;
+
+    mutex_lock(&t->lock);
+    while (t->completed_count == 0) {
+        condvar_wait(&t->done, &t->lock);
+    }
+    io_request_t* r = &io->requests[t->completed[t->completed_head]];
+    t->completed_head = (t->completed_head + 1) % io->depth;
+    t->completed_count--;
+    io->in_flight--;
+    mutex_unlock(&t->lock);
+
+    return r;
+}
+
+static u32 io_threads_worker(void* arg) {
+    io_t* io = arg;
+    io_threads_t* t = io->internal;
+
+    for (;;) {
+        mutex_lock(&t->lock);
+        while (t->running && t->pending_count == 0) {
+            condvar_wait(&t->work, &t->lock);
+        }
+        if (!t->running) {
+            mutex_unlock(&t->lock);
+            break;
+        }
+        io_request_t* r = &io->requests[t->pending[t->pending_head]];
+        t->pending_head = (t->pending_head + 1) % io->depth;
+        t->pending_count--;
+        mutex_unlock(&t->lock);
+
+        io_threads_perform(io, r);
+
+        mutex_lock(&t->lock);
+        t->completed[(t->completed_head + t->completed_count) % io->depth] = r->slot;
+        t->completed_count++;
+        condvar_signal(&t->done);
+        mutex_unlock(&t->lock);
+    }
+
+    return 0;
+}
+
+static void io_threads_perform(io_t* io, io_request_t* r) {
+    (void)io;
+
+    if (r->op == IO_OP_WRITE) {
+        FILE* file = fopen(r->path, "wb");
+        if (!file) {
+            fprintf(stderr, "Couldn't open file for writing: %s\n", r->path);
+            r->failed = true;
+            return;
+        }
+        r->done = fwrite(r->buffer, 1, r->size, file);
+        r->failed = r->done != r->size;
+        fclose(file);
+        return;
+    }
+
+    FILE* file = fopen(r->path, "rb");
+    if (!file) {
+        fprintf(stderr, "Couldn't open file: %s\n", r->path);
+        r->failed = true;
+        return;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    i64 file_size = ftell(file);
+    rewind(file);
+    if (file_size < 0) {
+        r->failed = true;
+        fclose(file);
+        return;
+    }
+    r->size = file_size;
+
+    if (r->size + 1 > IO_SLOT_SIZE) {
+        r->owned = malloc(r->size + 1);
+        if (r->owned == nullptr) {
+            r->failed = true;
+            fclose(file);
+            return;
+        }
+        r->buffer = r->owned;
+    }
+
+    r->done = fread(r->buffer, 1, r->size, file);
+    r->size = r->done;
+    r->buffer[r->size] = '\0';
+    fclose(file);
+}
+
+#ifdef __linux__
+
+// io_uring backend, talking to the kernel directly (no liburing)
+
+static i32 io_uring_enter_ring(io_uring_ring_t* ring, u32 min_complete) {
+    for (;;) {
+        i32 result = (i32)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (result < 0 && errno == EINTR) continue;
+
+        if (result > 0) ring->to_submit -= (u32)result;
+        return result;
+    }
+}
+
+static b8 io_uring_init(io_t* io) {
+    io_uring_ring_t* ring = calloc(1, sizeof(io_uring_ring_t));
+    if (ring == nullptr) {
+        return false;
+    }
+
+    struct io_uring_params params;
+    mem_set(&params, 0, sizeof(params));
+
+    ring->fd = (i32)syscall(__NR_io_uring_setup, io->depth * 2, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return false;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels share a single mapping for both rings
+    b8 single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring :
+        mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->iovs = malloc(sizeof(struct iovec) * io->depth);
+
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED || !ring->iovs) {
+        if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        if (!single_mmap && ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        free(ring->iovs);
+        close(ring->fd);
+        free(ring);
+        return false;
+    }
+
+    u8* sq = ring->sq_ring;
+    ring->sq_head = (u32*)(sq + params.sq_off.head);
+    ring->sq_tail = (u32*)(sq + params.sq_off.tail);
+    ring->sq_mask = (u32*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (u32*)(sq + params.sq_off.array);
+
+    u8* cq = ring->cq_ring;
+    ring->cq_head = (u32*)(cq + params.cq_off.head);
+    ring->cq_tail = (u32*)(cq + params.cq_off.tail);
+    ring->cq_mask = (u32*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Register the slot buffers, so the kernel doesn't have to map
+    // them for every request. Without it (memlock limits) the same
+    // buffers are used through readv/writev instead.
+    for (u32 i = 0; i < io->depth; ++i) {
+        ring->iovs[i].iov_base = io->slab + (u64)i * IO_SLOT_SIZE;
+        ring->iovs[i].iov_len = IO_SLOT_SIZE;
+    }
+    ring->registered = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, ring->iovs, io->depth) == 0;
+
+    io->internal = ring;
+    return true;
+}
+
+static void io_uring_shutdown(io_t* io) {
+    io_uring_ring_t* ring = io->internal;
+    if (ring == nullptr) return;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    free(ring->iovs);
+    free(ring);
+
+    io->internal = nullptr;
+}
+
+static void io_uring_queue(io_t* io, io_request_t* r) {
+    io_uring_ring_t* ring = io->internal;
+
+    u32 tail = *ring->sq_tail;
+    u32 index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    mem_set(sqe, 0, sizeof(*sqe));
+
+    u64 remaining = r->size - r->done;
+    if (remaining > 0x7ffff000) remaining = 0x7ffff000;
+
+    sqe->fd = r->fd;
+    sqe->off = r->done;
+    sqe->user_data = r->slot;
+
+    if (r->owned == nullptr && ring->registered) {
+        sqe->opcode = r->op == IO_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe->addr = (u64)(r->buffer + r->done);
+        sqe->len = (u32)remaining;
+        sqe->buf_index = (u16)r->slot;
+    } else {
+        // The kernel copied the iovecs at registration, so the
+        // slot's entry is free to describe this transfer.
+        struct iovec* iov = &ring->iovs[r->slot];
+        iov->iov_base = r->buffer + r->done;
+        iov->iov_len = remaining;
+
+        sqe->opcode = r->op == IO_OP_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->addr = (u64)iov;
+        sqe->len = 1;
+    }
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+static void io_uring_submit(io_t* io, io_request_t* r) {
+    // Only queued here, the next io_wait hands everything to the
+    // kernel with a single io_uring_enter.
+    io_uring_queue(io, r);
+    io->in_flight++;
+}
+
+static io_request_t* io_uring_wait(io_t* io) {
+    io_uring_ring_t* ring = io->internal;
+
+    for (;;) {
+        u32 head = *ring->cq_head;
+        u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail || ring->to_submit > 0) {
+            // Submit what's queued, and block only if nothing has completed
+            if (io_uring_enter_ring(ring, head == tail ? 1 : 0) < 0) {
+                fprintf(stderr, "io_uring_enter failed.\n");
+                return nullptr;
+            }
+            continue;
+        }
+
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        io_request_t* r = &io->requests[cqe->user_data];
+        i32 result = cqe->res;
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        if (result == -EAGAIN || result == -EINTR) {
+            io_uring_queue(io, r);
+            continue;
+        }
+
+        if (result < 0) {
+            r->failed = true;
+        } else if (result == 0 && r->op == IO_OP_READ) {
+            // File got shorter under us, take what we have
+            r->size = r->done;
+        } else if (result == 0) {
+            // A write that makes no progress would leave the output cut short
+            r->failed = true;
+        } else {
+            r->done += result;
+        }
+
+        // Short read/write, go again for the rest
+        if (!r->failed && r->done < r->size) {
+            io_uring_queue(io, r);
+            continue;
+        }
+
+        close(r->fd);
+        r->fd = -1;
+        if (r->op == IO_OP_READ) {
+            r->buffer[r->done] = '\0';
+            r->size = r->done;
+        }
+
+        io->in_flight--;
+        return r;
+    }
+}
+
+#endif
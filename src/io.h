@@ -0,0 +1,74 @@
+#pragma once
+
+#include "types.h"
+
+// Asynchronous whole-file reads and writes for batch runs, so the
+// next inputs load (and finished outputs drain) while the current
+// document is tokenized, parsed and rendered.
+//
+// Requests are submitted with io_read/io_write and come back, in
+// completion order, from io_wait. A completed request holds its slot
+// (and, for reads, the file contents) until io_release.
+
+#define IO_DEFAULT_DEPTH 32
+#define IO_SLOT_SIZE (128 * 1024)
+#define IO_PATH_MAX 4096
+
+typedef enum {
+    // io_uring with registered slot buffers (Linux)
+    IO_BACKEND_URING,
+    // Blocking stdio calls on a pool of threads
+    IO_BACKEND_THREADS
+} io_backend_t;
+
+typedef enum {
+    IO_OP_NONE,
+    IO_OP_READ,
+    IO_OP_WRITE
+} io_op_t;
+
+typedef struct io_request {
+    io_op_t op;
+    u32 tag;
+    b8 failed;
+
+    // Reads: the file contents, null terminated.
+    // Writes: the bytes to write.
+    char* buffer;
+    u64 size;
+    u64 done;
+
+    char path[IO_PATH_MAX];
+
+    // Internal
+    u32 slot;
+    i32 fd;
+    char* owned;
+} io_request_t;
+
+typedef struct io {
+    io_backend_t backend;
+    u32 depth;
+
+    // One request and one IO_SLOT_SIZE buffer per slot
+    io_request_t* requests;
+    char* slab;
+    u32* free_slots;
+    u32 free_count;
+    u32 in_flight;
+
+    void* internal;
+} io_t;
+
+// Falls back to IO_BACKEND_THREADS if io_uring can't be set up.
+b8 io_init(io_t* io, io_backend_t backend, u32 depth);
+void io_shutdown(io_t* io);
+
+// Both return false if there is no free slot (or the file can't be opened).
+b8 io_read(io_t* io, const char* path, u32 tag);
+b8 io_write(io_t* io, const char* path, const char* data, u64 length, u32 tag);
+
+io_request_t* io_wait(io_t* io);
+void io_release(io_t* io, io_request_t* r);
+
+const char* io_backend_str(io_backend_t backend);
@@ -0,0 +1,154 @@
+#include "json.h"
+
+// Indexed by node_type_t
+static const char* json_types[] = {
+    "header",
+    "paragraph",
+    "italic",
+    "bold",
+    "italic_bold",
+    "linebreak",
+    "blockquote",
+    "ordered_list",
+    "unordered_list",
+    "list_item",
+    "link",
+    "image",
+    "url",
+    "title",
+    "text",
+    "root"
+};
+
+static void json_write_string(sink_t* sink, str_view_t text);
+static void json_write_u64(sink_t* sink, u64 value);
+
+void node_to_json(node_t* node, sink_t* sink) {
+    if (node == nullptr) {
+        sink_write_str(sink, "null");
+        return;
+    }
+
+    sink_write_str(sink, "{\"type\":\"");
+    sink_write_str(sink, json_types[node->type]);
+    sink_write_str(sink, "\"");
+
+    node_t* child = node->children;
+
+    switch (node->type) {
+        case NODE_HEADER: {
+            sink_write_str(sink, ",\"level\":");
+            json_write_u64(sink, node->depth);
+        } break;
+
+        case NODE_ORDERED_LIST: {
+            // The list's value is the first item's marker, e.g. `3.`
+            u64 start = 0;
+            for (u64 i = 0; i + 1 < node->value.length; ++i) {
+                start = start * 10 + (node->value.data[i] - '0');
+            }
+            if (start != 1) {
+                sink_write_str(sink, ",\"start\":");
+                json_write_u64(sink, start);
+            }
+        } break;
+
+        case NODE_LINK:
+        case NODE_IMAGE: {
+            if (child && child->type == NODE_URL) {
+                sink_write_str(sink, ",\"url\":");
+                json_write_string(sink, child->value);
+                child = child->next;
+            }
+            if (child && child->type == NODE_TITLE) {
+                if (child->value.length > 0) {
+                    sink_write_str(sink, ",\"title\":");
+                    json_write_string(sink, child->value);
+                }
+                child = child->next;
+            }
+        } break;
+
+        case NODE_INNER_TEXT:
+        case NODE_URL:
+        case NODE_TITLE: {
+            sink_write_str(sink, ",\"value\":");
+            json_write_string(sink, node->value);
+        } break;
+
+        default: break;
+    }
+
+    if (child) {
+        sink_write_str(sink, ",\"children\":[");
+        for (b8 first = true; child; child = child->next, first = false) {
+            if (!first) sink_write_str(sink, ",");
+            node_to_json(child, sink);
+        }
+        sink_write_str(sink, "]");
+    }
+
+    sink_write_str(sink, "}");
+}
+
+void json_write_document(node_t* root, sink_t* sink, const page_t* page) {
+    (void)page;
+
+    node_to_json(root, sink);
+    sink_write_str(sink, "\n");
+}
+
+static void json_write_string(sink_t* sink, str_view_t text) {
+    static const char hex[] = "0123456789abcdef";
+    u64 run_start = 0;
+
+    sink_write_str(sink, "\"");
+
+    for (u64 i = 0; i < text.length; ++i) {
+        u8 c = (u8)text.data[i];
+        const char* escape;
+        char control[6];
+
+        switch (c) {
+            case '"': escape = "\\\""; break;
+            case '\\': escape = "\\\\"; break;
+            case '\n': escape = "\\n"; break;
+            case '\r': escape = "\\r"; break;
+            case '\t': escape = "\\t"; break;
+            default: {
+                if (c >= 0x20) continue;
+                escape = nullptr;
+            } break;
+        }
+
+        // Everything up until here is safe to reference
+        sink_write(sink, text.data + run_start, i - run_start);
+        if (escape) {
+            sink_write_str(sink, escape);
+        } else {
+            control[0] = '\\';
+            control[1] = 'u';
+            control[2] = '0';
+            control[3] = '0';
+            control[4] = hex[c >> 4];
+            control[5] = hex[c & 15];
+            sink_copy(sink, control, sizeof(control));
+        }
+        run_start = i + 1;
+    }
+
+    sink_write(sink, text.data + run_start, text.length - run_start);
+    sink_write_str(sink, "\"");
+}
+
+static void json_write_u64(sink_t* sink, u64 value) {
+    char digits[20];
+    u64 length = 0;
+
+    do {
+        digits[sizeof(digits) - 1 - length++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    sink_copy(sink, digits + sizeof(digits) - length, length);
+}
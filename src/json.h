@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+#include "parser.h"
+#include "sink.h"
+#include "template.h"
+
+// Compact JSON AST, one object per node:
+//   {"type":"header","level":1,"children":[{"type":"text","value":"Hi"}]}
+// Links and images carry "url" (and "title") instead of those child
+// nodes, ordered lists a "start" when they don't start at 1.
+void node_to_json(node_t* node, sink_t* sink);
+void json_write_document(node_t* root, sink_t* sink, const page_t* page);
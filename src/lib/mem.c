@@ -31,3 +31,21 @@ void mem_swap(void* ptr_a, void* ptr_b, u64 size) {
         b[i] = temp;
     }
 }
+
+b8 mem_equal(const void* ptr_a, const void* ptr_b, u64 size) {
+    const u8* a = ptr_a;
+    const u8* b = ptr_b;
+    u64 i = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        u64 word_a, word_b;
+        mem_copy(&word_a, (void*)(a + i), 8);
+        mem_copy(&word_b, (void*)(b + i), 8);
+        if (word_a != word_b) return false;
+    }
+    for (; i < size; ++i) {
+        if (a[i] != b[i]) return false;
+    }
+
+    return true;
+}
@@ -47,3 +47,14 @@ void* mem_set(void* dst, i32 value, u64 size);
  * @param size Size of the memory to swap in bytes.
  */
 void mem_swap(void* ptr_a, void* ptr_b, u64 size);
+
+/**
+ * @brief Compares two blocks of memory for equality, a word at a time
+ * where it can.
+ *
+ * @param ptr_a Pointer to one block of memory.
+ * @param ptr_b Pointer to another block of memory.
+ * @param size Size of the blocks in bytes.
+ * @return b8 True if every byte is the same.
+ */
+b8 mem_equal(const void* ptr_a, const void* ptr_b, u64 size);
@@ -34,6 +34,11 @@ i32 str_ncmp(const char* str_a, const char* str_b, u64 length) {
         i++;
     }
 
+    // Matched all the way through `length`
+    if (i == length) {
+        return 0;
+    }
+
     return str_a[i] - str_b[i];
 }
 
@@ -0,0 +1,154 @@
+#include "lines.h"
+
+#include <stdlib.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define LINES_SSE2 1
+#include <emmintrin.h>
+#endif
+
+static b8 line_index_build(line_index_t* index);
+static b8 line_index_push(line_index_t* index, u64 offset);
+static u32 lowest_bit(u32 mask);
+
+u64 lines_normalize(char* data, u64 size) {
+    u64 read = 0;
+
+    // Nothing to rewrite up to the first `\r`, which is usually the end
+#ifdef LINES_SSE2
+    const __m128i cr = _mm_set1_epi8('\r');
+    for (; read + 16 <= size; read += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(data + read));
+        u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, cr));
+        if (mask) {
+            read += lowest_bit(mask);
+            break;
+        }
+    }
+#endif
+    while (read < size && data[read] != '\r') read++;
+    if (read == size) {
+        return size;
+    }
+
+    // From here on the output trails the input
+    u64 write = read;
+    while (read < size) {
+#ifdef LINES_SSE2
+        // Blocks without a `\r` move over whole. The load happens before
+        // the store, so the overlap is fine.
+        if (read + 16 <= size) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(data + read));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, cr)) == 0) {
+                _mm_storeu_si128((__m128i*)(data + write), block);
+                read += 16;
+                write += 16;
+                continue;
+            }
+        }
+#endif
+        char c = data[read++];
+        if (c == '\r') {
+            // `\r\n` drops the `\r`, a lone `\r` becomes the linebreak
+            if (read < size && data[read] == '\n') continue;
+            c = '\n';
+        }
+        data[write++] = c;
+    }
+
+    data[write] = '\0';
+    return write;
+}
+
+void line_index_init(line_index_t* index) {
+    index->source = nullptr;
+    index->size = 0;
+
+    index->offsets = nullptr;
+    index->count = 0;
+    index->capacity = 0;
+    index->built = false;
+}
+
+void line_index_reset(line_index_t* index, const char* source, u64 size) {
+    index->source = source;
+    index->size = size;
+    index->count = 0;
+    index->built = false;
+}
+
+void line_index_shutdown(line_index_t* index) {
+    free(index->offsets);
+    line_index_init(index);
+}
+
+b8 line_index_locate(line_index_t* index, u64 offset, u64* line, u64* column) {
+    if (offset > index->size) return false;
+    if (!index->built && !line_index_build(index)) return false;
+
+    // Last line starting at or before `offset`
+    u64 lo = 0;
+    u64 hi = index->count;
+    while (lo < hi) {
+        u64 mid = (lo + hi) / 2;
+        if (index->offsets[mid] <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+
+    *line = lo;
+    *column = offset - index->offsets[lo - 1] + 1;
+    return true;
+}
+
+static b8 line_index_build(line_index_t* index) {
+    const char* data = index->source;
+    u64 size = index->size;
+    u64 i = 0;
+
+    index->count = 0;
+    if (!line_index_push(index, 0)) return false;
+
+#ifdef LINES_SSE2
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+        u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf));
+        while (mask) {
+            if (!line_index_push(index, i + lowest_bit(mask) + 1)) return false;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (data[i] == '\n' && !line_index_push(index, i + 1)) return false;
+    }
+
+    index->built = true;
+    return true;
+}
+
+static b8 line_index_push(line_index_t* index, u64 offset) {
+    if (index->count == index->capacity) {
+        u64 capacity = index->capacity ? index->capacity * 2 : 1024;
+        u64* offsets = realloc(index->offsets, sizeof(u64) * capacity);
+        if (offsets == nullptr) return false;
+        index->offsets = offsets;
+        index->capacity = capacity;
+    }
+
+    index->offsets[index->count++] = offset;
+    return true;
+}
+
+static u32 lowest_bit(u32 mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (u32)__builtin_ctz(mask);
+#else
+    u32 bit = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
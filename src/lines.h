@@ -0,0 +1,31 @@
+#pragma once
+
+#include "types.h"
+
+// Rewrites `\r\n` and lone `\r` line endings to `\n` in place, and
+// returns the new size (the data is null terminated there). Sources
+// without a `\r` are only read.
+u64 lines_normalize(char* data, u64 size);
+
+// Where each line starts, for turning source offsets into line and
+// column numbers. Nothing is scanned until the first lookup, so
+// sources that never need a diagnostic never pay for it.
+typedef struct line_index {
+    const char* source;
+    u64 size;
+
+    // offsets[i] is where line i + 1 starts
+    u64* offsets;
+    u64 count;
+    u64 capacity;
+    b8 built;
+} line_index_t;
+
+void line_index_init(line_index_t* index);
+// Points the index at a new source, keeping its memory.
+void line_index_reset(line_index_t* index, const char* source, u64 size);
+void line_index_shutdown(line_index_t* index);
+
+// 1 based line and column (in bytes) of `offset`. Returns false if the
+// offset is past the end, or the index couldn't be built.
+b8 line_index_locate(line_index_t* index, u64 offset, u64* line, u64* column);
@@ -0,0 +1,224 @@
+#include "links.h"
+
+#include "parser.h"
+#include "lib/mem.h"
+
+#include <stdlib.h>
+
+#define LINK_TABLE_MIN 16
+
+// Walks a label one normalized character at a time
+typedef struct label_cursor {
+    const char* data;
+    u64 length;
+    u64 pos;
+    b8 started;
+} label_cursor_t;
+
+static i32 label_next(label_cursor_t* c);
+static u64 label_hash(str_view_t label);
+static b8 label_equal(str_view_t a, str_view_t b);
+static b8 link_table_grow(link_table_t* t);
+static link_def_t* link_table_slot(link_def_t* defs, u64 capacity, str_view_t label, u64 hash);
+
+void link_table_init(link_table_t* t) {
+    t->defs = nullptr;
+    t->capacity = 0;
+    t->count = 0;
+
+    t->fixups = nullptr;
+    t->fixup_count = 0;
+    t->fixup_capacity = 0;
+}
+
+void link_table_reset(link_table_t* t) {
+    // Keep the memory, most documents have about as many links as the last one
+    if (t->count > 0) {
+        mem_set(t->defs, 0, sizeof(link_def_t) * t->capacity);
+        t->count = 0;
+    }
+    t->fixup_count = 0;
+}
+
+void link_table_shutdown(link_table_t* t) {
+    free(t->defs);
+    free(t->fixups);
+
+    link_table_init(t);
+}
+
+b8 link_table_define(link_table_t* t, str_view_t label, str_view_t url, str_view_t title) {
+    u64 hash = label_hash(label);
+    if (hash == 0) return false;
+
+    // Stay under 3/4 full so probe runs stay short
+    if ((t->count + 1) * 4 > t->capacity * 3 && !link_table_grow(t)) {
+        return false;
+    }
+
+    link_def_t* def = link_table_slot(t->defs, t->capacity, label, hash);
+    if (def->label.data != nullptr) {
+        return true;
+    }
+
+    def->hash = hash;
+    def->label = label;
+    def->url = url;
+    def->title = title;
+    t->count++;
+
+    return true;
+}
+
+link_def_t* link_table_find(const link_table_t* t, str_view_t label) {
+    if (t->count == 0) return nullptr;
+
+    u64 hash = label_hash(label);
+    if (hash == 0) return nullptr;
+
+    link_def_t* def = link_table_slot(t->defs, t->capacity, label, hash);
+    return def->label.data != nullptr ? def : nullptr;
+}
+
+b8 link_table_merge(link_table_t* dst, const link_table_t* src) {
+    for (u64 i = 0; i < src->capacity; ++i) {
+        link_def_t* def = &src->defs[i];
+        if (def->label.data == nullptr) continue;
+
+        if (!link_table_define(dst, def->label, def->url, def->title)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+b8 link_table_defer(link_table_t* t, node_t* node, str_view_t label, b8 image) {
+    if (label_hash(label) == 0) return false;
+
+    if (t->fixup_count == t->fixup_capacity) {
+        u64 capacity = t->fixup_capacity ? t->fixup_capacity * 2 : LINK_TABLE_MIN;
+        link_fixup_t* fixups = realloc(t->fixups, sizeof(link_fixup_t) * capacity);
+        if (fixups == nullptr) {
+            return false;
+        }
+        t->fixups = fixups;
+        t->fixup_capacity = capacity;
+    }
+
+    link_fixup_t* fixup = &t->fixups[t->fixup_count++];
+    fixup->node = node;
+    fixup->children = node->children;
+    fixup->label = label;
+    fixup->image = image;
+
+    return true;
+}
+
+void link_table_resolve(link_table_t* refs, const link_table_t* defs) {
+    for (u64 i = 0; i < refs->fixup_count; ++i) {
+        link_fixup_t* fixup = &refs->fixups[i];
+        node_t* node = fixup->node;
+
+        link_def_t* def = link_table_find(defs, fixup->label);
+        if (def) {
+            node->type = fixup->image ? NODE_IMAGE : NODE_LINK;
+            node->children = fixup->children;
+
+            // References always start with a url and a title node
+            fixup->children->value = def->url;
+            fixup->children->next->value = def->title;
+        } else {
+            // The node's value is the source it came from
+            node->type = NODE_INNER_TEXT;
+            node->children = nullptr;
+        }
+    }
+}
+
+static i32 label_next(label_cursor_t* c) {
+    if (c->pos < c->length && is_char_space(c->data[c->pos])) {
+        while (c->pos < c->length && is_char_space(c->data[c->pos])) c->pos++;
+
+        // Only whitespace between two characters counts
+        if (c->started && c->pos < c->length) {
+            return ' ';
+        }
+    }
+
+    if (c->pos >= c->length) {
+        return -1;
+    }
+
+    c->started = true;
+    char ch = c->data[c->pos++];
+    return (ch >= 'A' && ch <= 'Z') ? ch + 32 : (u8)ch;
+}
+
+static u64 label_hash(str_view_t label) {
+    // FNV-1a over the normalized label, 0 means there was nothing to hash
+    label_cursor_t c = { label.data, label.length, 0, false };
+    u64 hash = 14695981039346656037ULL;
+    b8 empty = true;
+
+    for (i32 ch = label_next(&c); ch != -1; ch = label_next(&c)) {
+        hash ^= (u64)ch;
+        hash *= 1099511628211ULL;
+        empty = false;
+    }
+
+    if (empty) return 0;
+    return hash != 0 ? hash : 1;
+}
+
+static b8 label_equal(str_view_t a, str_view_t b) {
+    label_cursor_t ca = { a.data, a.length, 0, false };
+    label_cursor_t cb = { b.data, b.length, 0, false };
+
+    for (;;) {
+        i32 x = label_next(&ca);
+        i32 y = label_next(&cb);
+        if (x != y) return false;
+        if (x == -1) return true;
+    }
+}
+
+static b8 link_table_grow(link_table_t* t) {
+    u64 capacity = t->capacity ? t->capacity * 2 : LINK_TABLE_MIN;
+    link_def_t* defs = malloc(sizeof(link_def_t) * capacity);
+    if (defs == nullptr) {
+        return false;
+    }
+    mem_set(defs, 0, sizeof(link_def_t) * capacity);
+
+    // Rehash with the stored hashes, the labels aren't walked again
+    for (u64 i = 0; i < t->capacity; ++i) {
+        link_def_t* def = &t->defs[i];
+        if (def->label.data == nullptr) continue;
+
+        u64 slot = def->hash & (capacity - 1);
+        while (defs[slot].label.data != nullptr) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        defs[slot] = *def;
+    }
+
+    free(t->defs);
+    t->defs = defs;
+    t->capacity = capacity;
+
+    return true;
+}
+
+static link_def_t* link_table_slot(link_def_t* defs, u64 capacity, str_view_t label, u64 hash) {
+    // Either the slot holding `label` or the empty one it would go into
+    u64 slot = hash & (capacity - 1);
+    while (defs[slot].label.data != nullptr) {
+        if (defs[slot].hash == hash && label_equal(defs[slot].label, label)) {
+            break;
+        }
+        slot = (slot + 1) & (capacity - 1);
+    }
+
+    return &defs[slot];
+}
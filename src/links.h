@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.h"
+#include "lib/str.h"
+
+struct node;
+
+// Reference definitions (`[label]: url "title"`), keyed on the
+// normalized label: ASCII case folded, leading and trailing
+// whitespace dropped, inner runs of whitespace collapsed to one.
+typedef struct link_def {
+    u64 hash;
+    // Empty slot if `label.data` is nullptr
+    str_view_t label;
+    str_view_t url;
+    str_view_t title;
+} link_def_t;
+
+// A reference link or image that was parsed before the table was
+// complete. Its node is patched in place by link_table_resolve, so
+// forward references don't need a second pass over the tokens.
+typedef struct link_fixup {
+    struct node* node;
+    // The url and title nodes, followed by the link text
+    struct node* children;
+    str_view_t label;
+    b8 image;
+} link_fixup_t;
+
+typedef struct link_table {
+    // Open addressing with linear probing, power of two capacity
+    link_def_t* defs;
+    u64 capacity;
+    u64 count;
+
+    link_fixup_t* fixups;
+    u64 fixup_count;
+    u64 fixup_capacity;
+} link_table_t;
+
+void link_table_init(link_table_t* t);
+void link_table_reset(link_table_t* t);
+void link_table_shutdown(link_table_t* t);
+
+// Returns false for an empty label. Later definitions of a label
+// that is already defined are ignored, the first one wins.
+b8 link_table_define(link_table_t* t, str_view_t label, str_view_t url, str_view_t title);
+link_def_t* link_table_find(const link_table_t* t, str_view_t label);
+
+// Adds every definition of `src` that isn't in `dst` yet.
+b8 link_table_merge(link_table_t* dst, const link_table_t* src);
+
+// Returns false for an empty label.
+b8 link_table_defer(link_table_t* t, struct node* node, str_view_t label, b8 image);
+
+// Points every deferred reference in `refs` at its definition in
+// `defs`. References without one turn back into the literal text they
+// were parsed from. Can be called again after `defs` changes.
+void link_table_resolve(link_table_t* refs, const link_table_t* defs);
@@ -1,8 +1,17 @@
 #include "types.h"
 #include "tokenizer.h"
 #include "parser.h"
-#include "html.h"
+#include "renderer.h"
+#include "render.h"
 #include "args.h"
+#include "bench.h"
+#include "watch.h"
+#include "daemon.h"
+#include "batch.h"
+#include "book.h"
+#include "parallel.h"
+#include "perf.h"
+#include "search.h"
 
 #include <stdio.h>
 
@@ -10,28 +19,170 @@ int main(int argc, char* argv[]) {
     // Parse the command line arguments
     config_t cfg = parse_args(argc, argv);
 
+    // Daemon mode serves requests until interrupted
+    if (cfg.daemon_socket != nullptr) {
+        return run_daemon(&cfg);
+    }
+
+    if (cfg.input_file == nullptr) {
+        return -1;
+    }
+
+    // Book mode puts every input into the one output
+    if (cfg.book && !cfg.watch && cfg.bench_iterations == 0) {
+        return run_book(&cfg);
+    }
+
+    // More than one input renders them all, each to its own output
+    if (cfg.input_count > 1 && !cfg.watch && cfg.bench_iterations == 0) {
+        return run_batch(&cfg);
+    }
+
+    // Benchmark mode replaces the normal run
+    if (cfg.bench_iterations > 0) {
+        return run_bench(&cfg);
+    }
+
+    // So does watch mode, which keeps running until interrupted
+    if (cfg.watch) {
+        return run_watch(&cfg);
+    }
+
+    page_t page;
+    template_t template;
+    if (!page_init(&page, &template, cfg.title, cfg.css, cfg.template_file)) {
+        return -1;
+    }
+
+    // A cached tree skips tokenizing and parsing (and the debug dumps)
+    if (cfg.cache) {
+        render_context_t ctx;
+        if (!render_context_init(&ctx, cfg.output_mode)) {
+            template_shutdown(&template);
+            return -1;
+        }
+        ctx.renderer = renderer_get(cfg.output_format);
+        ctx.use_cache = true;
+        ctx.gzip = cfg.gzip;
+        ctx.budget = cfg.budget;
+        if (cfg.search_index) {
+            fprintf(stderr, "The search index is only written without --cache, or for several inputs.\n");
+        }
+
+        b8 ok = render_file(&ctx, cfg.input_file, cfg.output_file, &page);
+        b8 stopped = ctx.budget.status != BUDGET_OK;
+        if (ok) {
+            printf("%s\n", ctx.cache_hits ? "Tree loaded from cache." : "Tree parsed and cached.");
+        } else if (!stopped) {
+            fprintf(stderr, "Failed to write %s!\n", ctx.renderer->name);
+        }
+
+        render_context_shutdown(&ctx);
+        template_shutdown(&template);
+        return ok ? 0 : stopped ? BUDGET_EXIT_CODE : -1;
+    }
+
+    // Hardware counters around each stage (optional)
+    perf_t perf;
+    perf_sample_t load, tokenize, parse, render;
+    b8 counting = cfg.perf && perf_init(&perf);
+
     // Start tokenizer
+    if (counting) perf_start(&perf);
     tokenizer_t tokenizer;
     if (!tokenizer_init(&tokenizer, cfg.input_file)) {
         fprintf(stderr, "Failed to initialize tokenizer!\n");
+        if (counting) perf_shutdown(&perf);
+        template_shutdown(&template);
         return -1;
     }
+    if (counting) perf_stop(&perf, &load);
+
+    // Limits count from here, loading the file isn't part of the render
+    budget_t* budget = budget_enabled(&cfg.budget) ? &cfg.budget : nullptr;
+    if (budget) {
+        budget_start(budget);
+        tokenizer.budget = budget;
+    }
 
+    if (counting) perf_start(&perf);
     while (next_token(&tokenizer));
+    if (counting) perf_stop(&perf, &tokenize);
     print_tokens(&tokenizer);
 
     // Parse and build the AST!
-    node_t* root = parse_md(&tokenizer);
+    node_pool_t pool;
+    node_pool_init(&pool);
+    link_table_t links;
+    link_table_init(&links);
+    if (counting) perf_start(&perf);
+    node_t* root = parse_md(&tokenizer, &pool, &links);
+    if (counting) perf_stop(&perf, &parse);
     print_nodes(root, 0);
 
-    // Generate html
-    generate_html(root, cfg.output_file, cfg.title, cfg.css);
+    // Generate the output. Large HTML documents are split between
+    // threads, budgets are only checked by the serial render.
+    const renderer_t* renderer = renderer_get(cfg.output_format);
+    u32 threads = budget == nullptr && cfg.output_format == FORMAT_HTML ?
+        parallel_threads(cfg.threads, tokenizer.source_size) : 1;
+    if (counting) perf_start(&perf);
+    b8 written = root != nullptr && (threads > 1 ?
+        parallel_write_file(root, tokenizer.source, tokenizer.source_size, cfg.output_file, &page,
+                            cfg.output_mode, &cfg.gzip, threads) :
+        renderer_write_file(renderer, root, cfg.output_file, &page, cfg.output_mode, &cfg.gzip, budget));
+    if (counting) perf_stop(&perf, &render);
+    if (!written) {
+        fprintf(stderr, "Failed to write %s!\n", renderer->name);
+        if (counting) perf_shutdown(&perf);
+        link_table_shutdown(&links);
+        node_pool_shutdown(&pool);
+        tokenizer_shutdown(&tokenizer);
+        template_shutdown(&template);
+        return -1;
+    }
+
+    // A limit stopped it somewhere along the way
+    if (budget && budget->status != BUDGET_OK) {
+        fprintf(stderr, "%s: render stopped at the %s\n", cfg.input_file, budget_status_str(budget->status));
+        if (!budget->partial) {
+            renderer_remove_file(cfg.output_file, &cfg.gzip);
+        }
+        if (counting) perf_shutdown(&perf);
+        link_table_shutdown(&links);
+        node_pool_shutdown(&pool);
+        tokenizer_shutdown(&tokenizer);
+        template_shutdown(&template);
+        return BUDGET_EXIT_CODE;
+    }
+
+    // The terms come from the tree, which is still around (optional)
+    if (cfg.search_index) {
+        search_index_t search;
+        search_index_init(&search);
+        if (search_index_add(&search, cfg.output_file, root) && search_index_write(&search, cfg.search_index)) {
+            printf("Indexed %llu terms in %llu sections into %s\n", search.term_count, search.section_count, cfg.search_index);
+        } else {
+            fprintf(stderr, "Couldn't write search index: %s\n", cfg.search_index);
+        }
+        search_index_shutdown(&search);
+    }
 
     // Success!
     printf("All is good.\n");
 
-    // Shutdown tokenizer
+    if (counting) {
+        perf_print("load", &load, tokenizer.source_size, 0);
+        perf_print("tokenize", &tokenize, tokenizer.source_size, 0);
+        perf_print("parse", &parse, tokenizer.source_size, pool.count);
+        perf_print("render", &render, tokenizer.source_size, pool.count);
+        perf_shutdown(&perf);
+    }
+
+    // Shutdown tokenizer and free the tree
+    link_table_shutdown(&links);
+    node_pool_shutdown(&pool);
     tokenizer_shutdown(&tokenizer);
+    template_shutdown(&template);
 
     return 0;
 }
@@ -0,0 +1,154 @@
+#include "parallel.h"
+
+#include "html.h"
+#include "platform.h"
+
+#include <stdlib.h>
+
+typedef struct parallel_range {
+    // Blocks from `first` up to (not including) `end`
+    node_t* first;
+    node_t* end;
+
+    sink_t out;
+    thread_t thread;
+    b8 started;
+} parallel_range_t;
+
+typedef struct parallel_page {
+    parallel_range_t* ranges;
+    u32 count;
+} parallel_page_t;
+
+static u32 parallel_render_range(void* arg);
+static void parallel_write_content(sink_t* sink, void* arg);
+static const char* block_start(node_t* node, const char* source, u64 size);
+
+u32 parallel_threads(u32 threads, u64 size) {
+    u32 count = threads ? threads : platform_core_count();
+    u64 most = size / PARALLEL_MIN_RANGE;
+    if (count > most) count = (u32)most;
+
+    return count > 1 ? count : 1;
+}
+
+void parallel_write_html(node_t* root, const char* source, u64 size, sink_t* sink, const page_t* page, u32 threads) {
+    parallel_range_t* ranges = threads > 1 ? calloc(threads, sizeof(parallel_range_t)) : nullptr;
+    if (ranges == nullptr) {
+        html_write_document(root, sink, page);
+        return;
+    }
+
+    // A range ends at the first block that starts past its share of the
+    // source. Blocks without any text of their own stay with the range
+    // before them, and a range can end up empty.
+    u32 count = 0;
+    const char* furthest = source;
+    ranges[0].first = root->children;
+    for (node_t* child = root->children; child; child = child->next) {
+        const char* start = block_start(child, source, size);
+        if (start == nullptr || start < furthest) continue;
+        furthest = start;
+
+        while (count + 1 < threads && (u64)(start - source) >= size / threads * (count + 1)) {
+            ranges[count].end = child;
+            ranges[++count].first = child;
+        }
+    }
+    ranges[count].end = nullptr;
+    count++;
+
+    b8 ok = true;
+    for (u32 i = 0; i < count; ++i) {
+        ok = sink_init_memory(&ranges[i].out) && ok;
+    }
+
+    // The last range renders right here, while the threads do the rest
+    if (ok) {
+        for (u32 i = 0; i + 1 < count; ++i) {
+            ranges[i].started = thread_create(parallel_render_range, &ranges[i], &ranges[i].thread);
+        }
+        parallel_render_range(&ranges[count - 1]);
+
+        for (u32 i = 0; i + 1 < count; ++i) {
+            if (ranges[i].started) {
+                thread_join(&ranges[i].thread);
+            } else {
+                parallel_render_range(&ranges[i]);
+            }
+            ok = ok && !ranges[i].out.failed;
+        }
+        ok = ok && !ranges[count - 1].out.failed;
+    }
+
+    if (ok) {
+        parallel_page_t p = { ranges, count };
+        const template_t* t = page->template ? page->template : template_default();
+        template_write_with(t, root, sink, page->title, page->css, parallel_write_content, &p);
+    } else {
+        html_write_document(root, sink, page);
+    }
+
+    // The buffers have to outlive the page, a gather sink points into them
+    sink_flush(sink);
+    for (u32 i = 0; i < count; ++i) {
+        sink_shutdown(&ranges[i].out);
+    }
+    free(ranges);
+}
+
+b8 parallel_write_file(node_t* root, const char* source, u64 size, const char* out_file, const page_t* page,
+                       sink_mode_t mode, const gzip_options_t* gzip, u32 threads) {
+    sink_t sink;
+    if (!sink_init(&sink, mode, nullptr)) {
+        return false;
+    }
+
+    if (!sink_open(&sink, out_file, gzip)) {
+        sink_shutdown(&sink);
+        return false;
+    }
+
+    parallel_write_html(root, source, size, &sink, page, threads);
+
+    b8 ok = sink_close(&sink);
+    sink_shutdown(&sink);
+
+    return ok;
+}
+
+static u32 parallel_render_range(void* arg) {
+    parallel_range_t* r = arg;
+
+    for (node_t* node = r->first; node != r->end; node = node->next) {
+        node_to_html(node, &r->out);
+    }
+
+    return 0;
+}
+
+static void parallel_write_content(sink_t* sink, void* arg) {
+    parallel_page_t* p = arg;
+
+    for (u32 i = 0; i < p->count; ++i) {
+        sink_write(sink, p->ranges[i].out.buffer, p->ranges[i].out.length);
+    }
+}
+
+static const char* block_start(node_t* node, const char* source, u64 size) {
+    // The first text of the block that's in the source. A reference
+    // link's url is wherever its definition is, so urls don't count.
+    if (node->type == NODE_URL || node->type == NODE_TITLE) {
+        return nullptr;
+    }
+    if (node->value.data >= source && node->value.data < source + size) {
+        return node->value.data;
+    }
+
+    for (node_t* child = node->children; child; child = child->next) {
+        const char* start = block_start(child, source, size);
+        if (start) return start;
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.h"
+#include "parser.h"
+#include "sink.h"
+#include "template.h"
+
+// HTML for one large tree, rendered on several threads. The root's
+// blocks are split into ranges of about the same size in the source
+// (every block's text points into it, in order), each range renders
+// into a buffer of its own, and the page is written with the buffers
+// in order, so the output is byte for byte what html_write_document
+// writes. A gather sink references the buffers instead of copying.
+
+// Smallest share of the source worth a thread of its own
+#define PARALLEL_MIN_RANGE (1024 * 1024)
+
+// How many threads to render `size` bytes of source with, given the
+// configured count (0 for one per core). 1 means render it serially.
+u32 parallel_threads(u32 threads, u64 size);
+
+// Writes the page like html_write_document, in `threads` ranges.
+// Falls back to rendering serially if the buffers can't be had.
+void parallel_write_html(node_t* root, const char* source, u64 size, sink_t* sink, const page_t* page, u32 threads);
+
+// Like renderer_write_file for HTML, through parallel_write_html.
+b8 parallel_write_file(node_t* root, const char* source, u64 size, const char* out_file, const page_t* page,
+                       sink_mode_t mode, const gzip_options_t* gzip, u32 threads);
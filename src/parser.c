@@ -1,9 +1,83 @@
 #include "parser.h"
 
+#include "lib/mem.h"
 #include "lib/str.h"
 #include <stdlib.h>
 #include <stdio.h>
 
+// Containers a line has to get through before its content: block
+// quotes, lists and list items, innermost last.
+typedef struct container {
+    node_t* node;
+    // Column a list item's content starts at
+    u64 indent;
+    // List marker, `.` for ordered lists
+    char marker;
+} container_t;
+
+typedef struct block_parser {
+    node_pool_t* pool;
+    link_table_t* links;
+    token_array_t* tokens;
+
+    container_t stack[PARSE_MAX_DEPTH];
+    u64 depth;
+
+    // Where the next line of text goes, if it continues a paragraph
+    node_t* paragraph;
+
+    // Start of the current line in the source, the current token,
+    // and how much of it has been consumed (`>>` is one token)
+    const char* line;
+    u64 i;
+    u64 used;
+} block_parser_t;
+
+// A run of inline tokens being parsed: the line, or the text of a
+// link on it. Emphasis moves `parent` down for the rest of the run.
+typedef struct inline_frame {
+    token_array_t tokens;
+    u64 i;
+    node_t* parent;
+    // How far `parent` is below the line's parent
+    u32 depth;
+} inline_frame_t;
+
+// A single `[` waiting for its `]`, and how many brackets were open below it
+typedef struct bracket {
+    u64 token;
+    u64 height;
+} bracket_t;
+
+// Open `[`s kept on the stack before it has to grow
+#define PARSE_BRACKETS_LOCAL 64
+
+static void parse_line(block_parser_t* bp);
+static void parse_blank_line(block_parser_t* bp);
+static void parse_header(block_parser_t* bp);
+static void parse_paragraph_line(block_parser_t* bp);
+static void open_container(block_parser_t* bp, node_t* node, u64 indent, char marker);
+static void close_containers(block_parser_t* bp, u64 depth);
+
+static u64 line_column(block_parser_t* bp);
+static u64 line_content_column(block_parser_t* bp);
+static void line_skip(block_parser_t* bp, u64 count);
+static void line_skip_spaces(block_parser_t* bp, u64 max);
+static b8 line_blank(block_parser_t* bp);
+static token_t* line_peek(block_parser_t* bp, u64* used);
+static b8 line_quote_marker(block_parser_t* bp);
+static void line_skip_quote_marker(block_parser_t* bp);
+static u64 line_list_marker(block_parser_t* bp, token_t** marker_token, char* marker);
+static b8 line_starts_block(block_parser_t* bp);
+
+static b8 parse_link(node_pool_t* pool, link_table_t* links, inline_frame_t* f, inline_frame_t* text);
+static u64 find_bracket_close(token_array_t* tokens, u64 open);
+static u64 bracket_close(token_array_t* tokens, u64 open);
+static b8 pair_brackets(token_array_t* tokens, u64 first);
+static str_view_t token_span(token_array_t* tokens, u64 first, u64 end);
+static u64 text_run_end(token_array_t* tokens, u64 first, b8* blank);
+static b8 parse_destination(str_view_t span, str_view_t* url, str_view_t* title);
+
 const char* node_str[] = {
     "NODE_HEADER",
     "NODE_PARAGRAPH",
@@ -23,200 +97,722 @@ const char* node_str[] = {
     "NODE_ROOT"
 };
 
-node_t* parse_md(tokenizer_t* t) {
+node_t* parse_md(tokenizer_t* t, node_pool_t* pool, link_table_t* links) {
+    // Whatever is in the table points into the previous tree
+    link_table_reset(links);
+
     // Create the root node
-    node_t* root = create_node(NODE_ROOT, nullptr, 0);
+    node_t* root = create_node(pool, NODE_ROOT, nullptr, 0);
+
+    block_parser_t bp;
+    bp.pool = pool;
+    bp.links = links;
+    bp.tokens = &t->token_array;
+    bp.stack[0].node = root;
+    bp.stack[0].indent = 0;
+    bp.stack[0].marker = 0;
+    bp.depth = 1;
+    bp.paragraph = nullptr;
+    bp.line = t->source;
+    bp.i = 0;
+    bp.used = 0;
+
+    // Every line goes through the open containers once, front to back
+    while (bp.i < bp.tokens->count) {
+        // Past a limit the tree ends here, it's still a valid tree
+        if (t->budget && !budget_check(t->budget, BUDGET_NODES, pool->count)) {
+            break;
+        }
+        if (pool->failed) {
+            return nullptr;
+        }
 
-    // Loop through all the tokens
-    u64 i = 0;
-    while (i < t->token_array.count) {
-        parse_block(root, &t->token_array, &i);
+        parse_line(&bp);
 
-        // TODO: remove this, and always consume in parsing!
-        // This has tripped me up sooo many times...
-        i++;
+        if (bp.i < bp.tokens->count) {
+            // A run of linebreaks is a single token, every extra one is a blank line
+            token_t* linebreak = &bp.tokens->tokens[bp.i];
+            if (linebreak->value.length > 1) {
+                parse_blank_line(&bp);
+            }
+
+            bp.line = linebreak->value.data + linebreak->value.length;
+            bp.i++;
+            bp.used = 0;
+        }
+    }
+
+    if (pool->failed) {
+        return nullptr;
     }
 
+    // Definitions may come after the references to them
+    link_table_resolve(links, links);
+
     return root;
 }
 
-void parse_block(node_t* parent, token_array_t* tokens, u64* i) {
-    token_t token = tokens->tokens[*i];
+static void parse_line(block_parser_t* bp) {
+    if (line_blank(bp)) {
+        parse_blank_line(bp);
+        line_skip_spaces(bp, (u64)-1);
+        return;
+    }
 
-    switch (token.type) {
-        case TOKEN_HEADER:
-            parse_header(parent, tokens, i);
-        break;
+    // Walk the containers that are already open. Block quotes need
+    // their marker again, list items need the line indented to their
+    // content. Lists stay open as long as their items do.
+    u64 matched = 1;
+    for (; matched < bp->depth; ++matched) {
+        container_t* c = &bp->stack[matched];
+
+        if (c->node->type == NODE_BLOCKQUOTE) {
+            if (!line_quote_marker(bp)) break;
+            line_skip_quote_marker(bp);
+        } else if (c->node->type == NODE_LIST_ITEM) {
+            if (line_blank(bp)) continue;
+            if (line_content_column(bp) < c->indent) break;
+
+            u64 column = line_column(bp);
+            if (column < c->indent) line_skip_spaces(bp, c->indent - column);
+        }
+    }
+
+    // A paragraph carries on through lines that miss some of its
+    // containers, as long as they don't start a new block (lazy continuation)
+    if (matched < bp->depth && bp->paragraph && !line_blank(bp) && !line_starts_block(bp)) {
+        parse_paragraph_line(bp);
+        return;
+    }
 
-        case TOKEN_LIST:
-            parse_list(parent, tokens, i);
-        break;
+    close_containers(bp, matched);
 
-        case TOKEN_TEXT:
-            parse_text(parent, tokens, i);
-        break;
+    // Open the containers this line starts
+    while (!line_blank(bp)) {
+        container_t* top = &bp->stack[bp->depth - 1];
+        b8 top_is_list = top->node->type == NODE_ORDERED_LIST || top->node->type == NODE_UNORDERED_LIST;
+
+        token_t* marker_token = nullptr;
+        char marker = 0;
+        u64 width = line_list_marker(bp, &marker_token, &marker);
+
+        // A list only stays open for another item of the same kind
+        if (top_is_list && (width == 0 || marker != top->marker)) {
+            close_containers(bp, bp->depth - 1);
+            continue;
+        }
+
+        if (bp->depth + 2 > PARSE_MAX_DEPTH) {
+            break;
+        }
 
-        default: break;
+        if (line_quote_marker(bp)) {
+            line_skip_spaces(bp, (u64)-1);
+            line_skip_quote_marker(bp);
+            open_container(bp, create_node(bp->pool, NODE_BLOCKQUOTE, nullptr, 0), 0, 0);
+        } else if (width > 0) {
+            line_skip_spaces(bp, (u64)-1);
+            u64 column = line_column(bp);
+
+            if (!top_is_list) {
+                node_type_t type = marker == '.' ? NODE_ORDERED_LIST : NODE_UNORDERED_LIST;
+                open_container(bp, create_node(bp->pool, type, &marker_token->value, 0), 0, marker);
+            }
+            line_skip(bp, width);
+
+            // Content lines up with the first character after the marker,
+            // unless that's more than 4 spaces away (or nothing at all)
+            u64 spaces = line_blank(bp) ? 1 : line_content_column(bp) - line_column(bp);
+            if (spaces > 4) spaces = 1;
+            line_skip_spaces(bp, spaces);
+
+            open_container(bp, create_node(bp->pool, NODE_LIST_ITEM, nullptr, 0), column + width + spaces, marker);
+        } else {
+            break;
+        }
     }
-}
 
-void parse_header(node_t* parent, token_array_t* tokens, u64* i) {
-    u64 cached_i = *i;
-    
-    if (!consume_token(tokens, i, TOKEN_HEADER)) {
-        // Something went wrong?
+    // What's left of the line is its content
+    if (line_blank(bp)) {
+        bp->paragraph = nullptr;
+        line_skip_spaces(bp, (u64)-1);
         return;
     }
+    line_skip_spaces(bp, (u64)-1);
+
+    token_array_t* tokens = bp->tokens;
+    token_t* token = &tokens->tokens[bp->i];
+
+    if (token->type == TOKEN_HEADER &&
+        bp->i + 1 < tokens->count &&
+        tokens->tokens[bp->i + 1].type == TOKEN_WHITESPACE) {
+        parse_header(bp);
+    } else if (token->type == TOKEN_SQBR_OPEN &&
+               bp->paragraph == nullptr &&
+               parse_link_definition(bp->links, tokens, &bp->i)) {
+        // Definitions don't produce any output, and can't interrupt a paragraph
+        bp->i++;
+    } else {
+        parse_paragraph_line(bp);
+    }
+}
 
-    if (!consume_token(tokens, i, TOKEN_WHITESPACE)) {
-        // Invalid header, no white space after
-        // parse_inline();
-        return;
+static void parse_blank_line(block_parser_t* bp) {
+    // Ends paragraphs and block quotes, list items carry on
+    u64 keep = 1;
+    while (keep < bp->depth && bp->stack[keep].node->type != NODE_BLOCKQUOTE) {
+        keep++;
     }
-    
+
+    close_containers(bp, keep);
+    bp->paragraph = nullptr;
+}
+
+static void parse_header(block_parser_t* bp) {
+    token_array_t* tokens = bp->tokens;
+    container_t* top = &bp->stack[bp->depth - 1];
+
     node_t* header = create_node(
+        bp->pool,
         NODE_HEADER,
         nullptr,
-        tokens->tokens[cached_i].value.length);
-    
-    // Add this to parent
-    add_child(parent, header);
+        tokens->tokens[bp->i].value.length);
+    add_child(top->node, header);
+    bp->paragraph = nullptr;
+
+    // Skip the marker and the white space after it
+    bp->i += 2;
+
+    // Headers are a single line, of the same inline text as paragraphs
+    parse_inline_text(bp->pool, bp->links, header, tokens, &bp->i);
+}
 
-    // Consume text
-    if (tokens->tokens[*i].type == TOKEN_TEXT) {
-        node_t* inner_text = create_node(
-            NODE_INNER_TEXT,
-            &tokens->tokens[*i].value,
-            0
-        );
-        add_child(header, inner_text);
+static void parse_paragraph_line(block_parser_t* bp) {
+    line_skip_spaces(bp, (u64)-1);
 
-        // (*i)++;
+    if (bp->paragraph) {
+        // Lines of the same paragraph are kept apart
+        add_child(bp->paragraph, create_node(bp->pool, NODE_LINEBREAK, nullptr, 0));
+    } else {
+        container_t* top = &bp->stack[bp->depth - 1];
+
+        if (top->node->type == NODE_LIST_ITEM && top->node->children == nullptr) {
+            // An item's first paragraph goes straight into the item
+            bp->paragraph = top->node;
+        } else {
+            bp->paragraph = create_node(bp->pool, NODE_PARAGRAPH, nullptr, 0);
+            add_child(top->node, bp->paragraph);
+        }
     }
 
-    // consume_token(tokens, i, TOKEN_LINEBREAK);
+    parse_inline_text(bp->pool, bp->links, bp->paragraph, bp->tokens, &bp->i);
 }
 
-void parse_list(node_t* parent, token_array_t* tokens, u64* i) {
-    u64 cached_i = *i;
-    (*i)++;
+static void open_container(block_parser_t* bp, node_t* node, u64 indent, char marker) {
+    add_child(bp->stack[bp->depth - 1].node, node);
 
-    if (!consume_token(tokens, i, TOKEN_WHITESPACE)) {
-        // We are throwing this back...
-        return;
+    container_t* c = &bp->stack[bp->depth++];
+    c->node = node;
+    c->indent = indent;
+    c->marker = marker;
+
+    bp->paragraph = nullptr;
+}
+
+static void close_containers(block_parser_t* bp, u64 depth) {
+    // The open paragraph always belongs to the innermost container
+    if (depth < bp->depth) {
+        bp->depth = depth;
+        bp->paragraph = nullptr;
     }
+}
 
-    // Creating the main list node
-    node_t* list = create_node(NODE_UNORDERED_LIST, nullptr, 0);
-    add_child(parent, list);
+static u64 line_column(block_parser_t* bp) {
+    if (bp->i >= bp->tokens->count) return 0;
+    return bp->tokens->tokens[bp->i].value.data + bp->used - bp->line;
+}
 
-    // Roll back to original `i`
-    *i = cached_i;
-    while (*i < tokens->count) {
-        if (!consume_token(tokens, i, TOKEN_LIST)) {
-            // No more list items, break out of the loop
-            break;
-        }
+static u64 line_content_column(block_parser_t* bp) {
+    // Column of the first character that isn't a space
+    token_t* token = bp->i < bp->tokens->count ? &bp->tokens->tokens[bp->i] : nullptr;
+    if (token && token->type == TOKEN_WHITESPACE) {
+        return token->value.data + token->value.length - bp->line;
+    }
+    return line_column(bp);
+}
 
-        consume_token(tokens, i, TOKEN_WHITESPACE);
+static void line_skip(block_parser_t* bp, u64 count) {
+    // Consume `count` characters of the current token
+    bp->used += count;
+    if (bp->used >= bp->tokens->tokens[bp->i].value.length) {
+        bp->i++;
+        bp->used = 0;
+    }
+}
 
-        // List item node
-        node_t* li = create_node(NODE_LIST_ITEM, nullptr, 0);
-        add_child(list, li);
+static void line_skip_spaces(block_parser_t* bp, u64 max) {
+    if (bp->i >= bp->tokens->count || bp->tokens->tokens[bp->i].type != TOKEN_WHITESPACE) {
+        return;
+    }
 
-        // Parse inner text
-        parse_inline_text(li, tokens, i);
+    u64 left = bp->tokens->tokens[bp->i].value.length - bp->used;
+    line_skip(bp, left < max ? left : max);
+}
 
-        // Check if we need to go another round because the next item is a list as well.
-        if ((*i) + 1 >= tokens->count || tokens->tokens[(*i) + 1].type != TOKEN_LIST) {
-            break;
-        }
+static b8 line_blank(block_parser_t* bp) {
+    token_array_t* tokens = bp->tokens;
+    u64 i = bp->i;
+    if (i < tokens->count && tokens->tokens[i].type == TOKEN_WHITESPACE) {
+        i++;
+    }
+    return i >= tokens->count || tokens->tokens[i].type == TOKEN_LINEBREAK;
+}
 
-        (*i)++;
+static token_t* line_peek(block_parser_t* bp, u64* used) {
+    // The first token after the indentation
+    token_array_t* tokens = bp->tokens;
+    u64 i = bp->i;
+    *used = bp->used;
+    if (i < tokens->count && tokens->tokens[i].type == TOKEN_WHITESPACE) {
+        i++;
+        *used = 0;
     }
+    return i < tokens->count ? &tokens->tokens[i] : nullptr;
 }
 
-void parse_text(node_t* parent, token_array_t* tokens, u64* i) {
+static b8 line_quote_marker(block_parser_t* bp) {
+    u64 used;
+    token_t* token = line_peek(bp, &used);
+    return token && token->type == TOKEN_BLOCKQUOTE && used < token->value.length;
+}
 
-    node_t* paragraph = create_node(
-        NODE_PARAGRAPH,
-        nullptr,
-        0
-    );
-    add_child(parent, paragraph);
+static void line_skip_quote_marker(block_parser_t* bp) {
+    // One `>` (of a possible `>>>`) and one space after it
+    line_skip_spaces(bp, (u64)-1);
+    line_skip(bp, 1);
+    line_skip_spaces(bp, 1);
+}
+
+static u64 line_list_marker(block_parser_t* bp, token_t** marker_token, char* marker) {
+    // `-`, `+` or `*` for bullets, digits and a `.` for ordered lists,
+    // followed by white space or the end of the line. Returns its width.
+    u64 used;
+    token_t* token = line_peek(bp, &used);
+    if (token == nullptr || used != 0) return 0;
+
+    token_t* next = token + 1;
+    b8 last = next == bp->tokens->tokens + bp->tokens->count;
+    if (!last && next->type != TOKEN_WHITESPACE && next->type != TOKEN_LINEBREAK) {
+        return 0;
+    }
+
+    str_view_t value = token->value;
+    if ((token->type == TOKEN_LIST || (token->type == TOKEN_EMPHASIS && value.data[0] == '*')) &&
+        value.length == 1) {
+        *marker = value.data[0];
+    } else if (token->type == TOKEN_NUMERICAL && value.length >= 2 && value.length <= 10 &&
+               value.data[value.length - 1] == '.') {
+        for (u64 i = 0; i + 1 < value.length; ++i) {
+            if (!is_char_digit(value.data[i])) return 0;
+        }
+        *marker = '.';
+    } else {
+        return 0;
+    }
 
-    // Parse inline!
-    parse_inline_text(paragraph, tokens, i);
+    *marker_token = token;
+    return value.length;
 }
 
-void parse_inline_text(node_t* parent, token_array_t* tokens, u64* i) {
-    // Iterate over all the texts, until we hit something
-    // that cancels the loop.
-    while (*i < tokens->count) {
+static b8 line_starts_block(block_parser_t* bp) {
+    token_t* marker_token;
+    char marker;
+    if (line_quote_marker(bp) || line_list_marker(bp, &marker_token, &marker) > 0) {
+        return true;
+    }
 
-        if (tokens->tokens[*i].type == TOKEN_TEXT) {
-            // Add TOKEN_TEXT as inner text
-            node_t* inner_text = create_node(
-                NODE_INNER_TEXT,
-                &tokens->tokens[*i].value,
-                0
-            );
-            add_child(parent, inner_text);
+    u64 used;
+    token_t* token = line_peek(bp, &used);
+    return token && token->type == TOKEN_HEADER &&
+           token + 1 < bp->tokens->tokens + bp->tokens->count &&
+           (token + 1)->type == TOKEN_WHITESPACE;
+}
 
-        } else if (tokens->tokens[*i].type == TOKEN_EMPHASIS) {
-            u8 em_count = tokens->tokens[*i].value.length;
+void parse_inline_text(node_pool_t* pool, link_table_t* links, node_t* parent, token_array_t* tokens, u64* i) {
+    if (!pair_brackets(tokens, *i)) {
+        fprintf(stderr, "Failed to allocate memory for brackets, they're kept as text.\n");
+    }
 
+    // The line, then the text of every link it's in. A link's text is
+    // its own run of tokens ending at the `]`.
+    inline_frame_t frames[PARSE_MAX_LINK_DEPTH + 1];
+    u32 top = 0;
+    frames[0] = (inline_frame_t){ *tokens, *i, parent, 0 };
+
+    // The block parser takes care of the linebreak that ends the line
+    for (;;) {
+        inline_frame_t* f = &frames[top];
+        token_array_t* run = &f->tokens;
+        if (f->i >= run->count || run->tokens[f->i].type == TOKEN_LINEBREAK) {
+            if (top == 0) break;
+            top--;
+            continue;
+        }
+
+        token_t* token = &run->tokens[f->i];
+        b8 blank;
+        u64 end = text_run_end(run, f->i, &blank);
+        if (end > f->i) {
+            // The whole run is a single node, white space the line ends
+            // with isn't content
+            if (!blank || (end < run->count && run->tokens[end].type != TOKEN_LINEBREAK)) {
+                token_t* last = &run->tokens[end - 1];
+                str_view_t text = string_view(token->value.data, last->value.data + last->value.length - token->value.data);
+                add_child(f->parent, create_node(pool, NODE_INNER_TEXT, &text, 0));
+            }
+            f->i = end;
+            continue;
+
+        } else if (token->type == TOKEN_EMPHASIS) {
+            u8 em_count = token->value.length;
 
             // Look ahead to see if the pattern is correct
-            if (tokens->tokens[*i + 1].type == TOKEN_TEXT &&
-                str_ncmp(tokens->tokens[*i].value.data, tokens->tokens[*i + 2].value.data, em_count - 1) == 0 &&
+            if (f->i + 2 < run->count &&
+                run->tokens[f->i + 1].type == TOKEN_TEXT &&
+                str_ncmp(token->value.data, run->tokens[f->i + 2].value.data, em_count - 1) == 0 &&
                 em_count <= 3) {
-                
-                // Emphasis pattern seems OK.
-                node_t* em_open = create_node(NODE_ITALIC + em_count, nullptr, em_count);
-                add_child(parent, em_open);
-
-                (*i)++;
 
-                // Add the inner text
-                parse_inline_text(em_open, tokens, i);
+                // The rest of the run goes inside
+                if (f->depth < PARSE_MAX_INLINE_DEPTH) {
+                    node_t* em_open = create_node(pool, NODE_ITALIC + em_count, nullptr, em_count);
+                    add_child(f->parent, em_open);
+                    f->parent = em_open;
+                    f->depth++;
+                } else {
+                    add_child(f->parent, create_node(pool, NODE_INNER_TEXT, &token->value, 0));
+                }
+                f->i++;
+                continue;
             } else {
                 // TODO:
                 // This is where we would save it as simple text somehow
             }
 
-        } else if (tokens->tokens[*i].type == TOKEN_LINEBREAK) {
-            u8 lb_count = tokens->tokens[*i].value.length;
+        } else if (token->type == TOKEN_SQBR_OPEN ||
+                   token->type == TOKEN_SQBR_CLOSE ||
+                   token->type == TOKEN_PAREN_OPEN ||
+                   token->type == TOKEN_PAREN_CLOSE ||
+                   token->type == TOKEN_EXCLAMATION) {
+
+            // A link moves this run past it, and its text is parsed next
+            if (top < PARSE_MAX_LINK_DEPTH && f->depth < PARSE_MAX_INLINE_DEPTH &&
+                parse_link(pool, links, f, &frames[top + 1])) {
+                top++;
+                continue;
+            }
+
+            // Brackets that don't end up as a link are just text
+            add_child(f->parent, create_node(pool, NODE_INNER_TEXT, &token->value, 0));
+        }
 
-            // Linebreaks only cause immediate exit, if there are
-            // two consecutive ones.
-            if (lb_count >= 2) {
-                // Exit loop
-                break;
+        f->i++;
+    }
+
+    *i = frames[0].i;
+}
+
+static b8 parse_link(node_pool_t* pool, link_table_t* links, inline_frame_t* f, inline_frame_t* text) {
+    token_array_t* tokens = &f->tokens;
+    u64 start = f->i;
+    b8 image = tokens->tokens[start].type == TOKEN_EXCLAMATION;
+
+    // The link text: [text] or ![text]
+    u64 open = image ? start + 1 : start;
+    u64 close = bracket_close(tokens, open);
+    if (close == 0) {
+        return false;
+    }
+
+    node_t* link = create_node(pool, image ? NODE_IMAGE : NODE_LINK, nullptr, 0);
+    str_view_t label = token_span(tokens, open + 1, close);
+    b8 is_inline = false;
+    u64 last = close;
+
+    // Inline: [text](url "title")
+    if (close + 1 < tokens->count && tokens->tokens[close + 1].type == TOKEN_PAREN_OPEN) {
+        u64 pair = tokens->tokens[close + 1].pair;
+        u64 paren = close + 1 + pair;
+
+        str_view_t url;
+        str_view_t title;
+        if (pair != 0 && paren < tokens->count) {
+            const char* from = tokens->tokens[close + 1].value.data + 1;
+            str_view_t destination = string_view(from, tokens->tokens[paren].value.data - from);
+
+            if (parse_destination(destination, &url, &title)) {
+                add_child(link, create_node(pool, NODE_URL, &url, 0));
+                if (title.length > 0) {
+                    add_child(link, create_node(pool, NODE_TITLE, &title, 0));
+                }
+                is_inline = true;
+                last = paren;
             }
+        }
+    }
 
-            // If it's only a single line break, it's either an html(<br>) or
-            // some other important element that we need to exit on.
-            // e.g. (Header, list...)
-            if ((*i) + 1 < tokens->count && (tokens->tokens[(*i) + 1].type == TOKEN_HEADER ||
-                                        tokens->tokens[(*i) + 1].type == TOKEN_EMPHASIS ||
-                                        tokens->tokens[(*i) + 1].type == TOKEN_LIST ||
-                                        tokens->tokens[(*i) + 1].type == TOKEN_NUMERICAL)) {
-                // Exit loop.
-                break;
+    // Reference: [text][label], [label][] or [label]
+    if (!is_inline) {
+        u64 label_close = close + 1 < tokens->count ? bracket_close(tokens, close + 1) : 0;
+        if (label_close != 0) {
+            if (label_close > close + 2) {
+                label = token_span(tokens, close + 2, label_close);
             }
+            last = label_close;
+        }
 
-            node_t* lb = create_node(
-                NODE_LINEBREAK,
-                nullptr,
-                0
-            );
-            add_child(parent, lb);
+        // Filled in once the definition is known
+        add_child(link, create_node(pool, NODE_URL, nullptr, 0));
+        add_child(link, create_node(pool, NODE_TITLE, nullptr, 0));
+    }
 
+    // Keep the source around, an unresolved reference falls back to it
+    link->value = token_span(tokens, start, last + 1);
+
+    if (!is_inline && !link_table_defer(links, link, label, image)) {
+        return false;
+    }
+
+    add_child(f->parent, link);
+    f->i = last + 1;
+
+    // A run of closing parentheses is a single token
+    token_t* end = &tokens->tokens[last];
+    if (is_inline && end->value.length > 1) {
+        str_view_t rest = string_view(end->value.data + 1, end->value.length - 1);
+        add_child(f->parent, create_node(pool, NODE_INNER_TEXT, &rest, 0));
+    }
+
+    // The link text is parsed like any other inline text
+    u64 length = close - open - 1;
+    *text = (inline_frame_t){ { tokens->tokens + open + 1, length, length }, 0, link, f->depth + 1 };
+
+    return true;
+}
+
+b8 parse_link_definition(link_table_t* links, token_array_t* tokens, u64* i) {
+    u64 open = *i;
+    if (tokens->tokens[open].type != TOKEN_SQBR_OPEN || tokens->tokens[open].value.length != 1) {
+        return false;
+    }
+
+    // [label]: url "title"
+    u64 close = find_bracket_close(tokens, open);
+    if (close == 0 || close + 1 >= tokens->count) {
+        return false;
+    }
+
+    token_t* colon = &tokens->tokens[close + 1];
+    if (colon->type != TOKEN_TEXT || colon->value.data[0] != ':') {
+        return false;
+    }
+
+    // The rest of the line is the destination
+    u64 end = close + 1;
+    while (end < tokens->count && tokens->tokens[end].type != TOKEN_LINEBREAK) {
+        end++;
+    }
+
+    str_view_t rest = token_span(tokens, close + 1, end);
+    rest.data++;
+    rest.length--;
+
+    str_view_t url;
+    str_view_t title;
+    if (!parse_destination(rest, &url, &title) || url.length == 0) {
+        return false;
+    }
+
+    if (!link_table_define(links, token_span(tokens, open + 1, close), url, title)) {
+        return false;
+    }
+
+    *i = end - 1;
+    return true;
+}
+
+static u64 find_bracket_close(token_array_t* tokens, u64 open) {
+    // Runs of brackets are single tokens, so this counts characters.
+    // The matching bracket has to end a token, 0 if there is none.
+    u64 depth = 0;
+    for (u64 j = open + 1; j < tokens->count; ++j) {
+        token_t* token = &tokens->tokens[j];
+
+        if (token->type == TOKEN_SQBR_OPEN) {
+            depth += token->value.length;
+        } else if (token->type == TOKEN_SQBR_CLOSE) {
+            if (token->value.length == depth + 1) return j;
+            if (token->value.length > depth) return 0;
+            depth -= token->value.length;
+        } else if (token->type == TOKEN_LINEBREAK) {
+            // Links don't span lines
+            return 0;
         }
+    }
 
-        (*i)++;
+    return 0;
+}
+
+static u64 bracket_close(token_array_t* tokens, u64 open) {
+    // The `]` pair_brackets found, if it's in this run of tokens
+    if (open >= tokens->count ||
+        tokens->tokens[open].type != TOKEN_SQBR_OPEN ||
+        tokens->tokens[open].value.length != 1) {
+        return 0;
+    }
+
+    u32 pair = tokens->tokens[open].pair;
+    return pair != 0 && open + pair < tokens->count ? open + pair : 0;
+}
+
+static b8 pair_brackets(token_array_t* tokens, u64 first) {
+    // What find_bracket_close says for every `[` on the line, in one
+    // pass. `height` is how many brackets are open: a `]` run of length
+    // n closes the top n, and only pairs with the `[` it closes down to
+    // exactly. Every other single `[` it closes has no pair.
+    bracket_t local[PARSE_BRACKETS_LOCAL];
+    bracket_t* stack = local;
+    u64 capacity = PARSE_BRACKETS_LOCAL;
+    u64 count = 0;
+    u64 height = 0;
+    u64 end = first;
+    b8 ok = true;
+
+    for (u64 j = first; j < tokens->count && tokens->tokens[j].type != TOKEN_LINEBREAK; ++j) {
+        token_t* token = &tokens->tokens[j];
+
+        if (token->type == TOKEN_SQBR_OPEN) {
+            token->pair = 0;
+            if (token->value.length == 1) {
+                if (count == capacity) {
+                    bracket_t* grown = stack == local ? malloc(sizeof(bracket_t) * capacity * 2) :
+                                                        realloc(stack, sizeof(bracket_t) * capacity * 2);
+                    if (grown == nullptr) {
+                        // The ones that don't fit stay text
+                        ok = false;
+                        height += token->value.length;
+                        continue;
+                    }
+                    if (stack == local) mem_copy(grown, local, sizeof(local));
+                    stack = grown;
+                    capacity *= 2;
+                }
+                stack[count++] = (bracket_t){ j, height };
+            }
+            height += token->value.length;
+
+        } else if (token->type == TOKEN_SQBR_CLOSE) {
+            u64 length = token->value.length;
+            u64 bottom = length > height ? 0 : height - length;
+            while (count > 0 && stack[count - 1].height >= bottom) {
+                bracket_t* b = &stack[--count];
+                if (length <= height && b->height == bottom && j - b->token <= (u32)-1) {
+                    tokens->tokens[b->token].pair = (u32)(j - b->token);
+                }
+            }
+            height = bottom;
+        }
+        end = j + 1;
+    }
+
+    // Every `(` gets the next `)` on the line, back to front
+    u64 paren = 0;
+    for (u64 j = end; j > first; --j) {
+        token_t* token = &tokens->tokens[j - 1];
+        if (token->type == TOKEN_PAREN_CLOSE) {
+            paren = j - 1;
+        } else if (token->type == TOKEN_PAREN_OPEN) {
+            token->pair = paren != 0 && paren - (j - 1) <= (u32)-1 ? (u32)(paren - (j - 1)) : 0;
+        }
+    }
+
+    if (stack != local) free(stack);
+    return ok;
+}
+
+static str_view_t token_span(token_array_t* tokens, u64 first, u64 end) {
+    // The source covered by tokens [first, end)
+    const char* from = tokens->tokens[first < tokens->count ? first : tokens->count - 1].value.data;
+    if (first >= tokens->count) {
+        from += tokens->tokens[tokens->count - 1].value.length;
+    }
+
+    const char* to;
+    if (end < tokens->count) {
+        to = tokens->tokens[end].value.data;
+    } else {
+        token_t* token = &tokens->tokens[tokens->count - 1];
+        to = token->value.data + token->value.length;
     }
+
+    return string_view(from, to > from ? to - from : 0);
+}
+
+static u64 text_run_end(token_array_t* tokens, u64 first, b8* blank) {
+    // Text, white space and the block markers the block parser didn't
+    // take all read as text. Tabs the tokenizer skipped between them
+    // are still in the source, so the run is one contiguous span.
+    u64 end = first;
+    *blank = true;
+    while (end < tokens->count) {
+        token_type_t type = tokens->tokens[end].type;
+        if (type != TOKEN_TEXT && type != TOKEN_WHITESPACE &&
+            type != TOKEN_HEADER && type != TOKEN_LIST &&
+            type != TOKEN_NUMERICAL && type != TOKEN_BLOCKQUOTE) {
+            break;
+        }
+        if (type != TOKEN_WHITESPACE) *blank = false;
+        end++;
+    }
+
+    return end;
+}
+
+static b8 parse_destination(str_view_t span, str_view_t* url, str_view_t* title) {
+    const char* d = span.data;
+    u64 s = 0;
+    u64 e = span.length;
+    while (s < e && is_char_space(d[s])) s++;
+    while (e > s && is_char_space(d[e - 1])) e--;
+
+    // Either <anything but a newline> or everything up to a space
+    u64 url_end = s;
+    if (s < e && d[s] == '<') {
+        url_end = s + 1;
+        while (url_end < e && d[url_end] != '>' && d[url_end] != '\n') url_end++;
+        if (url_end == e || d[url_end] != '>') return false;
+
+        *url = string_view(d + s + 1, url_end - s - 1);
+        url_end++;
+    } else {
+        while (url_end < e && !is_char_space(d[url_end])) url_end++;
+        *url = string_view(d + s, url_end - s);
+    }
+
+    // Optional title in "", '' or ()
+    u64 t = url_end;
+    while (t < e && is_char_space(d[t])) t++;
+    if (t == e) {
+        *title = string_view(nullptr, 0);
+        return true;
+    }
+
+    char close = d[t] == '(' ? ')' : d[t];
+    if (t == url_end || (d[t] != '"' && d[t] != '\'' && d[t] != '(') || e - t < 2 || d[e - 1] != close) {
+        return false;
+    }
+
+    *title = string_view(d + t + 1, e - t - 2);
+    return true;
 }
 
 token_t* peek_ahead(token_array_t* tokens, u64* i, u64 ahead) {
@@ -237,8 +833,13 @@ b8 consume_token(token_array_t* tokens, u64* i, token_type_t expected) {
     return false;
 }
 
-node_t* create_node(node_type_t node_type, str_view_t* value, u8 depth) {
-    node_t* node = malloc(sizeof(node_t));
+node_t* create_node(node_pool_t* pool, node_type_t node_type, str_view_t* value, u8 depth) {
+    // Out of memory the rest of the line still needs a node to go
+    // into, parse_md drops the tree
+    node_t* node = node_pool_alloc(pool);
+    if (node == nullptr) {
+        node = &pool->spare;
+    }
 
     node->type = node_type;
     node->value = string_view(
@@ -249,6 +850,7 @@ node_t* create_node(node_type_t node_type, str_view_t* value, u8 depth) {
     // Set children to nullptr
     node->next = nullptr;
     node->children = nullptr;
+    node->last_child = nullptr;
 
     return node;
 }
@@ -257,12 +859,9 @@ void add_child(node_t* parent, node_t* child) {
     if (!parent->children) {
         parent->children = child;
     } else {
-        node_t* sibling = parent->children;
-        while (sibling->next) {
-            sibling = sibling->next;
-        }
-        sibling->next = child;
+        parent->last_child->next = child;
     }
+    parent->last_child = child;
 }
 
 void print_nodes(node_t* node, i32 indent) {
@@ -301,3 +900,103 @@ void print_nodes(node_t* node, i32 indent) {
     }
 }
 
+
+void node_pool_init(node_pool_t* pool) {
+    pool->first = nullptr;
+    pool->current = nullptr;
+    pool->count = 0;
+    pool->failed = false;
+}
+
+void node_pool_reset(node_pool_t* pool) {
+    // Keep the chunks around, just mark them empty
+    for (node_chunk_t* chunk = pool->first; chunk; chunk = chunk->next) {
+        chunk->count = 0;
+    }
+    pool->current = pool->first;
+    pool->count = 0;
+    pool->failed = false;
+}
+
+void node_pool_shutdown(node_pool_t* pool) {
+    node_chunk_t* chunk = pool->first;
+    while (chunk) {
+        node_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    node_pool_init(pool);
+}
+
+node_t* node_pool_alloc(node_pool_t* pool) {
+    node_chunk_t* chunk = pool->current;
+
+    if (chunk == nullptr || chunk->count == chunk->capacity) {
+        if (chunk && chunk->next) {
+            // Reuse a chunk from a previous run
+            chunk = chunk->next;
+        } else {
+            // Chunks double in size, so small documents stay small
+            u64 capacity = chunk ? chunk->capacity * 2 : NODE_CHUNK_MIN;
+            node_chunk_t* new_chunk = malloc(sizeof(node_chunk_t) + sizeof(node_t) * capacity);
+            if (new_chunk == nullptr) {
+                if (!pool->failed) fprintf(stderr, "Failed to allocate memory for nodes.\n");
+                pool->failed = true;
+                return nullptr;
+            }
+            new_chunk->next = nullptr;
+            new_chunk->capacity = capacity;
+            new_chunk->count = 0;
+
+            if (chunk) {
+                chunk->next = new_chunk;
+            } else {
+                pool->first = new_chunk;
+            }
+            chunk = new_chunk;
+        }
+        pool->current = chunk;
+    }
+
+    pool->count++;
+    return &chunk->nodes[chunk->count++];
+}
+
+node_t* node_pool_alloc_array(node_pool_t* pool, u64 count) {
+    node_chunk_t* chunk = pool->current;
+
+    if (chunk == nullptr || chunk->capacity - chunk->count < count) {
+        if (chunk && chunk->next && chunk->next->capacity >= count) {
+            chunk = chunk->next;
+        } else {
+            u64 capacity = chunk ? chunk->capacity * 2 : NODE_CHUNK_MIN;
+            if (capacity < count) capacity = count;
+
+            node_chunk_t* new_chunk = malloc(sizeof(node_chunk_t) + sizeof(node_t) * capacity);
+            if (new_chunk == nullptr) {
+                if (!pool->failed) fprintf(stderr, "Failed to allocate memory for nodes.\n");
+                pool->failed = true;
+                return nullptr;
+            }
+            new_chunk->capacity = capacity;
+            new_chunk->count = 0;
+
+            // Goes in front of any chunks left from a previous run
+            if (chunk) {
+                new_chunk->next = chunk->next;
+                chunk->next = new_chunk;
+            } else {
+                new_chunk->next = pool->first;
+                pool->first = new_chunk;
+            }
+            chunk = new_chunk;
+        }
+        pool->current = chunk;
+    }
+
+    node_t* nodes = &chunk->nodes[chunk->count];
+    chunk->count += count;
+    pool->count += count;
+    return nodes;
+}
@@ -2,6 +2,7 @@
 
 #include "types.h"
 #include "tokenizer.h"
+#include "links.h"
 
 typedef enum {
     NODE_HEADER,
@@ -29,22 +30,69 @@ typedef struct node {
 
     struct node* next;
     struct node* children;
+    // Last of `children`, so appending doesn't walk the list
+    struct node* last_child;
 } node_t;
 
-node_t* parse_md(tokenizer_t* t);
-void parse_block(node_t* parent, token_array_t* tokens, u64* i);
+// Nodes are carved out of chunks that stay alive until the pool
+// is shut down, so the tree can be thrown away (and the memory
+// reused) with a single reset.
+#define NODE_CHUNK_MIN 64
 
-void parse_header(node_t* parent, token_array_t* tokens, u64* i);
-void parse_list(node_t* parent, token_array_t* tokens, u64* i);
-void parse_text(node_t* parent, token_array_t* tokens, u64* i);
-void parse_inline_text(node_t* parent, token_array_t* tokens, u64* i);
+typedef struct node_chunk {
+    struct node_chunk* next;
+    u64 capacity;
+    u64 count;
+    node_t nodes[];
+} node_chunk_t;
+
+typedef struct node_pool {
+    node_chunk_t* first;
+    node_chunk_t* current;
+    u64 count;
+
+    // Set when a chunk couldn't be allocated. The parse carries on into
+    // `spare` and returns nullptr at the end, the tree is thrown away.
+    b8 failed;
+    node_t spare;
+} node_pool_t;
+
+void node_pool_init(node_pool_t* pool);
+void node_pool_reset(node_pool_t* pool);
+void node_pool_shutdown(node_pool_t* pool);
+// Both return nullptr (and set `failed`) when out of memory.
+node_t* node_pool_alloc(node_pool_t* pool);
+// `count` nodes next to each other in one chunk.
+node_t* node_pool_alloc_array(node_pool_t* pool, u64 count);
+
+// Block structure is parsed line by line with a stack of open
+// containers (block quotes, lists, list items), so every token is
+// looked at once. Deeper nesting than this is kept as text.
+#define PARSE_MAX_DEPTH 64
+
+// Returns nullptr if the nodes couldn't be allocated.
+node_t* parse_md(tokenizer_t* t, node_pool_t* pool, link_table_t* links);
+
+// Emphasis and links nest up to this deep, and links inside links up
+// to PARSE_MAX_LINK_DEPTH. Deeper markers are kept as text, so the
+// trees the renderers walk stay shallow enough for any thread's stack.
+#define PARSE_MAX_INLINE_DEPTH 1024
+#define PARSE_MAX_LINK_DEPTH 32
+
+// Parses the rest of the line, up to (not including) the linebreak, in
+// one pass: brackets are paired up front, then link text is parsed
+// with a stack of the links it's in.
+void parse_inline_text(node_pool_t* pool, link_table_t* links, node_t* parent, token_array_t* tokens, u64* i);
+
+// Leaves `i` on its last token and returns false (without moving `i`)
+// if the tokens don't form a definition.
+b8 parse_link_definition(link_table_t* links, token_array_t* tokens, u64* i);
 
 token_t* peek_ahead(token_array_t* tokens, u64* i, u64 ahead);
 b8 consume_token(token_array_t* tokens, u64* i, token_type_t expected);
 
-node_t* create_node(node_type_t node_type, str_view_t* value, u8 depth);
+node_t* create_node(node_pool_t* pool, node_type_t node_type, str_view_t* value, u8 depth);
 void add_child(node_t* parent, node_t* child);
 
 void print_nodes(node_t* node, i32 indent);
 
-void nodes_free(node_t* root);
@@ -0,0 +1,165 @@
+#include "perf.h"
+
+#include "lib/mem.h"
+
+#include <stdio.h>
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+// What each counter is to the kernel
+static const struct {
+    u32 type;
+    u64 config;
+} perf_events[PERF_COUNTER_COUNT] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    [PERF_LLC_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+static i32 perf_open(u32 type, u64 config);
+static b8 perf_read(i32 fd, u64 out[3]);
+
+#endif
+
+static const char* perf_names[PERF_COUNTER_COUNT] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_BRANCH_MISSES] = "branch misses",
+    [PERF_L1D_MISSES] = "L1D misses",
+    [PERF_LLC_MISSES] = "LLC misses",
+};
+
+b8 perf_init(perf_t* p) {
+    p->available = false;
+    for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        p->fds[i] = -1;
+    }
+
+#ifdef __linux__
+    i32 error = 0;
+    for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        p->fds[i] = perf_open(perf_events[i].type, perf_events[i].config);
+        if (p->fds[i] != -1) {
+            p->available = true;
+        } else if (error == 0) {
+            error = errno;
+        }
+    }
+
+    if (!p->available) {
+        fprintf(stderr, "Hardware counters are not available (%s), see /proc/sys/kernel/perf_event_paranoid.\n",
+            strerror(error));
+    }
+#else
+    fprintf(stderr, "Hardware counters are only available on Linux.\n");
+#endif
+
+    return p->available;
+}
+
+void perf_shutdown(perf_t* p) {
+#ifdef __linux__
+    for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (p->fds[i] != -1) close(p->fds[i]);
+        p->fds[i] = -1;
+    }
+#endif
+    p->available = false;
+}
+
+void perf_start(perf_t* p) {
+#ifdef __linux__
+    for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (p->fds[i] == -1) continue;
+        if (!perf_read(p->fds[i], p->start[i])) mem_set(p->start[i], 0, sizeof(p->start[i]));
+        ioctl(p->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)p;
+#endif
+}
+
+void perf_stop(perf_t* p, perf_sample_t* out) {
+    mem_set(out, 0, sizeof(perf_sample_t));
+
+#ifdef __linux__
+    for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (p->fds[i] == -1) continue;
+        ioctl(p->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        u64 now[3];
+        if (!perf_read(p->fds[i], now) || now[2] == p->start[i][2]) {
+            continue;
+        }
+
+        // With more counters than the PMU has, each only ran part of the time
+        f64 scale = (f64)(now[1] - p->start[i][1]) / (f64)(now[2] - p->start[i][2]);
+        out->values[i] = (u64)((now[0] - p->start[i][0]) * scale);
+        out->valid[i] = true;
+    }
+#else
+    (void)p;
+#endif
+}
+
+void perf_print(const char* stage, const perf_sample_t* s, u64 bytes, u64 nodes) {
+    printf("  perf (%s):", stage);
+
+    for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i) {
+        if (!s->valid[i]) {
+            printf(" %s n/a", perf_names[i]);
+        } else if (nodes > 0) {
+            printf(" %s %.3f/B %.2f/node", perf_names[i], bytes ? (f64)s->values[i] / bytes : 0.0, (f64)s->values[i] / nodes);
+        } else {
+            printf(" %s %.3f/B", perf_names[i], bytes ? (f64)s->values[i] / bytes : 0.0);
+        }
+        printf(i + 1 < PERF_COUNTER_COUNT ? "," : "");
+    }
+
+    if (s->valid[PERF_CYCLES] && s->valid[PERF_INSTRUCTIONS] && s->values[PERF_CYCLES] > 0) {
+        printf(", %.2f IPC", (f64)s->values[PERF_INSTRUCTIONS] / s->values[PERF_CYCLES]);
+    }
+    printf("\n");
+}
+
+#ifdef __linux__
+
+static i32 perf_open(u32 type, u64 config) {
+    struct perf_event_attr attr;
+    mem_set(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // Threads started while counting (a parallel render) add to the
+    // count once they're joined
+    attr.inherit = 1;
+
+    // User space only, which is all an unprivileged process may count
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // This process, on whatever CPU it runs
+    return (i32)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static b8 perf_read(i32 fd, u64 out[3]) {
+    // Value, time enabled, time running
+    return read(fd, out, sizeof(u64) * 3) == (ssize_t)(sizeof(u64) * 3);
+}
+
+#endif
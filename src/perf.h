@@ -0,0 +1,48 @@
+#pragma once
+
+#include "types.h"
+
+// Hardware counters around the pipeline stages (Linux perf_event_open).
+// Each counter is opened on its own, so one the CPU (or a VM) doesn't
+// have is left out instead of taking the rest with it. Where none can
+// be opened at all (other platforms, perf_event_paranoid, containers)
+// perf_init says so once and every stage reads as unavailable.
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+
+    PERF_COUNTER_COUNT
+} perf_counter_t;
+
+typedef struct perf {
+    // -1 for counters that couldn't be opened
+    i32 fds[PERF_COUNTER_COUNT];
+    b8 available;
+
+    // Value, time enabled and time running at perf_start. Resetting
+    // wouldn't clear what exited threads added, so stages are differences.
+    u64 start[PERF_COUNTER_COUNT][3];
+} perf_t;
+
+typedef struct perf_sample {
+    // Scaled up if the kernel had to multiplex the counters
+    u64 values[PERF_COUNTER_COUNT];
+    b8 valid[PERF_COUNTER_COUNT];
+} perf_sample_t;
+
+// Returns false (and says why) if no counter could be opened.
+b8 perf_init(perf_t* p);
+void perf_shutdown(perf_t* p);
+
+// Counts the calling thread (and the threads it starts and joins in
+// between) from perf_start to perf_stop.
+void perf_start(perf_t* p);
+void perf_stop(perf_t* p, perf_sample_t* out);
+
+// One line for a stage: every counter per input byte and, if there
+// are any, per node, plus instructions per cycle.
+void perf_print(const char* stage, const perf_sample_t* s, u64 bytes, u64 nodes);
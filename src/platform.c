@@ -0,0 +1,297 @@
+#include "platform.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+typedef struct win32_thread_start {
+    thread_fn fn;
+    void* arg;
+} win32_thread_start_t;
+
+u64 platform_time_ns(void) {
+    static LARGE_INTEGER frequency = { 0 };
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    // Split to avoid overflowing when multiplying by 1e9
+    u64 seconds = counter.QuadPart / frequency.QuadPart;
+    u64 remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000ULL + (remainder * 1000000000ULL) / frequency.QuadPart;
+}
+
+u32 platform_core_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+b8 platform_map_file(const char* path, mapped_file_t* out) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    // The mapping keeps the file open, the handle isn't needed anymore
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) return false;
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    out->data = data;
+    out->size = (u64)size.QuadPart;
+    out->internal = mapping;
+    return true;
+}
+
+void platform_unmap_file(mapped_file_t* file) {
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->internal);
+    file->data = nullptr;
+    file->size = 0;
+    file->internal = nullptr;
+}
+
+static DWORD WINAPI win32_thread_proc(LPVOID param) {
+    win32_thread_start_t start = *(win32_thread_start_t*)param;
+    free(param);
+    return start.fn(start.arg);
+}
+
+b8 thread_create(thread_fn fn, void* arg, thread_t* out) {
+    win32_thread_start_t* start = malloc(sizeof(win32_thread_start_t));
+    if (start == nullptr) return false;
+    start->fn = fn;
+    start->arg = arg;
+
+    out->internal = CreateThread(nullptr, 0, win32_thread_proc, start, 0, nullptr);
+    if (out->internal == nullptr) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void thread_join(thread_t* t) {
+    WaitForSingleObject(t->internal, INFINITE);
+    CloseHandle(t->internal);
+    t->internal = nullptr;
+}
+
+b8 mutex_create(mutex_t* m) {
+    m->internal = malloc(sizeof(CRITICAL_SECTION));
+    if (m->internal == nullptr) return false;
+    InitializeCriticalSection(m->internal);
+    return true;
+}
+
+void mutex_destroy(mutex_t* m) {
+    DeleteCriticalSection(m->internal);
+    free(m->internal);
+    m->internal = nullptr;
+}
+
+void mutex_lock(mutex_t* m) {
+    EnterCriticalSection(m->internal);
+}
+
+void mutex_unlock(mutex_t* m) {
+    LeaveCriticalSection(m->internal);
+}
+
+b8 condvar_create(condvar_t* c) {
+    c->internal = malloc(sizeof(CONDITION_VARIABLE));
+    if (c->internal == nullptr) return false;
+    InitializeConditionVariable(c->internal);
+    return true;
+}
+
+void condvar_destroy(condvar_t* c) {
+    free(c->internal);
+    c->internal = nullptr;
+}
+
+void condvar_wait(condvar_t* c, mutex_t* m) {
+    SleepConditionVariableCS(c->internal, m->internal, INFINITE);
+}
+
+b8 condvar_wait_ns(condvar_t* c, mutex_t* m, u64 timeout_ns) {
+    DWORD ms = (DWORD)((timeout_ns + 999999) / 1000000);
+    return SleepConditionVariableCS(c->internal, m->internal, ms) != 0;
+}
+
+void condvar_signal(condvar_t* c) {
+    WakeConditionVariable(c->internal);
+}
+
+void condvar_broadcast(condvar_t* c) {
+    WakeAllConditionVariable(c->internal);
+}
+
+#else
+
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct posix_thread_start {
+    thread_fn fn;
+    void* arg;
+} posix_thread_start_t;
+
+u64 platform_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+u32 platform_core_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32)count : 1;
+}
+
+b8 platform_map_file(const char* path, mapped_file_t* out) {
+    i32 fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    // The mapping keeps the file referenced, the descriptor isn't needed anymore
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    out->data = data;
+    out->size = (u64)st.st_size;
+    out->internal = nullptr;
+    return true;
+}
+
+void platform_unmap_file(mapped_file_t* file) {
+    munmap((void*)file->data, file->size);
+    file->data = nullptr;
+    file->size = 0;
+}
+
+static void* posix_thread_proc(void* param) {
+    posix_thread_start_t start = *(posix_thread_start_t*)param;
+    free(param);
+    start.fn(start.arg);
+    return nullptr;
+}
+
+b8 thread_create(thread_fn fn, void* arg, thread_t* out) {
+    posix_thread_start_t* start = malloc(sizeof(posix_thread_start_t));
+    pthread_t* handle = malloc(sizeof(pthread_t));
+    if (start == nullptr || handle == nullptr) {
+        free(start);
+        free(handle);
+        return false;
+    }
+    start->fn = fn;
+    start->arg = arg;
+
+    if (pthread_create(handle, nullptr, posix_thread_proc, start) != 0) {
+        free(start);
+        free(handle);
+        return false;
+    }
+
+    out->internal = handle;
+    return true;
+}
+
+void thread_join(thread_t* t) {
+    pthread_join(*(pthread_t*)t->internal, nullptr);
+    free(t->internal);
+    t->internal = nullptr;
+}
+
+b8 mutex_create(mutex_t* m) {
+    m->internal = malloc(sizeof(pthread_mutex_t));
+    if (m->internal == nullptr) return false;
+    if (pthread_mutex_init(m->internal, nullptr) != 0) {
+        free(m->internal);
+        return false;
+    }
+    return true;
+}
+
+void mutex_destroy(mutex_t* m) {
+    pthread_mutex_destroy(m->internal);
+    free(m->internal);
+    m->internal = nullptr;
+}
+
+void mutex_lock(mutex_t* m) {
+    pthread_mutex_lock(m->internal);
+}
+
+void mutex_unlock(mutex_t* m) {
+    pthread_mutex_unlock(m->internal);
+}
+
+b8 condvar_create(condvar_t* c) {
+    c->internal = malloc(sizeof(pthread_cond_t));
+    if (c->internal == nullptr) return false;
+    if (pthread_cond_init(c->internal, nullptr) != 0) {
+        free(c->internal);
+        return false;
+    }
+    return true;
+}
+
+void condvar_destroy(condvar_t* c) {
+    pthread_cond_destroy(c->internal);
+    free(c->internal);
+    c->internal = nullptr;
+}
+
+void condvar_wait(condvar_t* c, mutex_t* m) {
+    pthread_cond_wait(c->internal, m->internal);
+}
+
+b8 condvar_wait_ns(condvar_t* c, mutex_t* m, u64 timeout_ns) {
+    // pthread wants an absolute (realtime) deadline
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    u64 nsec = (u64)ts.tv_nsec + timeout_ns;
+    ts.tv_sec += nsec / 1000000000ULL;
+    ts.tv_nsec = nsec % 1000000000ULL;
+
+    return pthread_cond_timedwait(c->internal, m->internal, &ts) != ETIMEDOUT;
+}
+
+void condvar_signal(condvar_t* c) {
+    pthread_cond_signal(c->internal);
+}
+
+void condvar_broadcast(condvar_t* c) {
+    pthread_cond_broadcast(c->internal);
+}
+
+#endif
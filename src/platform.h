@@ -0,0 +1,52 @@
+#pragma once
+
+#include "types.h"
+
+// Monotonic clock in nanoseconds, only meaningful as a difference.
+u64 platform_time_ns(void);
+
+// Number of logical cores, at least 1.
+u32 platform_core_count(void);
+
+// Maps a whole file read-only. Returns nullptr if it can't be opened
+// or is empty. `internal` holds whatever unmapping needs.
+typedef struct mapped_file {
+    const char* data;
+    u64 size;
+    void* internal;
+} mapped_file_t;
+
+b8 platform_map_file(const char* path, mapped_file_t* out);
+void platform_unmap_file(mapped_file_t* file);
+
+// Threads and synchronization. The platform objects live behind
+// `internal`, so these headers don't drag in windows.h/pthread.h.
+typedef u32 (*thread_fn)(void* arg);
+
+typedef struct thread {
+    void* internal;
+} thread_t;
+
+typedef struct mutex {
+    void* internal;
+} mutex_t;
+
+typedef struct condvar {
+    void* internal;
+} condvar_t;
+
+b8 thread_create(thread_fn fn, void* arg, thread_t* out);
+void thread_join(thread_t* t);
+
+b8 mutex_create(mutex_t* m);
+void mutex_destroy(mutex_t* m);
+void mutex_lock(mutex_t* m);
+void mutex_unlock(mutex_t* m);
+
+b8 condvar_create(condvar_t* c);
+void condvar_destroy(condvar_t* c);
+void condvar_wait(condvar_t* c, mutex_t* m);
+// Returns false if `timeout_ns` passed without a signal.
+b8 condvar_wait_ns(condvar_t* c, mutex_t* m, u64 timeout_ns);
+void condvar_signal(condvar_t* c);
+void condvar_broadcast(condvar_t* c);
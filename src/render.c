@@ -0,0 +1,485 @@
+#include "render.h"
+
+#include "cache.h"
+#include "document.h"
+#include "html.h"
+#include "io.h"
+#include "lib/str.h"
+#include "utf8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RENDER_INITIAL_SOURCE (64 * 1024)
+#define RENDER_INITIAL_BLOCKS 64
+
+// What render_write_blocks puts in {{content}}
+typedef struct render_page {
+    const render_block_t* blocks;
+    u64 count;
+    const char* html;
+} render_page_t;
+
+static char* render_read(render_context_t* ctx, const char* path, u64* size);
+static node_t* render_tree(render_context_t* ctx, char* buffer, u64 size, node_pool_t* pool);
+static b8 render_lookup_blocks(render_context_t* ctx, const char* buffer, u64 size, u64* count);
+static node_t* render_missed_blocks(render_context_t* ctx, u64 count);
+static void render_uncache_at(render_context_t* ctx, u64 count, const char* at);
+static void render_write_spans(sink_t* sink, void* arg);
+static const char* render_node_start(node_t* node, const char* source, u64 size);
+static b8 render_has_header(node_t* node);
+static void render_validate(render_context_t* ctx, char* buffer, u64 size, const char* path);
+static void render_begin(render_context_t* ctx);
+
+b8 render_context_init(render_context_t* ctx, sink_mode_t mode) {
+    char* source = malloc(RENDER_INITIAL_SOURCE);
+    if (source == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for source.\n");
+        return false;
+    }
+    source[0] = '\0';
+    ctx->source = source;
+    ctx->source_capacity = RENDER_INITIAL_SOURCE;
+
+    if (!tokenizer_init_source(&ctx->tokenizer, source, 0)) {
+        free(source);
+        return false;
+    }
+
+    if (!sink_init(&ctx->sink, mode, nullptr)) {
+        tokenizer_shutdown(&ctx->tokenizer);
+        return false;
+    }
+
+    node_pool_init(&ctx->pool);
+    link_table_init(&ctx->links);
+    ctx->renderer = renderer_get(FORMAT_HTML);
+
+    ctx->use_cache = false;
+    ctx->cache_hits = 0;
+    ctx->cache_misses = 0;
+    ctx->gzip = (gzip_options_t){ 0, false };
+    budget_init(&ctx->budget);
+
+    ctx->blocks = nullptr;
+    ctx->block_list = nullptr;
+    ctx->block_capacity = 0;
+
+    return true;
+}
+
+void render_context_shutdown(render_context_t* ctx) {
+    link_table_shutdown(&ctx->links);
+    node_pool_shutdown(&ctx->pool);
+    sink_shutdown(&ctx->sink);
+
+    if (ctx->blocks) {
+        sink_shutdown(&ctx->block_misses);
+        sink_shutdown(&ctx->block_html);
+        free(ctx->block_list);
+        ctx->blocks = nullptr;
+    }
+
+    // The tokenizer might be pointing at a caller's buffer
+    ctx->tokenizer.source = ctx->source;
+    tokenizer_shutdown(&ctx->tokenizer);
+    ctx->source = nullptr;
+}
+
+b8 render_context_use_blocks(render_context_t* ctx, block_cache_t* cache) {
+    if (ctx->blocks) {
+        ctx->blocks = cache;
+        return true;
+    }
+
+    if (!sink_init_memory(&ctx->block_misses)) {
+        return false;
+    }
+    if (!sink_init_memory(&ctx->block_html)) {
+        sink_shutdown(&ctx->block_misses);
+        return false;
+    }
+    ctx->blocks = cache;
+
+    // The same source renders differently through another backend
+    const char* name = renderer_get(FORMAT_HTML)->name;
+    ctx->block_seed = block_cache_hash(name, str_len(name), 0);
+
+    return true;
+}
+
+node_t* render_load(render_context_t* ctx, const char* path) {
+    u64 size;
+    char* source = render_read(ctx, path, &size);
+    if (source == nullptr) {
+        return nullptr;
+    }
+
+    node_t* root = render_parse_cached(ctx, source, size, path);
+    ctx->tokenizer.file_path = path;
+
+    return root;
+}
+
+char* render_reserve(render_context_t* ctx, u64 size) {
+    // Only grow the source buffer, never shrink it
+    char* source = ctx->source;
+    if (size + 1 > ctx->source_capacity) {
+        u64 capacity = ctx->source_capacity;
+        while (capacity < size + 1) capacity *= 2;
+
+        source = realloc(source, capacity);
+        if (source == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for source.\n");
+            return nullptr;
+        }
+        ctx->source = source;
+        ctx->source_capacity = capacity;
+    }
+
+    return source;
+}
+
+node_t* render_parse(render_context_t* ctx, u64 size) {
+    return render_parse_buffer(ctx, ctx->source, size);
+}
+
+node_t* render_parse_buffer(render_context_t* ctx, char* buffer, u64 size) {
+    render_begin(ctx);
+    buffer[size] = '\0';
+    size = lines_normalize(buffer, size);
+
+    return render_tree(ctx, buffer, size, &ctx->pool);
+}
+
+node_t* render_parse_cached(render_context_t* ctx, char* buffer, u64 size, const char* path) {
+    render_begin(ctx);
+    buffer[size] = '\0';
+    size = lines_normalize(buffer, size);
+    render_validate(ctx, buffer, size, path);
+
+    char cache_file[IO_PATH_MAX];
+    if (!ctx->use_cache || !cache_path(path, cache_file, sizeof(cache_file))) {
+        return render_tree(ctx, buffer, size, &ctx->pool);
+    }
+
+    node_pool_reset(&ctx->pool);
+    node_t* root = cache_load(cache_file, buffer, size, &ctx->pool);
+    if (root) {
+        // The definitions are already resolved into the tree
+        link_table_reset(&ctx->links);
+        ctx->cache_hits++;
+        return root;
+    }
+
+    // Missing or stale, parse and replace it. A tree a limit cut short
+    // isn't the document, it's not kept.
+    ctx->cache_misses++;
+    root = render_tree(ctx, buffer, size, &ctx->pool);
+    if (root && ctx->budget.status == BUDGET_OK && !cache_save(cache_file, root, buffer, size)) {
+        fprintf(stderr, "Couldn't write cache: %s\n", cache_file);
+    }
+
+    return root;
+}
+
+node_t* render_parse_into(render_context_t* ctx, char* buffer, u64 size, const char* path, node_pool_t* pool) {
+    render_begin(ctx);
+    buffer[size] = '\0';
+    size = lines_normalize(buffer, size);
+    render_validate(ctx, buffer, size, path);
+
+    return render_tree(ctx, buffer, size, pool);
+}
+
+void render_write_blocks(render_context_t* ctx, char* buffer, u64 size, const char* path, sink_t* sink,
+                         const page_t* page) {
+    render_begin(ctx);
+    buffer[size] = '\0';
+    size = lines_normalize(buffer, size);
+    if (path) {
+        render_validate(ctx, buffer, size, path);
+    }
+
+    u64 count = 0;
+    node_t* root = nullptr;
+    if (render_lookup_blocks(ctx, buffer, size, &count)) {
+        root = render_missed_blocks(ctx, count);
+    }
+
+    // Out of memory somewhere, render it all the usual way
+    if (root == nullptr) {
+        root = render_tree(ctx, buffer, size, &ctx->pool);
+        if (root == nullptr) {
+            sink->failed = true;
+        } else if (page) {
+            html_write_document(root, sink, page);
+        } else {
+            node_to_html(root, sink);
+        }
+        return;
+    }
+
+    // The tree only has the blocks that missed, but all the headers
+    render_page_t spans = { ctx->block_list, count, ctx->block_html.buffer };
+    if (page) {
+        const template_t* t = page->template ? page->template : template_default();
+        template_write_with(t, root, sink, page->title, page->css, render_write_spans, &spans);
+    } else {
+        render_write_spans(sink, &spans);
+    }
+
+    // Kept for the documents after this one
+    for (u64 i = 0; i < count; ++i) {
+        render_block_t* b = &ctx->block_list[i];
+        if (b->hit || !b->cacheable) continue;
+
+        block_cache_put(ctx->blocks, b->hash, ctx->block_misses.buffer + b->miss_offset, b->length,
+            ctx->block_html.buffer + b->html_offset, b->html_length);
+    }
+}
+
+static char* render_read(render_context_t* ctx, const char* path, u64* size) {
+    // Into the context's source buffer, which keeps whatever it grew to
+    i64 file_size = load_source(path, &ctx->source, &ctx->source_capacity);
+    if (file_size == -1) {
+        return nullptr;
+    }
+
+    *size = (u64)file_size;
+    return ctx->source;
+}
+
+static node_t* render_tree(render_context_t* ctx, char* buffer, u64 size, node_pool_t* pool) {
+    tokenizer_reset(&ctx->tokenizer, buffer, size);
+    while (next_token(&ctx->tokenizer));
+
+    node_pool_reset(pool);
+    return parse_md(&ctx->tokenizer, pool, &ctx->links);
+}
+
+static void render_validate(render_context_t* ctx, char* buffer, u64 size, const char* path) {
+    // Bad UTF-8 still renders, but say where it is
+    u64 error_offset, line, column;
+    tokenizer_reset(&ctx->tokenizer, buffer, size);
+    if (!utf8_validate(buffer, size, &error_offset) &&
+        tokenizer_locate(&ctx->tokenizer, buffer + error_offset, &line, &column)) {
+        fprintf(stderr, "%s:%llu:%llu: invalid UTF-8 (byte %llu)\n", path, line, column, error_offset);
+    }
+}
+
+b8 render_file(render_context_t* ctx, const char* in_file, const char* out_file, const page_t* page) {
+    if (ctx->blocks) {
+        u64 size;
+        char* source = render_read(ctx, in_file, &size);
+        if (source == nullptr || !sink_open(&ctx->sink, out_file, &ctx->gzip)) {
+            return false;
+        }
+
+        render_write_blocks(ctx, source, size, in_file, &ctx->sink, page);
+        ctx->tokenizer.file_path = in_file;
+
+        return sink_close(&ctx->sink);
+    }
+
+    node_t* root = render_load(ctx, in_file);
+    if (root == nullptr) {
+        return false;
+    }
+
+    if (!sink_open(&ctx->sink, out_file, &ctx->gzip)) {
+        return false;
+    }
+
+    ctx->renderer->write_document(root, &ctx->sink, page);
+
+    b8 ok = sink_close(&ctx->sink);
+    if (ctx->budget.status != BUDGET_OK) {
+        fprintf(stderr, "%s: render stopped at the %s\n", in_file, budget_status_str(ctx->budget.status));
+        if (!ctx->budget.partial) {
+            renderer_remove_file(out_file, &ctx->gzip);
+        }
+        ok = false;
+    }
+
+    return ok;
+}
+
+static b8 render_lookup_blocks(render_context_t* ctx, const char* buffer, u64 size, u64* count) {
+    sink_reset(&ctx->block_misses, nullptr);
+    sink_reset(&ctx->block_html, nullptr);
+
+    // Hits go straight into the HTML, misses are gathered to be parsed
+    u64 n = 0;
+    for (u64 offset = 0; offset < size; ) {
+        if (n == ctx->block_capacity) {
+            u64 capacity = ctx->block_capacity ? ctx->block_capacity * 2 : RENDER_INITIAL_BLOCKS;
+            render_block_t* list = realloc(ctx->block_list, sizeof(render_block_t) * capacity);
+            if (list == nullptr) {
+                return false;
+            }
+            ctx->block_list = list;
+            ctx->block_capacity = capacity;
+        }
+
+        render_block_t* b = &ctx->block_list[n++];
+        b->offset = offset;
+        b->length = document_block_split(buffer + offset, size - offset);
+        b->hash = block_cache_hash(buffer + offset, b->length, ctx->block_seed);
+        b->miss_offset = ctx->block_misses.length;
+        b->html_offset = ctx->block_html.length;
+        b->cacheable = false;
+
+        b->hit = block_cache_get(ctx->blocks, b->hash, buffer + offset, b->length, &ctx->block_html);
+        b->html_length = ctx->block_html.length - b->html_offset;
+        if (!b->hit) {
+            sink_copy(&ctx->block_misses, buffer + offset, b->length);
+        }
+
+        offset += b->length;
+    }
+
+    // The tokenizer wants a terminator
+    sink_copy(&ctx->block_misses, "", 1);
+
+    *count = n;
+    return !ctx->block_misses.failed && !ctx->block_html.failed;
+}
+
+static node_t* render_missed_blocks(render_context_t* ctx, u64 count) {
+    // Blocks parse the same on their own, so the misses parse as one
+    // document: definitions can't be in a hit, since those aren't cached
+    char* misses = ctx->block_misses.buffer;
+    u64 size = ctx->block_misses.length - 1;
+    node_t* root = render_tree(ctx, misses, size, &ctx->pool);
+    if (root == nullptr) {
+        return nullptr;
+    }
+
+    b8 hits = false;
+    for (u64 i = 0; i < count; ++i) {
+        hits = hits || ctx->block_list[i].hit;
+    }
+
+    // Each block's nodes, up to the first one that starts in the next
+    // block. A node without any text of its own could belong to either,
+    // so neither is cached, and if there are hits it could be on either
+    // side of them: that document renders the usual way.
+    node_t* child = root->children;
+    b8 unsure = false;
+    for (u64 i = 0; i < count; ++i) {
+        render_block_t* b = &ctx->block_list[i];
+        if (b->hit) continue;
+
+        const char* end = misses + b->miss_offset + b->length;
+        b->html_offset = ctx->block_html.length;
+        b->cacheable = !unsure;
+        unsure = false;
+
+        for (; child; child = child->next) {
+            const char* start = render_node_start(child, misses, size);
+            if (start && start >= end) break;
+
+            if (start == nullptr) {
+                if (hits) return nullptr;
+                b->cacheable = false;
+                unsure = true;
+            }
+            // The table of contents needs the headers in the tree
+            if (render_has_header(child)) {
+                b->cacheable = false;
+            }
+
+            node_to_html(child, &ctx->block_html);
+        }
+
+        b->html_length = ctx->block_html.length - b->html_offset;
+    }
+
+    // Nor is anything that references a link or could define one. A
+    // definition that lost to an earlier one isn't in the table, but
+    // it would win in a document of its own.
+    token_array_t* tokens = &ctx->tokenizer.token_array;
+    for (u64 i = 0; i + 1 < tokens->count; ++i) {
+        token_t* next = &tokens->tokens[i + 1];
+        if (tokens->tokens[i].type == TOKEN_SQBR_CLOSE && next->type == TOKEN_TEXT && next->value.data[0] == ':') {
+            render_uncache_at(ctx, count, tokens->tokens[i].value.data);
+        }
+    }
+    for (u64 i = 0; i < ctx->links.fixup_count; ++i) {
+        render_uncache_at(ctx, count, ctx->links.fixups[i].label.data);
+    }
+
+    return ctx->block_html.failed ? nullptr : root;
+}
+
+static void render_uncache_at(render_context_t* ctx, u64 count, const char* at) {
+    const char* misses = ctx->block_misses.buffer;
+    if (at < misses || at >= misses + ctx->block_misses.length) {
+        return;
+    }
+
+    // Binary search for the last block that starts at or before `at`
+    u64 offset = (u64)(at - misses);
+    u64 low = 0;
+    u64 high = count;
+    while (high - low > 1) {
+        u64 mid = low + (high - low) / 2;
+        if (ctx->block_list[mid].miss_offset <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    ctx->block_list[low].cacheable = false;
+}
+
+static void render_write_spans(sink_t* sink, void* arg) {
+    const render_page_t* p = arg;
+
+    // Every span in document order, hits and misses alike
+    for (u64 i = 0; i < p->count; ++i) {
+        sink_write(sink, p->html + p->blocks[i].html_offset, p->blocks[i].html_length);
+    }
+}
+
+static const char* render_node_start(node_t* node, const char* source, u64 size) {
+    // Same as where parallel renders split: a reference link's url is
+    // wherever its definition is, so urls don't count
+    if (node->type == NODE_URL || node->type == NODE_TITLE) {
+        return nullptr;
+    }
+    if (node->value.data >= source && node->value.data < source + size) {
+        return node->value.data;
+    }
+
+    for (node_t* child = node->children; child; child = child->next) {
+        const char* start = render_node_start(child, source, size);
+        if (start) return start;
+    }
+
+    return nullptr;
+}
+
+static b8 render_has_header(node_t* node) {
+    if (node->type == NODE_HEADER) {
+        return true;
+    }
+
+    for (node_t* child = node->children; child; child = child->next) {
+        if (render_has_header(child)) return true;
+    }
+
+    return false;
+}
+
+static void render_begin(render_context_t* ctx) {
+    // The clock starts with the parse, and only runs if there's a limit
+    budget_t* budget = budget_enabled(&ctx->budget) ? &ctx->budget : nullptr;
+    if (budget) {
+        budget_start(budget);
+    }
+    ctx->tokenizer.budget = budget;
+    ctx->sink.budget = budget;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "types.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "sink.h"
+#include "renderer.h"
+#include "blocks.h"
+
+// A top-level block of the document render_write_blocks is on
+typedef struct render_block {
+    // In the document's source
+    u64 offset;
+    u64 length;
+    u64 hash;
+    // Where its source is in `block_misses` if it wasn't cached (hits
+    // get the offset of the next miss, so the list stays sorted on it)
+    u64 miss_offset;
+    // Its HTML in `block_html`
+    u64 html_offset;
+    u64 html_length;
+    b8 hit;
+    b8 cacheable;
+} render_block_t;
+
+// Everything a render needs, kept alive between runs so repeated
+// renders (watch mode, servers) reuse the source buffer, the token
+// array, the node chunks, the link table and the output buffer instead of allocating
+// them again for every document.
+typedef struct render_context {
+    tokenizer_t tokenizer;
+    char* source;
+    u64 source_capacity;
+
+    node_pool_t pool;
+    link_table_t links;
+    sink_t sink;
+
+    // HTML unless the caller picks another backend
+    const renderer_t* renderer;
+
+    // Load trees from (and save them to) the cache next to each input
+    b8 use_cache;
+    u64 cache_hits;
+    u64 cache_misses;
+
+    // Rendered blocks shared with other documents and contexts, see
+    // render_context_use_blocks. nullptr renders every block.
+    block_cache_t* blocks;
+    u64 block_seed;
+    render_block_t* block_list;
+    u64 block_capacity;
+    // The source of the blocks that missed, and every block's HTML
+    sink_t block_misses;
+    sink_t block_html;
+
+    // render_file also writes `<output>.gz` when the level is set
+    gzip_options_t gzip;
+
+    // Limits for every parse and render through the context. After a
+    // render, `budget.status` says whether one of them stopped it.
+    budget_t budget;
+} render_context_t;
+
+b8 render_context_init(render_context_t* ctx, sink_mode_t mode);
+void render_context_shutdown(render_context_t* ctx);
+
+// Renders HTML block by block through `cache` from here on (render_file
+// and render_write_blocks). The cache isn't owned by the context.
+b8 render_context_use_blocks(render_context_t* ctx, block_cache_t* cache);
+
+// Loads `path` into the context and builds the tree.
+node_t* render_load(render_context_t* ctx, const char* path);
+
+// For sources that don't come from a file: reserve room for `size`
+// bytes, fill the returned buffer, then parse it.
+char* render_reserve(render_context_t* ctx, u64 size);
+node_t* render_parse(render_context_t* ctx, u64 size);
+
+// Parses a buffer the caller owns, which must have room for a null
+// terminator at `size`. Line endings are normalized to `\n` in place
+// first. Only the tokens and nodes come from `ctx`.
+node_t* render_parse_buffer(render_context_t* ctx, char* buffer, u64 size);
+
+// Like render_parse_buffer, but checks the encoding (a warning names
+// the first bad byte), tries the cache for `path` first and
+// saves the tree there if it had to be parsed. Without `use_cache`
+// it's just render_parse_buffer.
+node_t* render_parse_cached(render_context_t* ctx, char* buffer, u64 size, const char* path);
+
+// Like render_parse_cached without the cache, with the nodes coming
+// from `pool` instead of the context, so the tree outlives the next
+// parse (book mode keeps every chapter's tree until the page is out).
+node_t* render_parse_into(render_context_t* ctx, char* buffer, u64 size, const char* path, node_pool_t* pool);
+
+// Writes the HTML page for a buffer like render_parse_cached (`path`
+// can be nullptr), or just the content if `page` is nullptr, taking
+// every block it can from the context's block cache. The blocks that
+// missed are parsed and rendered together, then the ones that render
+// the same anywhere go into the cache. Without limits only, and the
+// tree (ctx->pool) only holds the blocks that missed afterwards.
+void render_write_blocks(render_context_t* ctx, char* buffer, u64 size, const char* path, sink_t* sink,
+                         const page_t* page);
+
+// Returns false if a limit stopped the render too. The output is
+// removed then, unless the budget keeps partial output.
+b8 render_file(render_context_t* ctx, const char* in_file, const char* out_file, const page_t* page);
@@ -0,0 +1,64 @@
+#include "renderer.h"
+
+#include "html.h"
+#include "text.h"
+#include "json.h"
+#include "io.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+
+static const renderer_t renderers[] = {
+    [FORMAT_HTML] = { "html", ".html", "out.html", node_to_html, html_write_document },
+    [FORMAT_TEXT] = { "text", ".txt", "out.txt", node_to_text, text_write_document },
+    [FORMAT_JSON] = { "json", ".json", "out.json", node_to_json, json_write_document }
+};
+
+const renderer_t* renderer_get(output_format_t format) {
+    return &renderers[format];
+}
+
+b8 renderer_find(const char* name, output_format_t* format) {
+    for (u32 i = 0; i < sizeof(renderers) / sizeof(renderers[0]); ++i) {
+        if (str_cmp(name, renderers[i].name) == 0) {
+            *format = (output_format_t)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+b8 renderer_write_file(const renderer_t* r, node_t* root, const char* out_file, const page_t* page,
+                       sink_mode_t mode, const gzip_options_t* gzip, budget_t* budget) {
+    sink_t sink;
+    if (!sink_init(&sink, mode, nullptr)) {
+        return false;
+    }
+    sink.budget = budget;
+
+    if (!sink_open(&sink, out_file, gzip)) {
+        sink_shutdown(&sink);
+        return false;
+    }
+
+    r->write_document(root, &sink, page);
+
+    b8 ok = sink_close(&sink);
+    sink_shutdown(&sink);
+
+    return ok;
+}
+
+void renderer_remove_file(const char* out_file, const gzip_options_t* gzip) {
+    if (gzip == nullptr || gzip->level == 0 || !gzip->only) {
+        remove(out_file);
+    }
+
+    char gz_file[IO_PATH_MAX];
+    if (gzip && gzip->level > 0 && str_len(out_file) + 4 <= sizeof(gz_file)) {
+        str_cpy(gz_file, out_file);
+        str_cat(gz_file, ".gz");
+        remove(gz_file);
+    }
+}
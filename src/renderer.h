@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+#include "parser.h"
+#include "sink.h"
+#include "template.h"
+
+typedef enum {
+    FORMAT_HTML,
+    FORMAT_TEXT,
+    FORMAT_JSON
+} output_format_t;
+
+// An output backend. They all write through a sink, and reference the
+// tree's text in the source instead of copying it where they can.
+typedef struct renderer {
+    const char* name;
+    // Replaces `.md` for batch and watch outputs
+    const char* extension;
+    // Used when no -o is given
+    const char* default_output;
+
+    // Just the tree (a fragment, a single block, a daemon reply)
+    void (*write_node)(node_t* node, sink_t* sink);
+    // A complete output file. Backends without a page ignore `page`.
+    void (*write_document)(node_t* root, sink_t* sink, const page_t* page);
+} renderer_t;
+
+const renderer_t* renderer_get(output_format_t format);
+
+// Looks a backend up by name (`html`, `text`, `json`).
+b8 renderer_find(const char* name, output_format_t* format);
+
+// `budget` (can be nullptr) is checked between blocks while writing.
+b8 renderer_write_file(const renderer_t* r, node_t* root, const char* out_file, const page_t* page,
+                       sink_mode_t mode, const gzip_options_t* gzip, budget_t* budget);
+
+// Removes an output and its compressed copy, after a render that stopped.
+void renderer_remove_file(const char* out_file, const gzip_options_t* gzip);
@@ -0,0 +1,388 @@
+#include "search.h"
+
+#include "html.h"
+#include "io.h"
+#include "lib/mem.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SEARCH_CHUNK_SIZE (256 * 1024)
+#define SEARCH_TABLE_MIN 1024
+#define SEARCH_LIST_MIN 64
+
+static void search_add_node(search_index_t* s, node_t* node, u32* section);
+static void search_add_text(search_index_t* s, str_view_t text, u32 section);
+static void search_add_term(search_index_t* s, const char* term, u32 length, u32 section);
+static b8 search_add_section(search_index_t* s, const char* anchor, u64 length, u32 document);
+static void* search_alloc(search_index_t* s, u64 size);
+static const char* search_store(search_index_t* s, const char* data, u64 length);
+static b8 search_grow(void** items, u64* capacity, u64 size);
+static b8 search_table_grow(search_index_t* s);
+static u64 search_hash(const char* data, u64 length);
+static b8 is_term_char(char c);
+static i32 compare_terms(const void* a, const void* b);
+
+void search_index_init(search_index_t* s) {
+    mem_set(s, 0, sizeof(search_index_t));
+}
+
+void search_index_shutdown(search_index_t* s) {
+    search_chunk_t* chunk = s->chunks;
+    while (chunk) {
+        search_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(s->terms);
+    free(s->sections);
+    free(s->documents);
+    mem_set(s, 0, sizeof(search_index_t));
+}
+
+b8 search_index_add(search_index_t* s, const char* name, node_t* root) {
+    if (s->failed) {
+        return false;
+    }
+
+    if (s->document_count == s->document_capacity &&
+        !search_grow((void**)&s->documents, &s->document_capacity, sizeof(search_document_t))) {
+        s->failed = true;
+        return false;
+    }
+
+    u32 document = (u32)s->document_count;
+    search_document_t* d = &s->documents[s->document_count++];
+    d->name = search_store(s, name, str_len(name));
+    d->name_length = (u32)str_len(name);
+    d->first_section = (u32)s->section_count;
+
+    // The top of the page, until the first header
+    u32 section = (u32)s->section_count;
+    if (!search_add_section(s, "", 0, document)) {
+        return false;
+    }
+
+    for (node_t* child = root->children; child; child = child->next) {
+        search_add_node(s, child, &section);
+    }
+
+    return !s->failed;
+}
+
+b8 search_index_write(search_index_t* s, const char* path) {
+    if (s->failed) {
+        return false;
+    }
+
+    // Terms sorted on their bytes, so the file can be binary searched
+    search_term_t** sorted = malloc(sizeof(search_term_t*) * (s->term_count ? s->term_count : 1));
+    search_file_document_t* documents = malloc(sizeof(search_file_document_t) * (s->document_count ? s->document_count : 1));
+    search_file_section_t* sections = malloc(sizeof(search_file_section_t) * (s->section_count ? s->section_count : 1));
+    search_file_term_t* terms = malloc(sizeof(search_file_term_t) * (s->term_count ? s->term_count : 1));
+    search_file_posting_t* postings = malloc(sizeof(search_file_posting_t) * (s->posting_count ? s->posting_count : 1));
+    char* strings = nullptr;
+    b8 ok = sorted && documents && sections && terms && postings;
+
+    u64 count = 0;
+    for (u64 i = 0; ok && i < s->term_capacity; ++i) {
+        if (s->terms[i].hash != 0) sorted[count++] = &s->terms[i];
+    }
+    if (ok) {
+        qsort(sorted, count, sizeof(search_term_t*), compare_terms);
+    }
+
+    // Every string once, in the order the arrays use them
+    u64 strings_size = 0;
+    for (u64 i = 0; ok && i < s->document_count; ++i) strings_size += s->documents[i].name_length;
+    for (u64 i = 0; ok && i < s->section_count; ++i) strings_size += s->sections[i].anchor_length;
+    for (u64 i = 0; ok && i < count; ++i) strings_size += sorted[i]->length;
+    strings = ok ? malloc(strings_size ? strings_size : 1) : nullptr;
+    ok = ok && strings;
+
+    u64 offset = 0;
+    for (u64 i = 0; ok && i < s->document_count; ++i) {
+        const search_document_t* d = &s->documents[i];
+        documents[i] = (search_file_document_t){ offset, d->name_length, d->first_section };
+        mem_copy(strings + offset, (void*)d->name, d->name_length);
+        offset += d->name_length;
+    }
+    for (u64 i = 0; ok && i < s->section_count; ++i) {
+        const search_section_t* section = &s->sections[i];
+        sections[i] = (search_file_section_t){ offset, section->anchor_length, section->document };
+        mem_copy(strings + offset, (void*)section->anchor, section->anchor_length);
+        offset += section->anchor_length;
+    }
+
+    u64 posting = 0;
+    for (u64 i = 0; ok && i < count; ++i) {
+        const search_term_t* t = sorted[i];
+        terms[i] = (search_file_term_t){ offset, t->length, t->posting_count, posting };
+        mem_copy(strings + offset, (void*)t->text, t->length);
+        offset += t->length;
+
+        // The list is newest first, it goes out oldest first
+        posting += t->posting_count;
+        u64 at = posting;
+        for (search_posting_t* p = t->postings; p; p = p->next) {
+            postings[--at] = (search_file_posting_t){ p->section, p->count };
+        }
+    }
+
+    search_file_header_t header = {
+        .magic = { SEARCH_MAGIC[0], SEARCH_MAGIC[1], SEARCH_MAGIC[2], SEARCH_MAGIC[3] },
+        .version = SEARCH_VERSION,
+        .document_count = s->document_count,
+        .section_count = s->section_count,
+        .term_count = count,
+        .posting_count = posting,
+        .strings_size = strings_size
+    };
+
+    // Written next to the real one and moved over it, so a reader
+    // never maps a half written file
+    char temp_path[IO_PATH_MAX];
+    ok = ok && str_len(path) + 5 <= sizeof(temp_path);
+    if (ok) {
+        str_cpy(temp_path, path);
+        str_cat(temp_path, ".tmp");
+    }
+
+    FILE* file = ok ? fopen(temp_path, "wb") : nullptr;
+    if (file) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(documents, sizeof(search_file_document_t), s->document_count, file) == s->document_count &&
+            fwrite(sections, sizeof(search_file_section_t), s->section_count, file) == s->section_count &&
+            fwrite(terms, sizeof(search_file_term_t), count, file) == count &&
+            fwrite(postings, sizeof(search_file_posting_t), posting, file) == posting &&
+            fwrite(strings, 1, strings_size, file) == strings_size;
+        ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+        // rename doesn't replace an existing file here
+        if (ok) remove(path);
+#endif
+        if (!ok || rename(temp_path, path) != 0) {
+            remove(temp_path);
+            ok = false;
+        }
+    } else {
+        ok = false;
+    }
+
+    free(sorted);
+    free(documents);
+    free(sections);
+    free(terms);
+    free(postings);
+    free(strings);
+
+    return ok;
+}
+
+static void search_add_node(search_index_t* s, node_t* node, u32* section) {
+    switch (node->type) {
+        case NODE_HEADER: {
+            // Everything up to the next header is found under its anchor,
+            // the header's own text too
+            if (node->children == nullptr) return;
+
+            char* slug = nullptr;
+            str_view_t anchor = html_header_anchor(node, &slug);
+            u32 document = (u32)(s->document_count - 1);
+            if (search_add_section(s, anchor.data, anchor.length, document)) {
+                *section = (u32)(s->section_count - 1);
+            }
+            free(slug);
+        } break;
+
+        case NODE_INNER_TEXT: {
+            search_add_text(s, node->value, *section);
+        } break;
+
+        // Where a link goes isn't what it says
+        case NODE_URL:
+        case NODE_TITLE:
+            return;
+
+        default:
+            break;
+    }
+
+    for (node_t* child = node->children; child; child = child->next) {
+        search_add_node(s, child, section);
+    }
+}
+
+static void search_add_text(search_index_t* s, str_view_t text, u32 section) {
+    char term[SEARCH_MAX_TERM];
+
+    u64 i = 0;
+    while (i < text.length) {
+        while (i < text.length && !is_term_char(text.data[i])) i++;
+
+        u64 start = i;
+        while (i < text.length && is_term_char(text.data[i])) i++;
+
+        u64 length = i - start;
+        if (length == 0 || length > SEARCH_MAX_TERM) continue;
+
+        for (u64 j = 0; j < length; ++j) {
+            char c = text.data[start + j];
+            term[j] = (c >= 'A' && c <= 'Z') ? c + 32 : c;
+        }
+        search_add_term(s, term, (u32)length, section);
+    }
+}
+
+static void search_add_term(search_index_t* s, const char* term, u32 length, u32 section) {
+    // Stay under 3/4 full so probe runs stay short
+    if ((s->term_count + 1) * 4 > s->term_capacity * 3 && !search_table_grow(s)) {
+        s->failed = true;
+        return;
+    }
+
+    u64 hash = search_hash(term, length);
+    u64 mask = s->term_capacity - 1;
+    u64 i = hash & mask;
+    while (s->terms[i].hash != 0 &&
+           (s->terms[i].hash != hash || s->terms[i].length != length || !mem_equal(s->terms[i].text, term, length))) {
+        i = (i + 1) & mask;
+    }
+
+    search_term_t* t = &s->terms[i];
+    if (t->hash == 0) {
+        const char* text = search_store(s, term, length);
+        if (text == nullptr) return;
+
+        *t = (search_term_t){ hash, text, length, 0, nullptr };
+        s->term_count++;
+    }
+
+    // Sections only ever grow, so the newest posting is the only one
+    // that can be for this section
+    if (t->postings && t->postings->section == section) {
+        t->postings->count++;
+        return;
+    }
+
+    search_posting_t* p = search_alloc(s, sizeof(search_posting_t));
+    if (p == nullptr) return;
+
+    *p = (search_posting_t){ t->postings, section, 1 };
+    t->postings = p;
+    t->posting_count++;
+    s->posting_count++;
+}
+
+static b8 search_add_section(search_index_t* s, const char* anchor, u64 length, u32 document) {
+    if (s->section_count == s->section_capacity &&
+        !search_grow((void**)&s->sections, &s->section_capacity, sizeof(search_section_t))) {
+        s->failed = true;
+        return false;
+    }
+
+    const char* stored = search_store(s, anchor, length);
+    if (stored == nullptr) {
+        return false;
+    }
+
+    s->sections[s->section_count++] = (search_section_t){ stored, (u32)length, document };
+    return true;
+}
+
+static void* search_alloc(search_index_t* s, u64 size) {
+    // Everything stays 8 byte aligned for the postings
+    size = (size + 7) & ~7ULL;
+
+    search_chunk_t* chunk = s->chunks;
+    if (chunk == nullptr || chunk->used + size > chunk->capacity) {
+        u64 capacity = size > SEARCH_CHUNK_SIZE ? size : SEARCH_CHUNK_SIZE;
+        chunk = malloc(sizeof(search_chunk_t) + capacity);
+        if (chunk == nullptr) {
+            s->failed = true;
+            return nullptr;
+        }
+        chunk->next = s->chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        s->chunks = chunk;
+    }
+
+    void* data = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return data;
+}
+
+static const char* search_store(search_index_t* s, const char* data, u64 length) {
+    char* copy = search_alloc(s, length ? length : 1);
+    if (copy) {
+        mem_copy(copy, (void*)data, length);
+    }
+
+    return copy;
+}
+
+static b8 search_grow(void** items, u64* capacity, u64 size) {
+    u64 grown = *capacity ? *capacity * 2 : SEARCH_LIST_MIN;
+    void* list = realloc(*items, size * grown);
+    if (list == nullptr) {
+        return false;
+    }
+
+    *items = list;
+    *capacity = grown;
+    return true;
+}
+
+static b8 search_table_grow(search_index_t* s) {
+    u64 capacity = s->term_capacity ? s->term_capacity * 2 : SEARCH_TABLE_MIN;
+    search_term_t* terms = calloc(capacity, sizeof(search_term_t));
+    if (terms == nullptr) {
+        return false;
+    }
+
+    for (u64 i = 0; i < s->term_capacity; ++i) {
+        if (s->terms[i].hash == 0) continue;
+
+        u64 j = s->terms[i].hash & (capacity - 1);
+        while (terms[j].hash != 0) j = (j + 1) & (capacity - 1);
+        terms[j] = s->terms[i];
+    }
+
+    free(s->terms);
+    s->terms = terms;
+    s->term_capacity = capacity;
+
+    return true;
+}
+
+static u64 search_hash(const char* data, u64 length) {
+    // FNV-1a, 0 marks empty slots
+    u64 hash = 14695981039346656037ULL;
+    for (u64 i = 0; i < length; ++i) {
+        hash ^= (u8)data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+static b8 is_term_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (u8)c >= 0x80;
+}
+
+static i32 compare_terms(const void* a, const void* b) {
+    const search_term_t* x = *(search_term_t* const*)a;
+    const search_term_t* y = *(search_term_t* const*)b;
+
+    u32 length = x->length < y->length ? x->length : y->length;
+    for (u32 i = 0; i < length; ++i) {
+        if (x->text[i] != y->text[i]) return (u8)x->text[i] < (u8)y->text[i] ? -1 : 1;
+    }
+
+    return (x->length > y->length) - (x->length < y->length);
+}
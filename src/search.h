@@ -0,0 +1,127 @@
+#pragma once
+
+#include "types.h"
+#include "parser.h"
+
+// Full-text index of the documents a run renders, for a site search:
+// every term with the sections (header anchors) it's in and how often.
+// Built from each tree while its source is still around, so the pages
+// never have to be read back.
+//
+// Terms are runs of ASCII letters and digits and non-ASCII bytes (like
+// anchors), ASCII lowercased. Longer runs than SEARCH_MAX_TERM (urls,
+// hashes) are left out. Text before the first header is in a section
+// with an empty anchor, the top of the page.
+//
+// The file is a header and five arrays: documents, sections, terms
+// sorted on their bytes, postings grouped by term in section order,
+// then the strings. Everything refers to the rest by index or by
+// offset into the strings, so it's searched as mapped (a binary search
+// over the terms), nothing needs fixing up.
+
+#define SEARCH_MAGIC "MDTS"
+#define SEARCH_VERSION 1
+#define SEARCH_MAX_TERM 64
+
+// Native byte order, like the tree cache
+typedef struct search_file_header {
+    char magic[4];
+    u32 version;
+    u64 document_count;
+    u64 section_count;
+    u64 term_count;
+    u64 posting_count;
+    u64 strings_size;
+} search_file_header_t;
+
+typedef struct search_file_document {
+    // The output path
+    u64 name;
+    u32 name_length;
+    u32 first_section;
+} search_file_document_t;
+
+typedef struct search_file_section {
+    u64 anchor;
+    u32 anchor_length;
+    u32 document;
+} search_file_section_t;
+
+typedef struct search_file_term {
+    u64 text;
+    u32 length;
+    u32 posting_count;
+    u64 first_posting;
+} search_file_term_t;
+
+typedef struct search_file_posting {
+    u32 section;
+    u32 count;
+} search_file_posting_t;
+
+// Term, document and section strings and the postings come from
+// chunks that are only freed all at once
+typedef struct search_chunk {
+    struct search_chunk* next;
+    u64 used;
+    u64 capacity;
+    _Alignas(8) char data[];
+} search_chunk_t;
+
+typedef struct search_posting {
+    struct search_posting* next;
+    u32 section;
+    u32 count;
+} search_posting_t;
+
+typedef struct search_term {
+    // Empty slot if 0
+    u64 hash;
+    const char* text;
+    u32 length;
+    u32 posting_count;
+    // Newest section first while building
+    search_posting_t* postings;
+} search_term_t;
+
+typedef struct search_section {
+    const char* anchor;
+    u32 anchor_length;
+    u32 document;
+} search_section_t;
+
+typedef struct search_document {
+    const char* name;
+    u32 name_length;
+    u32 first_section;
+} search_document_t;
+
+typedef struct search_index {
+    search_chunk_t* chunks;
+
+    // Open addressing with linear probing, power of two capacity
+    search_term_t* terms;
+    u64 term_capacity;
+    u64 term_count;
+    u64 posting_count;
+
+    search_section_t* sections;
+    u64 section_count;
+    u64 section_capacity;
+
+    search_document_t* documents;
+    u64 document_count;
+    u64 document_capacity;
+
+    // Set if something couldn't be allocated, the index isn't written then
+    b8 failed;
+} search_index_t;
+
+void search_index_init(search_index_t* s);
+void search_index_shutdown(search_index_t* s);
+
+// Adds the text of a document under the name it's found by (its output).
+b8 search_index_add(search_index_t* s, const char* name, node_t* root);
+
+// Returns false (and leaves no file behind) if it can't be written.
+b8 search_index_write(search_index_t* s, const char* path);
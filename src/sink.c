@@ -0,0 +1,564 @@
+#include "sink.h"
+
+#include "lib/mem.h"
+
+#include <stdlib.h>
+#include <limits.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#ifdef MDT_ZLIB
+#include <zlib.h>
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define SINK_PATH_MAX 4096
+
+#ifdef MDT_ZLIB
+
+#define SINK_GZIP_CHUNK (64 * 1024)
+
+typedef struct sink_gzip {
+    z_stream stream;
+    i32 level;
+    b8 active;
+
+    // Compressed bytes are written to `file` whenever the buffer
+    // fills up, or all kept in the buffer if there's no file
+    FILE* file;
+    char* buffer;
+    u64 length;
+    u64 capacity;
+} sink_gzip_t;
+
+static b8 sink_gzip_drain(sink_t* s, sink_gzip_t* g);
+
+#endif
+
+static void sink_flush_buffered(sink_t* s);
+static void sink_flush_gather(sink_t* s);
+static void sink_push_iov(sink_t* s, const char* data, u64 length);
+static void sink_gzip_feed(sink_t* s, const char* data, u64 length, b8 finish);
+static FILE* sink_gzip_file(sink_t* s);
+static void sink_gzip_free(sink_t* s);
+
+b8 sink_init(sink_t* s, sink_mode_t mode, FILE* file) {
+    s->mode = mode;
+    s->file = file;
+    s->in_memory = false;
+
+    s->buffer = malloc(SINK_BUFFER_SIZE);
+    if (s->buffer == nullptr) {
+        fprintf(stderr, "Failed to allocate memory for output buffer.\n");
+        return false;
+    }
+    s->capacity = SINK_BUFFER_SIZE;
+    s->length = 0;
+
+    s->iov = nullptr;
+    s->iov_count = 0;
+    s->iov_capacity = 0;
+
+    if (mode == SINK_GATHER) {
+        s->iov = malloc(sizeof(sink_iov_t) * IOV_MAX);
+        if (s->iov == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for output spans.\n");
+            free(s->buffer);
+            return false;
+        }
+        s->iov_capacity = IOV_MAX;
+    }
+
+    s->gzip = nullptr;
+
+    s->produced = 0;
+    s->budget = nullptr;
+
+    s->bytes_written = 0;
+    s->write_calls = 0;
+    s->failed = false;
+
+    return true;
+}
+
+b8 sink_init_memory(sink_t* s) {
+    if (!sink_init(s, SINK_BUFFERED, nullptr)) {
+        return false;
+    }
+    s->in_memory = true;
+
+    return true;
+}
+
+void sink_shutdown(sink_t* s) {
+    sink_flush(s);
+
+    free(s->buffer);
+    free(s->iov);
+    sink_gzip_free(s);
+
+    s->buffer = nullptr;
+    s->iov = nullptr;
+}
+
+void sink_reset(sink_t* s, FILE* file) {
+    // Point an existing sink (and its buffers) at a new file
+    s->file = file;
+    s->length = 0;
+    s->iov_count = 0;
+    s->produced = 0;
+
+    s->bytes_written = 0;
+    s->write_calls = 0;
+    s->failed = false;
+}
+
+b8 sink_open(sink_t* s, const char* path, const gzip_options_t* gzip) {
+    b8 compress = gzip && gzip->level > 0;
+
+    FILE* file = nullptr;
+    if (!compress || !gzip->only) {
+        file = fopen(path, "wb");
+        if (!file) {
+            fprintf(stderr, "Couldn't open file for writing: %s\n", path);
+            return false;
+        }
+    }
+    sink_reset(s, file);
+
+    if (compress) {
+        char gz_path[SINK_PATH_MAX];
+        u64 length = str_len(path);
+        FILE* gz_file = nullptr;
+        if (length + 4 <= sizeof(gz_path)) {
+            str_cpy(gz_path, path);
+            str_cat(gz_path, ".gz");
+            gz_file = fopen(gz_path, "wb");
+        }
+
+        if (!gz_file) {
+            fprintf(stderr, "Couldn't open file for writing: %s.gz\n", path);
+        }
+        if (!gz_file || !sink_gzip_begin(s, gz_file, gzip->level)) {
+            // Don't leave empty files behind
+            if (gz_file) {
+                fclose(gz_file);
+                remove(gz_path);
+            }
+            if (file) {
+                fclose(file);
+                remove(path);
+            }
+            s->file = nullptr;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+b8 sink_close(sink_t* s) {
+    FILE* gz_file = sink_gzip_file(s);
+    if (gz_file) {
+        sink_gzip_end(s);
+    } else {
+        sink_flush(s);
+    }
+
+    b8 ok = !s->failed;
+    if (s->file && fclose(s->file) != 0) ok = false;
+    if (gz_file && fclose(gz_file) != 0) ok = false;
+    s->file = nullptr;
+
+    return ok;
+}
+
+b8 sink_gzip_begin(sink_t* s, FILE* file, i32 level) {
+#ifdef MDT_ZLIB
+    sink_gzip_t* g = s->gzip;
+
+    // The stream is reused across documents as long as the level stays
+    if (g && g->level != level) {
+        sink_gzip_free(s);
+        g = nullptr;
+    }
+
+    if (g == nullptr) {
+        g = malloc(sizeof(sink_gzip_t));
+        char* buffer = malloc(SINK_GZIP_CHUNK);
+        if (g == nullptr || buffer == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for the compressor.\n");
+            free(g);
+            free(buffer);
+            return false;
+        }
+        mem_set(g, 0, sizeof(sink_gzip_t));
+
+        // 16 on top of the window bits asks for a gzip header and trailer
+        if (deflateInit2(&g->stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "Failed to set up the compressor.\n");
+            free(g);
+            free(buffer);
+            return false;
+        }
+        g->level = level;
+        g->buffer = buffer;
+        g->capacity = SINK_GZIP_CHUNK;
+        s->gzip = g;
+    } else {
+        deflateReset(&g->stream);
+    }
+
+    g->file = file;
+    g->length = 0;
+    g->active = true;
+
+    return true;
+#else
+    (void)s;
+    (void)file;
+    (void)level;
+    fprintf(stderr, "Built without zlib (MDT_ZLIB), can't write gzip output.\n");
+    return false;
+#endif
+}
+
+b8 sink_gzip_end(sink_t* s) {
+#ifdef MDT_ZLIB
+    sink_gzip_t* g = s->gzip;
+    if (g == nullptr || !g->active) {
+        return false;
+    }
+
+    // Memory sinks never flushed, the whole output goes in at once
+    if (s->in_memory) {
+        sink_gzip_feed(s, s->buffer, s->length, false);
+    } else {
+        sink_flush(s);
+    }
+    sink_gzip_feed(s, nullptr, 0, true);
+
+    if (g->file && g->length > 0) {
+        sink_gzip_drain(s, g);
+    }
+    g->active = false;
+
+    return !s->failed;
+#else
+    (void)s;
+    return false;
+#endif
+}
+
+const char* sink_gzip_data(sink_t* s, u64* length) {
+#ifdef MDT_ZLIB
+    sink_gzip_t* g = s->gzip;
+    if (g && g->file == nullptr) {
+        *length = g->length;
+        return g->buffer;
+    }
+#else
+    (void)s;
+#endif
+    *length = 0;
+    return nullptr;
+}
+
+void sink_flush(sink_t* s) {
+    if (s->in_memory) {
+        return;
+    }
+
+    if (s->mode == SINK_GATHER) {
+        sink_flush_gather(s);
+    } else {
+        sink_flush_buffered(s);
+    }
+}
+
+void sink_write(sink_t* s, const char* data, u64 length) {
+    if (length == 0) return;
+
+    if (s->mode == SINK_GATHER) {
+        s->produced += length;
+        sink_push_iov(s, data, length);
+    } else {
+        sink_copy(s, data, length);
+    }
+}
+
+void sink_write_str(sink_t* s, const char* str) {
+    sink_write(s, str, str_len(str));
+}
+
+void sink_copy(sink_t* s, const char* data, u64 length) {
+    if (length == 0) return;
+    s->produced += length;
+
+    if (s->in_memory && s->length + length > s->capacity) {
+        u64 capacity = s->capacity;
+        while (capacity < s->length + length) capacity *= 2;
+
+        char* buffer = realloc(s->buffer, capacity);
+        if (buffer == nullptr) {
+            s->failed = true;
+            return;
+        }
+        s->buffer = buffer;
+        s->capacity = capacity;
+    }
+
+    // Make room, flushing what we have. In gather mode the span list
+    // must have room too, since a flush would recycle the buffer
+    // under the span we're about to add.
+    if (s->length + length > s->capacity ||
+        (s->mode == SINK_GATHER && s->iov_count == s->iov_capacity)) {
+        sink_flush(s);
+    }
+
+    // Still doesn't fit, it goes out directly
+    if (length > s->capacity) {
+        if (s->mode == SINK_GATHER) {
+            sink_push_iov(s, data, length);
+            sink_flush_gather(s);
+        } else {
+            sink_gzip_feed(s, data, length, false);
+            if (s->file) {
+                if (fwrite(data, 1, length, s->file) != length) s->failed = true;
+                s->bytes_written += length;
+                s->write_calls++;
+            }
+        }
+        return;
+    }
+
+    char* dst = s->buffer + s->length;
+    mem_copy(dst, (void*)data, length);
+    s->length += length;
+
+    if (s->mode == SINK_GATHER) {
+        sink_push_iov(s, dst, length);
+    }
+}
+
+void sink_write_text(sink_t* s, str_view_t text) {
+    u64 run_start = 0;
+
+    for (u64 i = 0; i < text.length; ++i) {
+        const char* entity;
+        switch (text.data[i]) {
+            case '&': entity = "&amp;"; break;
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '"': entity = "&quot;"; break;
+            default: continue;
+        }
+
+        // Everything up until here is safe to reference
+        sink_write(s, text.data + run_start, i - run_start);
+        sink_write_str(s, entity);
+        run_start = i + 1;
+    }
+
+    sink_write(s, text.data + run_start, text.length - run_start);
+}
+
+const char* sink_mode_str(sink_mode_t mode) {
+    return mode == SINK_GATHER ? "gather" : "buffered";
+}
+
+static void sink_push_iov(sink_t* s, const char* data, u64 length) {
+    // Extend the previous span if this one continues it
+    // (consecutive source text, consecutive copied bytes).
+    if (s->iov_count > 0) {
+        sink_iov_t* last = &s->iov[s->iov_count - 1];
+        if ((const char*)last->iov_base + last->iov_len == data) {
+            last->iov_len += length;
+            return;
+        }
+    }
+
+    if (s->iov_count == s->iov_capacity) {
+        sink_flush_gather(s);
+    }
+
+    s->iov[s->iov_count].iov_base = (void*)data;
+    s->iov[s->iov_count].iov_len = length;
+    s->iov_count++;
+}
+
+static void sink_flush_buffered(sink_t* s) {
+    if (s->length == 0) return;
+
+    sink_gzip_feed(s, s->buffer, s->length, false);
+    if (s->file) {
+        if (fwrite(s->buffer, 1, s->length, s->file) != s->length) s->failed = true;
+        s->bytes_written += s->length;
+        s->write_calls++;
+    }
+    s->length = 0;
+}
+
+#ifdef _WIN32
+
+static void sink_flush_gather(sink_t* s) {
+    // No writev, fall back to writing the spans one by one
+    for (u64 i = 0; i < s->iov_count; ++i) {
+        sink_gzip_feed(s, s->iov[i].iov_base, s->iov[i].iov_len, false);
+        if (s->file == nullptr) continue;
+
+        if (fwrite(s->iov[i].iov_base, 1, s->iov[i].iov_len, s->file) != s->iov[i].iov_len) {
+            s->failed = true;
+        }
+        s->bytes_written += s->iov[i].iov_len;
+        s->write_calls++;
+    }
+
+    s->iov_count = 0;
+    s->length = 0;
+}
+
+#else
+
+static void sink_flush_gather(sink_t* s) {
+    if (s->iov_count == 0) return;
+
+    for (u64 i = 0; i < s->iov_count; ++i) {
+        sink_gzip_feed(s, s->iov[i].iov_base, s->iov[i].iov_len, false);
+    }
+    if (s->file == nullptr) {
+        s->iov_count = 0;
+        s->length = 0;
+        return;
+    }
+
+    // Anything written through stdio has to land first
+    fflush(s->file);
+    i32 fd = fileno(s->file);
+
+    sink_iov_t* iov = s->iov;
+    u64 remaining = s->iov_count;
+    while (remaining > 0 && !s->failed) {
+        i32 batch = remaining > IOV_MAX ? IOV_MAX : (i32)remaining;
+        ssize_t written = writev(fd, iov, batch);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            s->failed = true;
+            break;
+        }
+        s->bytes_written += written;
+        s->write_calls++;
+
+        // Skip the fully written spans and trim a partially written one
+        while (remaining > 0 && (u64)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            remaining--;
+        }
+        if (remaining > 0 && written > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    s->iov_count = 0;
+    s->length = 0;
+}
+
+#endif
+
+static void sink_gzip_feed(sink_t* s, const char* data, u64 length, b8 finish) {
+#ifdef MDT_ZLIB
+    sink_gzip_t* g = s->gzip;
+    if (g == nullptr || !g->active) return;
+
+    do {
+        // zlib counts in uInt, big spans go in pieces
+        uInt piece = length > (1u << 30) ? (1u << 30) : (uInt)length;
+        g->stream.next_in = (Bytef*)data;
+        g->stream.avail_in = piece;
+        if (piece) {
+            data += piece;
+            length -= piece;
+        }
+        b8 last = finish && length == 0;
+
+        for (;;) {
+            if (g->length == g->capacity && !sink_gzip_drain(s, g)) return;
+
+            g->stream.next_out = (Bytef*)(g->buffer + g->length);
+            g->stream.avail_out = (uInt)(g->capacity - g->length);
+            i32 result = deflate(&g->stream, last ? Z_FINISH : Z_NO_FLUSH);
+            g->length = g->capacity - g->stream.avail_out;
+
+            if (result == Z_STREAM_ERROR) {
+                s->failed = true;
+                return;
+            }
+            if (last ? result == Z_STREAM_END : (g->stream.avail_in == 0 && g->stream.avail_out > 0)) {
+                break;
+            }
+        }
+    } while (length > 0);
+#else
+    (void)s;
+    (void)data;
+    (void)length;
+    (void)finish;
+#endif
+}
+
+static FILE* sink_gzip_file(sink_t* s) {
+#ifdef MDT_ZLIB
+    sink_gzip_t* g = s->gzip;
+    if (g && g->active) return g->file;
+#else
+    (void)s;
+#endif
+    return nullptr;
+}
+
+static void sink_gzip_free(sink_t* s) {
+#ifdef MDT_ZLIB
+    sink_gzip_t* g = s->gzip;
+    if (g == nullptr) return;
+
+    deflateEnd(&g->stream);
+    free(g->buffer);
+    free(g);
+#endif
+    s->gzip = nullptr;
+}
+
+#ifdef MDT_ZLIB
+
+static b8 sink_gzip_drain(sink_t* s, sink_gzip_t* g) {
+    if (g->file) {
+        if (fwrite(g->buffer, 1, g->length, g->file) != g->length) {
+            s->failed = true;
+            return false;
+        }
+        g->length = 0;
+        return true;
+    }
+
+    // Memory sinks keep all of it
+    u64 capacity = g->capacity * 2;
+    char* buffer = realloc(g->buffer, capacity);
+    if (buffer == nullptr) {
+        s->failed = true;
+        return false;
+    }
+    g->buffer = buffer;
+    g->capacity = capacity;
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "types.h"
+#include "budget.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+typedef struct sink_iov {
+    void* iov_base;
+    size_t iov_len;
+} sink_iov_t;
+#else
+#include <sys/uio.h>
+typedef struct iovec sink_iov_t;
+#endif
+
+#define SINK_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+    // Every byte is copied into the sink's buffer and written
+    // out with a single fwrite when the buffer fills up.
+    SINK_BUFFERED,
+
+    // Tag literals and unescaped source spans are only referenced
+    // and the whole list is handed to writev. Only bytes that had
+    // to be produced (escapes, slugs, attributes) are copied.
+    SINK_GATHER
+} sink_mode_t;
+
+// A gzip compressed copy of the output, written in the same pass
+// (needs a build with MDT_ZLIB)
+typedef struct gzip_options {
+    // 1 to 9, 0 is off
+    i32 level;
+    // Only the .gz, no plain file
+    b8 only;
+} gzip_options_t;
+
+typedef struct sink {
+    sink_mode_t mode;
+    // nullptr if only the compressed copy is written
+    FILE* file;
+
+    // Memory sinks never flush, the buffer grows to hold everything
+    b8 in_memory;
+
+    // Copy buffer. Holds all the output in buffered mode, and only
+    // the generated bytes in gather mode.
+    char* buffer;
+    u64 capacity;
+    u64 length;
+
+    // Pending spans (gather mode only)
+    sink_iov_t* iov;
+    u64 iov_count;
+    u64 iov_capacity;
+
+    // Compressor state, everything that's flushed goes through it
+    // between sink_gzip_begin and sink_gzip_end
+    void* gzip;
+
+    // Bytes handed to the sink since the last reset, and the limits
+    // renderers check between blocks (nullptr for none)
+    u64 produced;
+    budget_t* budget;
+
+    // Stats
+    u64 bytes_written;
+    u64 write_calls;
+    b8 failed;
+} sink_t;
+
+b8 sink_init(sink_t* s, sink_mode_t mode, FILE* file);
+b8 sink_init_memory(sink_t* s);
+void sink_shutdown(sink_t* s);
+void sink_reset(sink_t* s, FILE* file);
+void sink_flush(sink_t* s);
+
+// Opens `path` (unless gzip->only) and `path`.gz (if gzip->level is
+// set) and points the sink at them. `gzip` can be nullptr.
+b8 sink_open(sink_t* s, const char* path, const gzip_options_t* gzip);
+// Flushes, finishes the compressed copy and closes the files.
+// Returns false if any of it failed.
+b8 sink_close(sink_t* s);
+
+// Starts compressing everything written from here on, into `file`,
+// or into memory for memory sinks (and `file` nullptr).
+b8 sink_gzip_begin(sink_t* s, FILE* file, i32 level);
+b8 sink_gzip_end(sink_t* s);
+// The compressed bytes of a memory sink, after sink_gzip_end.
+const char* sink_gzip_data(sink_t* s, u64* length);
+
+// `data` must stay alive until the next flush (literals, source text).
+void sink_write(sink_t* s, const char* data, u64 length);
+void sink_write_str(sink_t* s, const char* str);
+
+// `data` is copied immediately, so it can be a temporary.
+void sink_copy(sink_t* s, const char* data, u64 length);
+
+// Writes text from the source, escaping HTML special characters.
+// Runs that don't need escaping are written as is.
+void sink_write_text(sink_t* s, str_view_t text);
+
+const char* sink_mode_str(sink_mode_t mode);
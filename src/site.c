@@ -0,0 +1,371 @@
+#include "site.h"
+
+#include "batch.h"
+#include "html.h"
+#include "io.h"
+#include "lib/mem.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SITE_TABLE_MIN 64
+#define SITE_LINKS_MIN 64
+#define SITE_STRINGS_MIN (16 * 1024)
+
+static b8 site_add_node(site_index_t* s, u32 document, node_t* node, tokenizer_t* t);
+static b8 site_add_link(site_index_t* s, u32 document, str_view_t target, tokenizer_t* t);
+static b8 site_check_link(site_index_t* s, const site_link_t* link, const char** reason);
+static b8 site_is_external(str_view_t target);
+static u64 site_resolve(const char* from, str_view_t path, char* out, u64 size);
+static i64 site_store(site_index_t* s, const char* data, u64 length);
+static u64 site_hash(u32 document, const char* data, u64 length);
+static site_entry_t* site_table_insert(site_index_t* s, site_table_t* table, u32 document, const char* data, u64 length);
+static site_entry_t* site_table_find(const site_index_t* s, const site_table_t* table, u32 document, const char* data, u64 length);
+static site_entry_t* site_table_slot(const site_index_t* s, const site_table_t* table, u32 document, const char* data, u64 length, u64 hash);
+static b8 site_table_grow(site_table_t* table);
+
+b8 site_index_init(site_index_t* s, char** inputs, u32 count, const char* extension) {
+    mem_set(s, 0, sizeof(site_index_t));
+    s->inputs = inputs;
+    s->document_count = count;
+    s->anchors.keyed = true;
+
+    // Every output is known up front, links to documents that haven't
+    // rendered yet resolve like any other
+    char output[IO_PATH_MAX];
+    char resolved[IO_PATH_MAX];
+    for (u32 i = 0; i < count; ++i) {
+        if (!batch_output_path(inputs[i], extension, output, sizeof(output))) continue;
+
+        u64 length = site_resolve("", string_view(output, str_len(output)), resolved, sizeof(resolved));
+        if (length > 0 && site_table_insert(s, &s->documents, i, resolved, length) == nullptr) {
+            site_index_shutdown(s);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void site_index_shutdown(site_index_t* s) {
+    free(s->documents.entries);
+    free(s->anchors.entries);
+    free(s->links);
+    free(s->strings);
+
+    mem_set(s, 0, sizeof(site_index_t));
+}
+
+b8 site_index_add(site_index_t* s, u32 document, node_t* root, tokenizer_t* t) {
+    return site_add_node(s, document, root, t);
+}
+
+u64 site_index_check(site_index_t* s) {
+    u64 broken = 0;
+
+    for (u64 i = 0; i < s->link_count; ++i) {
+        const site_link_t* link = &s->links[i];
+        const char* reason = nullptr;
+        if (site_check_link(s, link, &reason)) continue;
+
+        fprintf(stderr, "%s:%llu:%llu: broken link to %.*s (%s)\n",
+            s->inputs[link->document],
+            link->line,
+            link->column,
+            (int)link->length,
+            s->strings + link->target,
+            reason);
+        broken++;
+    }
+
+    return broken;
+}
+
+static b8 site_add_node(site_index_t* s, u32 document, node_t* node, tokenizer_t* t) {
+    for (node_t* child = node->children; child; child = child->next) {
+        switch (child->type) {
+            case NODE_HEADER: {
+                if (child->children == nullptr) break;
+
+                // The same anchor the HTML backend gives the header
+                char* slug = nullptr;
+                str_view_t anchor = html_header_anchor(child, &slug);
+                b8 ok = anchor.length == 0 || site_table_insert(s, &s->anchors, document, anchor.data, anchor.length) != nullptr;
+                free(slug);
+                if (!ok) return false;
+
+                // Headers have links too
+                if (!site_add_node(s, document, child, t)) return false;
+            } break;
+
+            case NODE_LINK:
+            case NODE_IMAGE: {
+                // Url first, then an optional title, then the link text
+                node_t* url = child->children;
+                if (url && url->type == NODE_URL && !site_add_link(s, document, url->value, t)) {
+                    return false;
+                }
+                if (!site_add_node(s, document, child, t)) return false;
+            } break;
+
+            default: {
+                if (!site_add_node(s, document, child, t)) return false;
+            } break;
+        }
+    }
+
+    return true;
+}
+
+static b8 site_add_link(site_index_t* s, u32 document, str_view_t target, tokenizer_t* t) {
+    if (target.length == 0 || site_is_external(target)) {
+        return true;
+    }
+
+    if (s->link_count == s->link_capacity) {
+        u64 capacity = s->link_capacity ? s->link_capacity * 2 : SITE_LINKS_MIN;
+        site_link_t* links = realloc(s->links, sizeof(site_link_t) * capacity);
+        if (links == nullptr) {
+            return false;
+        }
+        s->links = links;
+        s->link_capacity = capacity;
+    }
+
+    i64 stored = site_store(s, target.data, target.length);
+    if (stored == -1) {
+        return false;
+    }
+
+    site_link_t* link = &s->links[s->link_count++];
+    link->document = document;
+    link->length = (u32)target.length;
+    link->target = (u64)stored;
+    link->line = 0;
+    link->column = 0;
+    tokenizer_locate(t, target.data, &link->line, &link->column);
+
+    return true;
+}
+
+static b8 site_check_link(site_index_t* s, const site_link_t* link, const char** reason) {
+    const char* target = s->strings + link->target;
+
+    // `path?query#anchor`, any part of which can be missing
+    u64 path_length = 0;
+    while (path_length < link->length && target[path_length] != '#' && target[path_length] != '?') {
+        path_length++;
+    }
+    u64 anchor_start = path_length;
+    while (anchor_start < link->length && target[anchor_start] != '#') anchor_start++;
+    str_view_t anchor = anchor_start < link->length ?
+        string_view(target + anchor_start + 1, link->length - anchor_start - 1) :
+        string_view(nullptr, 0);
+
+    u32 document = link->document;
+    if (path_length > 0) {
+        // Outputs are written next to their inputs
+        char resolved[IO_PATH_MAX];
+        u64 length = site_resolve(s->inputs[document], string_view(target, path_length), resolved, sizeof(resolved));
+        if (length == 0) {
+            return true;
+        }
+
+        site_entry_t* entry = site_table_find(s, &s->documents, 0, resolved, length);
+        if (entry == nullptr) {
+            // Not rendered here, but it might be a file that's deployed too
+            FILE* file = fopen(resolved, "rb");
+            if (file) fclose(file);
+            *reason = "no such document";
+            return file != nullptr;
+        }
+        document = entry->document;
+    }
+
+    if (anchor.length > 0 && site_table_find(s, &s->anchors, document, anchor.data, anchor.length) == nullptr) {
+        *reason = "no such anchor";
+        return false;
+    }
+
+    return true;
+}
+
+static b8 site_is_external(str_view_t target) {
+    // Absolute and protocol relative paths depend on where the site is served
+    if (target.data[0] == '/') return true;
+
+    // A scheme is letters, digits, `+`, `-` or `.` up to a `:`
+    for (u64 i = 0; i < target.length; ++i) {
+        char c = target.data[i];
+        if (c == ':') return i > 0;
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.')) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+static u64 site_resolve(const char* from, str_view_t path, char* out, u64 size) {
+    // `path` relative to the directory of `from`, with `.` and `..` folded
+    // and repeated slashes dropped. Returns 0 if it doesn't fit.
+    u64 from_length = str_len(from);
+    while (from_length > 0 && from[from_length - 1] != '/') from_length--;
+
+    // Folding never makes a path longer
+    char joined[IO_PATH_MAX];
+    if (from_length + path.length + 1 > size || from_length + path.length + 1 > sizeof(joined)) {
+        return 0;
+    }
+    mem_copy(joined, (void*)from, from_length);
+    mem_copy(joined + from_length, (void*)path.data, path.length);
+    u64 length = from_length + path.length;
+
+    u64 o = 0;
+    if (length > 0 && joined[0] == '/') out[o++] = '/';
+    u64 root = o;
+
+    for (u64 i = 0; i < length;) {
+        u64 end = i;
+        while (end < length && joined[end] != '/') end++;
+        u64 segment = end - i;
+
+        // A `..` backs up over the last segment, unless there is none
+        // (or it's a `..` itself) and it has to stay
+        b8 parent = segment == 2 && joined[i] == '.' && joined[i + 1] == '.';
+        b8 after_parent = o - root >= 2 && out[o - 1] == '.' && out[o - 2] == '.' &&
+            (o - root == 2 || out[o - 3] == '/');
+
+        if (segment == 0 || (segment == 1 && joined[i] == '.')) {
+            // Nothing to add
+        } else if (parent && o > root && !after_parent) {
+            while (o > root && out[o - 1] != '/') o--;
+            if (o > root) o--;
+        } else {
+            if (o > root) out[o++] = '/';
+            mem_copy(out + o, joined + i, segment);
+            o += segment;
+        }
+
+        i = end + 1;
+    }
+    out[o] = '\0';
+
+    return o;
+}
+
+static i64 site_store(site_index_t* s, const char* data, u64 length) {
+    if (s->string_length + length + 1 > s->string_capacity) {
+        u64 capacity = s->string_capacity ? s->string_capacity : SITE_STRINGS_MIN;
+        while (s->string_length + length + 1 > capacity) capacity *= 2;
+
+        char* strings = realloc(s->strings, capacity);
+        if (strings == nullptr) {
+            return -1;
+        }
+        s->strings = strings;
+        s->string_capacity = capacity;
+    }
+
+    u64 offset = s->string_length;
+    mem_copy(s->strings + offset, (void*)data, length);
+    s->strings[offset + length] = '\0';
+    s->string_length += length + 1;
+
+    return (i64)offset;
+}
+
+static u64 site_hash(u32 document, const char* data, u64 length) {
+    // FNV-1a over the document index and the string, 0 marks empty slots
+    u64 hash = 14695981039346656037ULL;
+    for (u32 i = 0; i < 4; ++i) {
+        hash ^= (document >> (i * 8)) & 0xff;
+        hash *= 1099511628211ULL;
+    }
+    for (u64 i = 0; i < length; ++i) {
+        hash ^= (u8)data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+static site_entry_t* site_table_insert(site_index_t* s, site_table_t* table, u32 document, const char* data, u64 length) {
+    // Stay under 3/4 full so probe runs stay short
+    if ((table->count + 1) * 4 > table->capacity * 3 && !site_table_grow(table)) {
+        return nullptr;
+    }
+
+    // The first insert of a string wins
+    u64 hash = site_hash(table->keyed ? document : 0, data, length);
+    site_entry_t* entry = site_table_slot(s, table, document, data, length, hash);
+    if (entry->hash != 0) {
+        return entry;
+    }
+
+    i64 stored = site_store(s, data, length);
+    if (stored == -1) {
+        return nullptr;
+    }
+
+    entry->hash = hash;
+    entry->document = document;
+    entry->length = (u32)length;
+    entry->string = (u64)stored;
+    table->count++;
+
+    return entry;
+}
+
+static site_entry_t* site_table_find(const site_index_t* s, const site_table_t* table, u32 document, const char* data, u64 length) {
+    if (table->count == 0) return nullptr;
+
+    u64 hash = site_hash(table->keyed ? document : 0, data, length);
+    site_entry_t* entry = site_table_slot(s, table, document, data, length, hash);
+    return entry->hash != 0 ? entry : nullptr;
+}
+
+static site_entry_t* site_table_slot(const site_index_t* s, const site_table_t* table, u32 document, const char* data, u64 length, u64 hash) {
+    // Either the slot holding the key or the empty one it would go into
+    u64 slot = hash & (table->capacity - 1);
+    while (table->entries[slot].hash != 0) {
+        site_entry_t* e = &table->entries[slot];
+        if (e->hash == hash && e->length == length &&
+            (e->document == document || !table->keyed) &&
+            mem_equal(s->strings + e->string, data, length)) {
+            break;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    return &table->entries[slot];
+}
+
+static b8 site_table_grow(site_table_t* table) {
+    u64 capacity = table->capacity ? table->capacity * 2 : SITE_TABLE_MIN;
+    site_entry_t* entries = malloc(sizeof(site_entry_t) * capacity);
+    if (entries == nullptr) {
+        return false;
+    }
+    mem_set(entries, 0, sizeof(site_entry_t) * capacity);
+
+    // Rehash with the stored hashes, the strings aren't walked again
+    for (u64 i = 0; i < table->capacity; ++i) {
+        site_entry_t* entry = &table->entries[i];
+        if (entry->hash == 0) continue;
+
+        u64 slot = entry->hash & (capacity - 1);
+        while (entries[slot].hash != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        entries[slot] = *entry;
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+
+    return true;
+}
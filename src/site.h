@@ -0,0 +1,69 @@
+#pragma once
+
+#include "types.h"
+#include "parser.h"
+#include "tokenizer.h"
+
+// Every header anchor and outgoing link of the documents in a batch
+// run, collected while they render, so links between them are checked
+// at the end without reading the output back.
+//
+// Links that leave the site (a scheme, `//host` or `/absolute`) aren't
+// checked. Relative ones must name a document of the batch (by its
+// output path) or a file that exists, and their `#anchor`, if they
+// have one, must be a header of that document.
+
+// A string and the document it belongs to, empty if `hash` is 0
+typedef struct site_entry {
+    u64 hash;
+    u32 document;
+    u32 length;
+    // Offset into the string pool
+    u64 string;
+} site_entry_t;
+
+typedef struct site_table {
+    // Open addressing with linear probing, power of two capacity
+    site_entry_t* entries;
+    u64 capacity;
+    u64 count;
+    // Anchors are keyed on the document and the string, paths on the
+    // string alone (and map it to its document)
+    b8 keyed;
+} site_table_t;
+
+typedef struct site_link {
+    u32 document;
+    u32 length;
+    u64 target;
+    // Where the target is in the document's source
+    u64 line;
+    u64 column;
+} site_link_t;
+
+typedef struct site_index {
+    char** inputs;
+    u32 document_count;
+    site_table_t documents;
+    site_table_t anchors;
+
+    site_link_t* links;
+    u64 link_count;
+    u64 link_capacity;
+
+    // Copies of everything above, sources don't outlive their render
+    char* strings;
+    u64 string_length;
+    u64 string_capacity;
+} site_index_t;
+
+// `extension` is what the inputs' outputs end in (`.html`).
+b8 site_index_init(site_index_t* s, char** inputs, u32 count, const char* extension);
+void site_index_shutdown(site_index_t* s);
+
+// Adds the anchors and links of one document. `t` is the tokenizer
+// the tree was parsed with, to tell where the links are.
+b8 site_index_add(site_index_t* s, u32 document, node_t* root, tokenizer_t* t);
+
+// Reports every broken link and returns how many there were.
+u64 site_index_check(site_index_t* s);
@@ -0,0 +1,222 @@
+#include "template.h"
+
+#include "html.h"
+#include "tokenizer.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEMPLATE_LITERAL(s) { SEGMENT_LITERAL, { s, sizeof(s) - 1 } }
+#define TEMPLATE_SLOT(type) { type, { nullptr, 0 } }
+
+static template_segment_t default_segments[] = {
+    TEMPLATE_LITERAL(
+        "<!DOCTYPE html>\n"
+        "<html lang=\"en\">\n"
+        "<head>\n"
+        "\t<meta charset=\"UTF-8\">\n"
+        "\t<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n"
+        "\t<title>"),
+    TEMPLATE_SLOT(SEGMENT_TITLE),
+    TEMPLATE_LITERAL("</title>"),
+    TEMPLATE_SLOT(SEGMENT_CSS),
+    TEMPLATE_LITERAL(
+        "\n"
+        "</head>\n"
+        "<body>\n"),
+    TEMPLATE_SLOT(SEGMENT_CONTENT),
+    TEMPLATE_LITERAL("</body>\n</html>\n")
+};
+
+static const template_t default_template = {
+    default_segments,
+    sizeof(default_segments) / sizeof(default_segments[0]),
+    nullptr
+};
+
+static b8 template_push(template_t* t, u64* capacity, segment_type_t type, str_view_t text);
+static b8 template_slot(str_view_t name, segment_type_t* type);
+
+b8 page_init(page_t* page, template_t* t, const char* title, const char* css, const char* template_file) {
+    t->segments = nullptr;
+    t->count = 0;
+    t->source = nullptr;
+
+    page->title = title;
+    page->css = css;
+    page->template = nullptr;
+
+    if (template_file == nullptr) {
+        return true;
+    }
+
+    if (!template_load(t, template_file)) {
+        return false;
+    }
+    page->template = t;
+
+    return true;
+}
+
+b8 template_load(template_t* t, const char* path) {
+    char* source = nullptr;
+    u64 capacity = 0;
+    i64 file_size = load_source(path, &source, &capacity);
+    if (file_size == -1) {
+        free(source);
+        return false;
+    }
+
+    if (!template_compile(t, source, file_size)) {
+        free(source);
+        return false;
+    }
+    t->source = source;
+
+    return true;
+}
+
+b8 template_compile(template_t* t, const char* text, u64 length) {
+    t->segments = nullptr;
+    t->count = 0;
+    t->source = nullptr;
+
+    u64 capacity = 0;
+    u64 literal_start = 0;
+    u64 i = 0;
+
+    while (i + 1 < length) {
+        if (text[i] != '{' || text[i + 1] != '{') {
+            i++;
+            continue;
+        }
+
+        u64 close = i + 2;
+        while (close + 1 < length && !(text[close] == '}' && text[close + 1] == '}')) close++;
+        if (close + 1 >= length) break;
+
+        segment_type_t type;
+        if (!template_slot(string_view(text + i + 2, close - i - 2), &type)) {
+            i += 2;
+            continue;
+        }
+
+        if ((i > literal_start && !template_push(t, &capacity, SEGMENT_LITERAL, string_view(text + literal_start, i - literal_start))) ||
+            !template_push(t, &capacity, type, string_view(nullptr, 0))) {
+            template_shutdown(t);
+            return false;
+        }
+
+        i = close + 2;
+        literal_start = i;
+    }
+
+    if (length > literal_start &&
+        !template_push(t, &capacity, SEGMENT_LITERAL, string_view(text + literal_start, length - literal_start))) {
+        template_shutdown(t);
+        return false;
+    }
+
+    return true;
+}
+
+void template_shutdown(template_t* t) {
+    free(t->segments);
+    free(t->source);
+
+    t->segments = nullptr;
+    t->count = 0;
+    t->source = nullptr;
+}
+
+const template_t* template_default(void) {
+    return &default_template;
+}
+
+void template_write(const template_t* t, node_t* root, sink_t* sink, const char* title, const char* css) {
+    template_write_with(t, root, sink, title, css, nullptr, nullptr);
+}
+
+void template_write_with(const template_t* t, node_t* root, sink_t* sink, const char* title, const char* css,
+                         template_content_fn content, void* arg) {
+    for (u64 i = 0; i < t->count; ++i) {
+        const template_segment_t* segment = &t->segments[i];
+
+        switch (segment->type) {
+            case SEGMENT_LITERAL: {
+                sink_write(sink, segment->text.data, segment->text.length);
+            } break;
+
+            case SEGMENT_TITLE: {
+                const char* text = title ? title : "Markdown";
+                sink_write_text(sink, string_view(text, str_len(text)));
+            } break;
+
+            case SEGMENT_CSS: {
+                if (css == nullptr || css[0] == '\0') break;
+                sink_write_str(sink, "<link rel=\"stylesheet\" href=\"");
+                sink_write_text(sink, string_view(css, str_len(css)));
+                sink_write_str(sink, "\">");
+            } break;
+
+            case SEGMENT_TOC: {
+                html_write_toc(root, sink);
+            } break;
+
+            case SEGMENT_CONTENT: {
+                if (content) {
+                    content(sink, arg);
+                } else {
+                    node_to_html(root, sink);
+                }
+            } break;
+        }
+    }
+}
+
+static b8 template_push(template_t* t, u64* capacity, segment_type_t type, str_view_t text) {
+    if (t->count == *capacity) {
+        u64 new_capacity = *capacity ? *capacity * 2 : 8;
+        template_segment_t* segments = realloc(t->segments, sizeof(template_segment_t) * new_capacity);
+        if (segments == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for template.\n");
+            return false;
+        }
+        t->segments = segments;
+        *capacity = new_capacity;
+    }
+
+    t->segments[t->count].type = type;
+    t->segments[t->count].text = text;
+    t->count++;
+
+    return true;
+}
+
+static b8 template_slot(str_view_t name, segment_type_t* type) {
+    static const struct { const char* name; segment_type_t type; } slots[] = {
+        { "title", SEGMENT_TITLE },
+        { "css", SEGMENT_CSS },
+        { "toc", SEGMENT_TOC },
+        { "content", SEGMENT_CONTENT }
+    };
+
+    // `{{ title }}` is fine too
+    while (name.length > 0 && is_char_space(name.data[0])) {
+        name.data++;
+        name.length--;
+    }
+    while (name.length > 0 && is_char_space(name.data[name.length - 1])) {
+        name.length--;
+    }
+
+    for (u32 i = 0; i < sizeof(slots) / sizeof(slots[0]); ++i) {
+        if (str_len(slots[i].name) == name.length && str_ncmp(name.data, slots[i].name, name.length) == 0) {
+            *type = slots[i].type;
+            return true;
+        }
+    }
+
+    return false;
+}
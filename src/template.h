@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.h"
+#include "parser.h"
+#include "sink.h"
+
+// HTML page templates. The text around the placeholders is split into
+// segments once, when the template is loaded, and every page after
+// that is the segments written in order: literals straight from the
+// template (so a gather sink references them instead of copying), and
+// the slots filled in.
+//
+// Placeholders:
+//   {{title}}    the title, escaped
+//   {{css}}      a stylesheet <link>, or nothing if there's no css
+//   {{toc}}      nested lists of links to the headers
+//   {{content}}  the rendered document
+// Anything else in braces is kept as it is.
+
+typedef enum {
+    SEGMENT_LITERAL,
+    SEGMENT_TITLE,
+    SEGMENT_CSS,
+    SEGMENT_TOC,
+    SEGMENT_CONTENT
+} segment_type_t;
+
+typedef struct template_segment {
+    segment_type_t type;
+    // Only for literals
+    str_view_t text;
+} template_segment_t;
+
+typedef struct template {
+    template_segment_t* segments;
+    u64 count;
+    // What the literals point into, if the template owns it
+    char* source;
+} template_t;
+
+// What goes around the tree in a complete output file.
+typedef struct page {
+    const char* title;
+    const char* css;
+    // The backend's own page if nullptr
+    const template_t* template;
+} page_t;
+
+// Fills `page`, loading `template_file` into `t` first if there is
+// one. `t` is shut down with the rest either way.
+b8 page_init(page_t* page, template_t* t, const char* title, const char* css, const char* template_file);
+
+b8 template_load(template_t* t, const char* path);
+// `text` is referenced, not copied, and has to outlive the template.
+b8 template_compile(template_t* t, const char* text, u64 length);
+void template_shutdown(template_t* t);
+
+// The page the HTML backend uses without a template.
+const template_t* template_default(void);
+
+void template_write(const template_t* t, node_t* root, sink_t* sink, const char* title, const char* css);
+
+// Same, but {{content}} is whatever `content` writes (output rendered
+// ahead of time, like book chapters). `root` still drives {{toc}}.
+typedef void (*template_content_fn)(sink_t* sink, void* arg);
+void template_write_with(const template_t* t, node_t* root, sink_t* sink, const char* title, const char* css,
+                         template_content_fn content, void* arg);
@@ -0,0 +1,108 @@
+#include "text.h"
+
+typedef struct text_writer {
+    sink_t* sink;
+    // Linebreaks owed before the next span, so separators never
+    // pile up and nothing trails the last block
+    u32 pending;
+    b8 started;
+    u32 list_depth;
+} text_writer_t;
+
+static void text_node(text_writer_t* w, node_t* node);
+static void text_children(text_writer_t* w, node_t* child);
+static void text_break(text_writer_t* w, u32 count);
+
+void node_to_text(node_t* node, sink_t* sink) {
+    text_writer_t w = { sink, 0, false, 0 };
+    text_node(&w, node);
+}
+
+void text_write_document(node_t* root, sink_t* sink, const page_t* page) {
+    (void)page;
+
+    text_writer_t w = { sink, 0, false, 0 };
+    text_node(&w, root);
+
+    if (w.started) {
+        sink_write_str(sink, "\n");
+    }
+}
+
+static void text_node(text_writer_t* w, node_t* node) {
+    if (node == nullptr) {
+        return;
+    }
+
+    switch (node->type) {
+        case NODE_HEADER:
+        case NODE_PARAGRAPH:
+        case NODE_BLOCKQUOTE: {
+            text_children(w, node->children);
+            text_break(w, 2);
+        } break;
+
+        case NODE_ORDERED_LIST:
+        case NODE_UNORDERED_LIST: {
+            w->list_depth++;
+            text_children(w, node->children);
+            w->list_depth--;
+
+            // A nested list is still part of an item
+            text_break(w, w->list_depth > 0 ? 1 : 2);
+        } break;
+
+        case NODE_LIST_ITEM: {
+            text_break(w, 1);
+            text_children(w, node->children);
+            text_break(w, 1);
+        } break;
+
+        case NODE_LINEBREAK: {
+            text_break(w, 1);
+        } break;
+
+        case NODE_LINK:
+        case NODE_IMAGE: {
+            // Skip the url and title, the rest is the link text
+            node_t* child = node->children ? node->children->next : nullptr;
+            if (child && child->type == NODE_TITLE) child = child->next;
+            text_children(w, child);
+        } break;
+
+        case NODE_URL:
+        case NODE_TITLE:
+        break;
+
+        case NODE_INNER_TEXT: {
+            if (node->value.length > 0) {
+                if (w->started && w->pending > 0) {
+                    sink_write(w->sink, "\n\n", w->pending);
+                }
+                w->pending = 0;
+                w->started = true;
+
+                sink_write(w->sink, node->value.data, node->value.length);
+            }
+            text_children(w, node->children);
+        } break;
+
+        default: {
+            // Root and emphasis only hold other nodes
+            text_children(w, node->children);
+        } break;
+    }
+}
+
+static void text_children(text_writer_t* w, node_t* child) {
+    while (child) {
+        text_node(w, child);
+        child = child->next;
+    }
+}
+
+static void text_break(text_writer_t* w, u32 count) {
+    if (w->pending < count) {
+        w->pending = count;
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "types.h"
+#include "parser.h"
+#include "sink.h"
+#include "template.h"
+
+// Plain text: only the text spans, with a blank line between blocks
+// and a linebreak between list items and between the lines of a
+// paragraph. Links keep their text, images their alt text.
+void node_to_text(node_t* node, sink_t* sink);
+void text_write_document(node_t* root, sink_t* sink, const page_t* page);
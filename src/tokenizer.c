@@ -1,6 +1,7 @@
 #include "tokenizer.h"
 
-#include "lib/mem.h"
+#include "utf8.h"
+#include "gzip.h"
 #include "lib/str.h"
 
 #include <stdio.h>
@@ -27,59 +28,158 @@ const char* token_str[] = {
     "TOKEN_NONE"
 };
 
+// Bytes the tokenizer tells apart, everything else is text
+typedef enum {
+    CHAR_OTHER,
+    CHAR_LINEBREAK,
+    CHAR_HASH,
+    CHAR_LIST,
+    CHAR_EMPHASIS,
+    CHAR_SQBR_OPEN,
+    CHAR_SQBR_CLOSE,
+    CHAR_PAREN_OPEN,
+    CHAR_PAREN_CLOSE,
+    CHAR_ANGLE,
+    CHAR_SPACE,
+    CHAR_DIGIT,
+    CHAR_BANG,
+    // `!` followed by `[`, from the lookahead
+    CHAR_BANG_IMAGE,
+
+    CHAR_CLASS_COUNT
+} char_class_t;
+
+static const u8 char_class[256] = {
+    ['\n'] = CHAR_LINEBREAK,
+    ['#'] = CHAR_HASH,
+    ['-'] = CHAR_LIST, ['+'] = CHAR_LIST,
+    ['*'] = CHAR_EMPHASIS, ['_'] = CHAR_EMPHASIS,
+    ['['] = CHAR_SQBR_OPEN,
+    [']'] = CHAR_SQBR_CLOSE,
+    ['('] = CHAR_PAREN_OPEN,
+    [')'] = CHAR_PAREN_CLOSE,
+    ['>'] = CHAR_ANGLE,
+    [' '] = CHAR_SPACE,
+    ['0'] = CHAR_DIGIT, ['1'] = CHAR_DIGIT, ['2'] = CHAR_DIGIT, ['3'] = CHAR_DIGIT,
+    ['4'] = CHAR_DIGIT, ['5'] = CHAR_DIGIT, ['6'] = CHAR_DIGIT, ['7'] = CHAR_DIGIT,
+    ['8'] = CHAR_DIGIT, ['9'] = CHAR_DIGIT, ['.'] = CHAR_DIGIT,
+    ['!'] = CHAR_BANG,
+};
+
+// What a class of byte becomes in a given state, one row per state
+#define TOKEN_ROW(s) {                                                                      \
+    [CHAR_OTHER] = TOKEN_TEXT,                                                              \
+    [CHAR_LINEBREAK] = TOKEN_LINEBREAK,                                                     \
+    [CHAR_HASH] = ((s) & TOKENIZER_LINE_START) ? TOKEN_HEADER : TOKEN_TEXT,                 \
+    [CHAR_LIST] = ((s) & TOKENIZER_LINE_START) ? TOKEN_LIST : TOKEN_TEXT,                   \
+    [CHAR_EMPHASIS] = TOKEN_EMPHASIS,                                                       \
+    [CHAR_SQBR_OPEN] = TOKEN_SQBR_OPEN,                                                     \
+    [CHAR_SQBR_CLOSE] = TOKEN_SQBR_CLOSE,                                                   \
+    [CHAR_PAREN_OPEN] = ((s) & TOKENIZER_AFTER_SQBR_CLOSE) ? TOKEN_PAREN_OPEN : TOKEN_TEXT, \
+    [CHAR_PAREN_CLOSE] = ((s) & TOKENIZER_PAREN_OPEN) ? TOKEN_PAREN_CLOSE : TOKEN_TEXT,     \
+    [CHAR_ANGLE] = ((s) & TOKENIZER_LINE_START) ? TOKEN_BLOCKQUOTE : TOKEN_TEXT,            \
+    [CHAR_SPACE] = ((s) & TOKENIZER_AFTER_TEXT) ? TOKEN_TEXT : TOKEN_WHITESPACE,            \
+    [CHAR_DIGIT] = ((s) & TOKENIZER_LINE_START) ? TOKEN_NUMERICAL : TOKEN_TEXT,             \
+    [CHAR_BANG] = TOKEN_TEXT,                                                               \
+    [CHAR_BANG_IMAGE] = TOKEN_EXCLAMATION,                                                  \
+}
+
+static const u8 token_table[TOKENIZER_STATE_COUNT][CHAR_CLASS_COUNT] = {
+    TOKEN_ROW(0), TOKEN_ROW(1), TOKEN_ROW(2), TOKEN_ROW(3),
+    TOKEN_ROW(4), TOKEN_ROW(5), TOKEN_ROW(6), TOKEN_ROW(7),
+    TOKEN_ROW(8), TOKEN_ROW(9), TOKEN_ROW(10), TOKEN_ROW(11),
+    TOKEN_ROW(12), TOKEN_ROW(13), TOKEN_ROW(14), TOKEN_ROW(15),
+};
+
+#undef TOKEN_ROW
+
+static void track_brackets(tokenizer_t* t, token_type_t type);
+
 b8 tokenizer_init(tokenizer_t* t, const char* path) {
+    // Load source into allocated memory, with \n line endings
+    char* source = nullptr;
+    u64 capacity = 0;
+    i64 file_size = load_source(path, &source, &capacity);
+    if (file_size == -1) {
+        free(source);
+        return false;
+    }
+    source[file_size] = '\0';
+    file_size = lines_normalize(source, file_size);
+
+    if (!tokenizer_init_source(t, source, file_size)) {
+        free(source);
+        return false;
+    }
+
     // Save file path
     t->file_path = path;
 
-    // Determine the source's size
-    i64 file_size = load_source(path, 0);
-    if (file_size == -1) {
-        fprintf(stderr, "Couldn't open file: %s\n", path);
-        return false;
+    // Bad UTF-8 still renders, but say where it is
+    u64 error_offset, line, column;
+    if (!utf8_validate(source, file_size, &error_offset) &&
+        tokenizer_locate(t, source + error_offset, &line, &column)) {
+        fprintf(stderr, "%s:%llu:%llu: invalid UTF-8 (byte %llu)\n", path, line, column, error_offset);
     }
 
-    // For future reference
-    t->source_size = file_size;
+    return true;
+}
 
-    // Allocate memory for source
-    t->source = malloc(file_size + 1);
-    if (t->source == NULL) {
-        fprintf(stderr, "Failed to allocate memory for source.\n");
+b8 tokenizer_init_source(tokenizer_t* t, char* source, u64 size) {
+    // Allocate and setup token array
+    t->token_array.tokens = malloc(sizeof(token_t) * INITIAL_CAPACITY);
+    if (t->token_array.tokens == NULL) {
+        fprintf(stderr, "Failed to allocate memory for tokens.\n");
         return false;
     }
+    t->token_array.capacity = INITIAL_CAPACITY;
+    t->budget = nullptr;
+
+    line_index_init(&t->lines);
+    tokenizer_reset(t, source, size);
+
+    return true;
+}
+
+void tokenizer_reset(tokenizer_t* t, char* source, u64 size) {
+    t->file_path = nullptr;
 
-    // Load source into allocated memory
-    load_source(path, t->source);
-    t->source[file_size] = '\0';
+    // The tokenizer takes ownership of the (null terminated) source
+    t->source = source;
+    t->source_size = size;
 
     // Point cursor to start of source
     t->cursor = t->source;
+    t->start = t->source;
 
+    // Start of the input behaves like the start of a fresh line
     t->current_type = TOKEN_NONE;
-    t->previous_type = TOKEN_NONE;
+    t->previous_type = TOKEN_LINEBREAK;
     t->open_type = TOKEN_NONE;
     t->current_length = 0;
+    t->line_start = true;
 
-    // Set debug defaults (1 indexed)
-    t->current_line = 1;
-    t->current_char = 1;
+    // Line numbers are only looked up for diagnostics
+    line_index_reset(&t->lines, source, size);
 
-    // Allocate and setup token array
-    t->token_array.tokens = malloc(sizeof(token_t) * INITIAL_CAPACITY);
-    t->token_array.capacity = INITIAL_CAPACITY;
+    // Tokens from a previous run are dropped, the memory is kept
     t->token_array.count = 0;
-
-    return true;
 }
 
 void tokenizer_shutdown(tokenizer_t* t) {
     free(t->source);
     free(t->token_array.tokens);
+    line_index_shutdown(&t->lines);
 
     t->source = nullptr;
     t->cursor = nullptr;
 }
 
+b8 tokenizer_locate(tokenizer_t* t, const char* at, u64* line, u64* column) {
+    if (at < t->source) return false;
+    return line_index_locate(&t->lines, at - t->source, line, column);
+}
+
 b8 next_token(tokenizer_t* t) {
     // End of file, flush and return false
     if (*t->cursor == '\0' || (t->cursor - t->source) >= (i64)t->source_size) {
@@ -90,12 +190,18 @@ b8 next_token(tokenizer_t* t) {
     // Ever encountering a tab, we just ignore
     // by incrementing our current position.
     if (*t->cursor == '\t') {
-        t->current_char++;
         t->cursor++;
+
+        // ...which might have been the last character
+        if ((t->cursor - t->source) >= (i64)t->source_size) {
+            flush_token(t);
+            return false;
+        }
     }
 
     // Register the type we are looking at
-    token_type_t type = char_to_token(*t->cursor, t);
+    token_type_t type = char_to_token(t->cursor, tokenizer_state(t));
+    track_brackets(t, type);
 
     // If it's a new kind of token and we haven't flushed
     if (type != t->current_type && t->current_type != TOKEN_NONE) {
@@ -110,14 +216,17 @@ b8 next_token(tokenizer_t* t) {
     }
 
     t->current_length++;
-    t->current_char++;
     t->cursor++;
 
-    while (char_to_token(*t->cursor, t) == type) {
+    // The context can't change within a run, so neither can the state
+    const char* end = t->source + t->source_size;
+    u32 state = tokenizer_state(t);
+    token_type_t next = type;
+    while (t->cursor < end && (next = char_to_token(t->cursor, state)) == type) {
         t->current_length++;
-        t->current_char++;
         t->cursor++;
     }
+    track_brackets(t, next);
 
     // Handle signals for open and close brackets
     if (type == TOKEN_PAREN_OPEN || type == TOKEN_SQBR_OPEN) {
@@ -126,8 +235,22 @@ b8 next_token(tokenizer_t* t) {
         t->open_type = TOKEN_NONE;
     }
 
-    // If we hit a linebreak, increment the line number
-    if (type == TOKEN_LINEBREAK) t->current_line++;
+    // Links are single line, so brackets don't stay open past a linebreak
+    if (type == TOKEN_LINEBREAK) {
+        t->open_type = TOKEN_NONE;
+
+        // Past a limit, the tokens so far are all there will be
+        if (t->budget && !budget_check(t->budget, BUDGET_TOKENS, t->token_array.count)) {
+            flush_token(t);
+            return false;
+        }
+    }
+
+    // Block markers can be indented and nested (`  > - # item`)
+    t->line_start = type == TOKEN_LINEBREAK ||
+        (t->line_start && (type == TOKEN_WHITESPACE ||
+                           type == TOKEN_BLOCKQUOTE ||
+                           type == TOKEN_LIST));
 
     // Store the current type as previous for next iteration
     t->previous_type = type;
@@ -137,9 +260,20 @@ b8 next_token(tokenizer_t* t) {
 
 void flush_token(tokenizer_t* t) {
     if (t->current_length > 0) {
+        // Grow the token array if needed
+        if (t->token_array.count == t->token_array.capacity) {
+            u64 new_capacity = t->token_array.capacity * 2;
+            token_t* tokens = realloc(t->token_array.tokens, sizeof(token_t) * new_capacity);
+            if (tokens) {
+                t->token_array.tokens = tokens;
+                t->token_array.capacity = new_capacity;
+            }
+        }
+
         // Add it to the token array
         if (t->token_array.count < t->token_array.capacity) {
             t->token_array.tokens[t->token_array.count].type = t->current_type;
+            t->token_array.tokens[t->token_array.count].pair = 0;
             t->token_array.tokens[t->token_array.count].value = string_view(t->start, t->current_length);
             t->token_array.count++;
         } else {
@@ -152,74 +286,34 @@ void flush_token(tokenizer_t* t) {
     }
 }
 
-token_type_t char_to_token(char c, tokenizer_t* t) {
-    switch (c) {
-        case '\n':
-            return TOKEN_LINEBREAK;
-
-        case '#':
-            return (t->previous_type == TOKEN_LINEBREAK || t->current_char <= 1) ? TOKEN_HEADER : TOKEN_TEXT;
-
-        case '-':
-        case '+':
-            return (t->previous_type == TOKEN_LINEBREAK) ? TOKEN_LIST : TOKEN_TEXT; 
-
-        case '*':
-        case '_':
-            return TOKEN_EMPHASIS;
-
-        case '[':
-            return TOKEN_SQBR_OPEN;
-        case ']': {
-            t->open_type = TOKEN_SQBR_CLOSE;
-            return TOKEN_SQBR_CLOSE;
-        }
-
-        case '(': {
-            if (t->previous_type == TOKEN_SQBR_CLOSE) {
-                t->open_type = TOKEN_PAREN_OPEN;
-                return TOKEN_PAREN_OPEN;
-            }
-            return TOKEN_TEXT;
-        }
-
-        case ')': {
-            if (t->open_type == TOKEN_PAREN_OPEN) {
-                return TOKEN_PAREN_CLOSE;
-            }
-            return TOKEN_TEXT;
-        }
+u32 tokenizer_state(const tokenizer_t* t) {
+    return (u32)(t->line_start != 0) * TOKENIZER_LINE_START |
+           (u32)(t->previous_type == TOKEN_TEXT) * TOKENIZER_AFTER_TEXT |
+           (u32)(t->previous_type == TOKEN_SQBR_CLOSE) * TOKENIZER_AFTER_SQBR_CLOSE |
+           (u32)(t->open_type == TOKEN_PAREN_OPEN) * TOKENIZER_PAREN_OPEN;
+}
 
-        // For this we need to look ahead 1
-        case '!': {
-            if (((t->cursor + 1) - t->source) <= (i64)t->source_size &&  *(t->cursor + 1) == '[') {
-                return TOKEN_EXCLAMATION;
-            }
-            return TOKEN_TEXT;
-        }
+token_type_t char_to_token(const char* at, u32 state) {
+    u32 c = char_class[(u8)*at];
 
-        case '>':
-            return (t->previous_type == TOKEN_LINEBREAK || t->current_char <= 1) ? TOKEN_BLOCKQUOTE : TOKEN_TEXT;
+    // `![` starts an image, the one class that needs the next byte. There
+    // always is one, sources are null terminated.
+    c += (c == CHAR_BANG) & (at[1] == '[');
 
-        case ' ':
-            return (t->previous_type != TOKEN_TEXT) ? TOKEN_WHITESPACE : TOKEN_TEXT;
-            
-        default:
-            // Handle digit
-            if ((is_char_digit(c) || c == '.') && t->previous_type == TOKEN_LINEBREAK) {
-                return TOKEN_NUMERICAL;
-            }
-            // Otherwise, text.
-            return TOKEN_TEXT;
-    }
+    return (token_type_t)token_table[state][c];
 }
 
 b8 is_char_digit(char c) {
     return c <= '9' && c >= '0';
 }
 
-i64 load_source(const char* path, char* out) {
-    FILE* file = fopen(path, "r");
+b8 is_char_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+i64 load_source(const char* path, char** out, u64* capacity) {
+    // Binary, line endings are normalized after loading
+    FILE* file = fopen(path, "rb");
     if (!file) {
         fprintf(stderr, "Couldn't open file: %s\n", path);
         return -1;
@@ -227,19 +321,46 @@ i64 load_source(const char* path, char* out) {
     
     // Get size of file
     // NOTE: Maximum file size is around 2GB because of fseek returning int
-    // Also, this returns more on Win than Unix if using binary mode because of '\r\n'
-    fseek(file, 0L, SEEK_END);
+    if (fseek(file, 0L, SEEK_END) != 0) {
+        fprintf(stderr, "Couldn't read file: %s\n", path);
+        fclose(file);
+        return -1;
+    }
     i64 file_size = ftell(file);
-    // Seek back to beginning... but do we have to for fgets?
     rewind(file);
+    if (file_size < 0) {
+        fprintf(stderr, "Couldn't read file: %s\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    // Compressed sources (.md.gz) are inflated straight into the buffer,
+    // which grows for as long as there's more
+    char magic[2];
+    b8 compressed = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && gzip_detect(magic, sizeof(magic));
+    rewind(file);
+    if (compressed) {
+        file_size = gzip_read_file(file, (u64)file_size, out, capacity);
+        if (file_size == -1) {
+            fprintf(stderr, "Couldn't read compressed file: %s\n", path);
+        }
+        fclose(file);
+        return file_size;
+    }
 
-    // If out is allocated, we shove the text in.
-    if (out) {
-        // But first we zero out the memory so we don't have to deal with
-        // null termination.
-        mem_set(out, 0, file_size);
-        fread(out, 1, file_size, file);
+    // Room for the text and its null terminator
+    if ((u64)file_size + 1 > *capacity) {
+        char* grown = realloc(*out, file_size + 1);
+        if (grown == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for source.\n");
+            fclose(file);
+            return -1;
+        }
+        *out = grown;
+        *capacity = (u64)file_size + 1;
     }
+    file_size = (i64)fread(*out, 1, file_size, file);
+    (*out)[file_size] = '\0';
 
     // Closing the file
     fclose(file);
@@ -247,6 +368,22 @@ i64 load_source(const char* path, char* out) {
     return file_size;
 }
 
+i64 source_file_size(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Couldn't open file: %s\n", path);
+        return -1;
+    }
+
+    i64 file_size = fseek(file, 0L, SEEK_END) == 0 ? ftell(file) : -1;
+    fclose(file);
+    if (file_size < 0) {
+        fprintf(stderr, "Couldn't read file: %s\n", path);
+    }
+
+    return file_size;
+}
+
 void print_tokens(tokenizer_t* t) {
     for (u64 i = 0; i < t->token_array.count; ++i) {
         token_t token = t->token_array.tokens[i];
@@ -258,3 +395,11 @@ void print_tokens(tokenizer_t* t) {
         );
     }
 }
+
+static void track_brackets(tokenizer_t* t, token_type_t type) {
+    // A `]`, or a `(` right after one, marks the brackets as soon as it's
+    // seen, even when it only ended the run before it
+    if (type == TOKEN_SQBR_CLOSE || type == TOKEN_PAREN_OPEN) {
+        t->open_type = type;
+    }
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "types.h"
+#include "lines.h"
+#include "budget.h"
 #include "lib/str.h"
 
 typedef enum {
@@ -25,6 +27,9 @@ typedef enum {
 
 typedef struct {
     token_type_t type;
+    // Set by the parser on a single `[` and on `(`: how many tokens on
+    // its `]`, or the next `)`, is. 0 if it has none
+    u32 pair;
     str_view_t value;
 } token_t;
 
@@ -51,19 +56,47 @@ typedef struct {
     token_type_t open_type;
     u64 current_length;
 
-    // Debug info
-    u64 current_line;
-    u64 current_char;
+    // Still in the indentation and block markers at the start of a line
+    b8 line_start;
+
+    // Line numbers for diagnostics, only built when one asks
+    line_index_t lines;
+
+    // Limits checked at every linebreak, nullptr for none
+    budget_t* budget;
 } tokenizer_t;
 
 b8 tokenizer_init(tokenizer_t* t, const char* path);
+b8 tokenizer_init_source(tokenizer_t* t, char* source, u64 size);
+void tokenizer_reset(tokenizer_t* t, char* source, u64 size);
 void tokenizer_shutdown(tokenizer_t* t);
 
+// 1 based line and column of a position in the source.
+b8 tokenizer_locate(tokenizer_t* t, const char* at, u64* line, u64* column);
+
+// The context a byte is classified in, as bits of a state. Within a run
+// of one token type it doesn't change.
+#define TOKENIZER_LINE_START (1u << 0)
+#define TOKENIZER_AFTER_TEXT (1u << 1)
+#define TOKENIZER_AFTER_SQBR_CLOSE (1u << 2)
+#define TOKENIZER_PAREN_OPEN (1u << 3)
+#define TOKENIZER_STATE_COUNT 16
+
 b8 next_token(tokenizer_t* t);
 void flush_token(tokenizer_t* t);
-token_type_t char_to_token(char c, tokenizer_t* t);
+u32 tokenizer_state(const tokenizer_t* t);
+
+// The type of the byte at `at` in `state`: a byte class and a state x
+// class table lookup, no branches on the byte itself.
+token_type_t char_to_token(const char* at, u32 state);
 
 // Helper functions
 b8 is_char_digit(char c);
-i64 load_source(const char* path, char* out);
+b8 is_char_space(char c);
+// Loads the file into `*out`, a malloc'd buffer of `*capacity` bytes
+// (nullptr and 0 to start), grown to fit it and a null terminator.
+// Compressed sources are inflated. Returns the size, -1 on an error.
+i64 load_source(const char* path, char** out, u64* capacity);
+// Size of the file on disk, compressed or not.
+i64 source_file_size(const char* path);
 void print_tokens(tokenizer_t* t);
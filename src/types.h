@@ -7,6 +7,9 @@ typedef char i8;
 typedef int i32;
 typedef long long i64;
 
+typedef float f32;
+typedef double f64;
+
 typedef unsigned char b8;
 #define true 1
 #define false 0
@@ -0,0 +1,403 @@
+#include "utf8.h"
+
+#include "lib/mem.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define UTF8_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+// Code points from `first` to `last` map to cp + delta. With a stride
+// of 2 only every other one does (upper/lower case pairs).
+typedef struct case_range {
+    u32 first;
+    u32 last;
+    i32 delta;
+    u32 stride;
+} case_range_t;
+
+typedef struct code_range {
+    u32 first;
+    u32 last;
+} code_range_t;
+
+static const case_range_t lower_ranges[] = {
+    { 0x00C0, 0x00D6, 32, 1 },
+    { 0x00D8, 0x00DE, 32, 1 },
+    { 0x0100, 0x012F, 1, 2 },
+    { 0x0132, 0x0137, 1, 2 },
+    { 0x0139, 0x0148, 1, 2 },
+    { 0x014A, 0x0177, 1, 2 },
+    { 0x0178, 0x0178, -121, 1 },
+    { 0x0179, 0x017E, 1, 2 },
+    { 0x01C4, 0x01C4, 2, 1 },
+    { 0x01C5, 0x01C5, 1, 1 },
+    { 0x01C7, 0x01C7, 2, 1 },
+    { 0x01C8, 0x01C8, 1, 1 },
+    { 0x01CA, 0x01CA, 2, 1 },
+    { 0x01CB, 0x01CB, 1, 1 },
+    { 0x01CD, 0x01DC, 1, 2 },
+    { 0x01DE, 0x01EF, 1, 2 },
+    { 0x01F1, 0x01F1, 2, 1 },
+    { 0x01F2, 0x01F2, 1, 1 },
+    { 0x01F4, 0x01F4, 1, 1 },
+    { 0x01F8, 0x021F, 1, 2 },
+    { 0x0222, 0x0233, 1, 2 },
+    { 0x0370, 0x0373, 1, 2 },
+    { 0x0376, 0x0376, 1, 1 },
+    { 0x0386, 0x0386, 38, 1 },
+    { 0x0388, 0x038A, 37, 1 },
+    { 0x038C, 0x038C, 64, 1 },
+    { 0x038E, 0x038F, 63, 1 },
+    { 0x0391, 0x03A1, 32, 1 },
+    { 0x03A3, 0x03AB, 32, 1 },
+    { 0x03D8, 0x03EF, 1, 2 },
+    { 0x0400, 0x040F, 80, 1 },
+    { 0x0410, 0x042F, 32, 1 },
+    { 0x0460, 0x0481, 1, 2 },
+    { 0x048A, 0x04BF, 1, 2 },
+    { 0x04C0, 0x04C0, 15, 1 },
+    { 0x04C1, 0x04CE, 1, 2 },
+    { 0x04D0, 0x052F, 1, 2 },
+    { 0x0531, 0x0556, 48, 1 },
+    { 0x10A0, 0x10C5, 7264, 1 },
+    { 0x10C7, 0x10C7, 7264, 1 },
+    { 0x10CD, 0x10CD, 7264, 1 },
+    { 0x1E00, 0x1E95, 1, 2 },
+    { 0x1E9E, 0x1E9E, -7615, 1 },
+    { 0x1EA0, 0x1EFF, 1, 2 },
+    { 0x1F08, 0x1F0F, -8, 1 },
+    { 0x1F18, 0x1F1D, -8, 1 },
+    { 0x1F28, 0x1F2F, -8, 1 },
+    { 0x1F38, 0x1F3F, -8, 1 },
+    { 0x1F48, 0x1F4D, -8, 1 },
+    { 0x1F59, 0x1F5F, -8, 2 },
+    { 0x1F68, 0x1F6F, -8, 1 },
+    { 0x2C00, 0x2C2F, 48, 1 },
+    { 0xFF21, 0xFF3A, 32, 1 },
+    { 0x10400, 0x10427, 40, 1 }
+};
+
+// Everything outside these (above ASCII) counts as part of a word
+static const code_range_t non_word_ranges[] = {
+    { 0x0080, 0x00A9 },
+    { 0x00AB, 0x00B4 },
+    { 0x00B6, 0x00B9 },
+    { 0x00BB, 0x00BF },
+    { 0x00D7, 0x00D7 },
+    { 0x00F7, 0x00F7 },
+    { 0x037E, 0x037E },
+    { 0x0387, 0x0387 },
+    { 0x055A, 0x055F },
+    { 0x0589, 0x058A },
+    { 0x05BE, 0x05BE },
+    { 0x05C0, 0x05C0 },
+    { 0x05C3, 0x05C3 },
+    { 0x05C6, 0x05C6 },
+    { 0x05F3, 0x05F4 },
+    { 0x060C, 0x060D },
+    { 0x061B, 0x061B },
+    { 0x061F, 0x061F },
+    { 0x066A, 0x066D },
+    { 0x06D4, 0x06D4 },
+    { 0x0964, 0x0965 },
+    { 0x0E3F, 0x0E3F },
+    { 0x0E4F, 0x0E4F },
+    { 0x0E5A, 0x0E5B },
+    { 0x10FB, 0x10FB },
+    { 0x1360, 0x1368 },
+    { 0x166D, 0x166E },
+    { 0x1680, 0x1680 },
+    { 0x2000, 0x2BFF },
+    { 0x2E00, 0x2E7F },
+    { 0x3000, 0x3004 },
+    { 0x3008, 0x3020 },
+    { 0x3030, 0x3030 },
+    { 0x303D, 0x303F },
+    { 0x30FB, 0x30FB },
+    { 0xD800, 0xF8FF },
+    { 0xFD3E, 0xFD3F },
+    { 0xFE10, 0xFE1F },
+    { 0xFE30, 0xFE6F },
+    { 0xFEFF, 0xFEFF },
+    { 0xFF01, 0xFF0F },
+    { 0xFF1A, 0xFF20 },
+    { 0xFF3B, 0xFF40 },
+    { 0xFF5B, 0xFF65 },
+    { 0xFFF0, 0xFFFF },
+    { 0x1F000, 0x1FAFF },
+    { 0xE0000, 0xE007F },
+    { 0xF0000, 0x10FFFF }
+};
+
+static u64 utf8_sequence(const u8* p, u64 remaining);
+static b8 utf8_validate_scalar(const u8* data, u64 length, u64 from, u64* error_offset);
+static u64 utf8_back_to_lead(const u8* data, u64 i);
+
+#ifdef UTF8_SSSE3
+static b8 utf8_validate_ssse3(const u8* data, u64 length, u64* error_offset);
+#endif
+
+b8 utf8_validate(const char* data, u64 length, u64* error_offset) {
+#ifdef UTF8_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        return utf8_validate_ssse3((const u8*)data, length, error_offset);
+    }
+#endif
+    return utf8_validate_scalar((const u8*)data, length, 0, error_offset);
+}
+
+i32 utf8_decode(const char* data, u64 length, u64* i) {
+    const u8* p = (const u8*)data + *i;
+    u64 n = utf8_sequence(p, length - *i);
+    if (n == 0) {
+        (*i)++;
+        return -1;
+    }
+    *i += n;
+
+    switch (n) {
+        case 1: return p[0];
+        case 2: return ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+        case 3: return ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+        default: return ((p[0] & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+    }
+}
+
+u32 utf8_encode(u32 cp, char* out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+u32 utf8_to_lower(u32 cp) {
+    if (cp < 0x80) {
+        return (cp >= 'A' && cp <= 'Z') ? cp + 32 : cp;
+    }
+
+    // Last range starting at or before `cp`
+    u32 lo = 0;
+    u32 hi = sizeof(lower_ranges) / sizeof(lower_ranges[0]);
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (lower_ranges[mid].first <= cp) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return cp;
+
+    const case_range_t* r = &lower_ranges[lo - 1];
+    if (cp > r->last || (cp - r->first) % r->stride != 0) {
+        return cp;
+    }
+
+    return (u32)((i32)cp + r->delta);
+}
+
+b8 utf8_is_word(u32 cp) {
+    if (cp < 0x80) {
+        return (cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z') || (cp >= '0' && cp <= '9');
+    }
+
+    u32 lo = 0;
+    u32 hi = sizeof(non_word_ranges) / sizeof(non_word_ranges[0]);
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (non_word_ranges[mid].first <= cp) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo == 0 || cp > non_word_ranges[lo - 1].last;
+}
+
+static u64 utf8_sequence(const u8* p, u64 remaining) {
+    // Length of the well formed sequence at `p`, 0 if there isn't one
+    // (Unicode 15, table 3-7)
+    u8 c = p[0];
+    if (c < 0x80) return 1;
+
+    u64 n;
+    u8 lo = 0x80;
+    u8 hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        if (c == 0xE0) lo = 0xA0;
+        if (c == 0xED) hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        if (c == 0xF0) lo = 0x90;
+        if (c == 0xF4) hi = 0x8F;
+    } else {
+        return 0;
+    }
+
+    if (remaining < n) return 0;
+    if (p[1] < lo || p[1] > hi) return 0;
+    for (u64 i = 2; i < n; ++i) {
+        if (p[i] < 0x80 || p[i] > 0xBF) return 0;
+    }
+
+    return n;
+}
+
+static b8 utf8_validate_scalar(const u8* data, u64 length, u64 from, u64* error_offset) {
+    u64 i = from;
+    while (i < length) {
+        // Skip ASCII a word at a time
+        while (i + 8 <= length) {
+            u64 word;
+            mem_copy(&word, (void*)(data + i), 8);
+            if (word & 0x8080808080808080ULL) break;
+            i += 8;
+        }
+        if (i >= length) break;
+
+        u64 n = utf8_sequence(data + i, length - i);
+        if (n == 0) {
+            if (error_offset) *error_offset = i;
+            return false;
+        }
+        i += n;
+    }
+
+    return true;
+}
+
+static u64 utf8_back_to_lead(const u8* data, u64 i) {
+    // Start of the character byte i - 1 belongs to, so one cut off
+    // at `i` is looked at whole
+    if (i == 0) return 0;
+
+    u64 start = i - 1;
+    for (u32 k = 0; k < 3 && start > 0 && (data[start] & 0xC0) == 0x80; ++k) start--;
+    return start;
+}
+
+#ifdef UTF8_SSSE3
+
+// Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+// Byte". Each byte is checked against the three before it with three
+// nibble lookups, and the errors of a whole chunk are or'ed together.
+// Only a chunk with an error is looked at again, byte by byte, to find
+// where it is.
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS ((char)(1 << 7))
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static __m128i utf8_block_errors(__m128i input, __m128i previous) {
+    const __m128i byte_1_high = _mm_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m128i byte_1_low = _mm_setr_epi8(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m128i byte_2_high = _mm_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+
+    __m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+    __m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+
+    // Two byte sequence errors, and whether a continuation was expected
+    __m128i special = _mm_and_si128(
+        _mm_and_si128(
+            _mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+            _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+        _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+
+    // Third and fourth bytes of 3 and 4 byte sequences must be continuations
+    __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+    __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+    __m128i must_continue = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+
+    return _mm_xor_si128(must_continue, special);
+}
+
+__attribute__((target("ssse3")))
+static b8 utf8_validate_ssse3(const u8* data, u64 length, u64* error_offset) {
+    // A lead byte this close to the end of a block needs the next one
+    const __m128i incomplete_max = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+
+    __m128i previous = _mm_setzero_si128();
+    __m128i incomplete = _mm_setzero_si128();
+
+    u64 i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m128i error = _mm_setzero_si128();
+
+        for (u32 k = 0; k < 4; ++k) {
+            __m128i input = _mm_loadu_si128((const __m128i*)(data + i + k * 16));
+
+            if (_mm_movemask_epi8(input) == 0) {
+                // All ASCII, only a sequence cut off before it can be wrong
+                error = _mm_or_si128(error, incomplete);
+                incomplete = _mm_setzero_si128();
+            } else {
+                error = _mm_or_si128(error, utf8_block_errors(input, previous));
+                incomplete = _mm_subs_epu8(input, incomplete_max);
+            }
+            previous = input;
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) {
+            return utf8_validate_scalar(data, length, utf8_back_to_lead(data, i), error_offset);
+        }
+    }
+
+    // The rest, from the start of the character the last chunk ended in
+    return utf8_validate_scalar(data, length, utf8_back_to_lead(data, i), error_offset);
+}
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+// Returns true if `data` is well formed UTF-8. Otherwise `error_offset`
+// (if given) is set to the offset of the first byte of the first bad
+// sequence. Vectorized (SSSE3, picked at runtime) where it's available.
+b8 utf8_validate(const char* data, u64 length, u64* error_offset);
+
+// Decodes the code point at `*i` and moves past it. Returns -1, and
+// moves past a single byte, if the sequence isn't valid.
+i32 utf8_decode(const char* data, u64 length, u64* i);
+
+// Writes up to 4 bytes, returns how many.
+u32 utf8_encode(u32 cp, char* out);
+
+// Simple (one to one) lowercase mapping for the Latin, Greek, Cyrillic,
+// Armenian, Georgian and fullwidth Latin blocks. Anything else is
+// returned as it is.
+u32 utf8_to_lower(u32 cp);
+
+// False for the punctuation, symbol, space and private use ranges,
+// true for the rest, which in practice means letters, marks and digits
+// of every script.
+b8 utf8_is_word(u32 cp);
@@ -0,0 +1,354 @@
+#include "watch.h"
+
+#include "render.h"
+#include "batch.h"
+#include "platform.h"
+#include "lib/str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+// How long to keep collecting events after the first one. Editors
+// tend to fire several writes/renames for a single save.
+#define WATCH_COALESCE_MS 5
+#define WATCH_PATH_MAX 4096
+#define WATCH_EVENT_BUFFER (64 * 1024)
+
+typedef struct watch_dir {
+    i32 wd;
+    char* path;
+} watch_dir_t;
+
+typedef struct watch {
+    config_t* cfg;
+    render_context_t ctx;
+    // Compiled once, every render reuses it
+    page_t page;
+    template_t template;
+    i32 fd;
+
+    // Blocks an edit didn't touch come from here (--block-cache)
+    block_cache_t blocks;
+    b8 use_blocks;
+
+    // Watching a whole directory tree, or a single file
+    b8 is_dir;
+    const char* file_name;
+
+    watch_dir_t* dirs;
+    u64 dir_count;
+    u64 dir_capacity;
+
+    // Files changed since the last render
+    char** dirty;
+    u64 dirty_count;
+    u64 dirty_capacity;
+} watch_t;
+
+static volatile sig_atomic_t watch_running = 1;
+
+static void watch_on_signal(i32 signal);
+static b8 watch_add_dir(watch_t* w, const char* path, b8 render);
+static const char* watch_dir_path(watch_t* w, i32 wd);
+static void watch_mark_dirty(watch_t* w, const char* path);
+static void watch_render(watch_t* w, const char* path);
+static b8 watch_read_events(watch_t* w);
+static b8 is_markdown(const char* name);
+
+i32 run_watch(config_t* cfg) {
+    watch_t w = { 0 };
+    w.cfg = cfg;
+
+    struct stat st;
+    if (stat(cfg->input_file, &st) != 0) {
+        fprintf(stderr, "Couldn't open file: %s\n", cfg->input_file);
+        return -1;
+    }
+    w.is_dir = S_ISDIR(st.st_mode);
+
+    w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w.fd < 0) {
+        fprintf(stderr, "Failed to initialize inotify.\n");
+        return -1;
+    }
+
+    if (!page_init(&w.page, &w.template, cfg->title, cfg->css, cfg->template_file)) {
+        close(w.fd);
+        return -1;
+    }
+
+    if (!render_context_init(&w.ctx, cfg->output_mode)) {
+        template_shutdown(&w.template);
+        close(w.fd);
+        return -1;
+    }
+    w.ctx.renderer = renderer_get(cfg->output_format);
+    w.ctx.use_cache = cfg->cache;
+    w.ctx.gzip = cfg->gzip;
+    w.ctx.budget = cfg->budget;
+
+    // Limits need the whole tree, so they turn it off
+    w.use_blocks = cfg->block_cache_mb > 0 && cfg->output_format == FORMAT_HTML && !budget_enabled(&w.ctx.budget);
+    if (w.use_blocks && block_cache_init(&w.blocks, (u64)cfg->block_cache_mb * 1024 * 1024)) {
+        if (!render_context_use_blocks(&w.ctx, &w.blocks)) {
+            block_cache_shutdown(&w.blocks);
+            w.use_blocks = false;
+        }
+    } else {
+        w.use_blocks = false;
+    }
+    if (cfg->block_cache_mb > 0 && !w.use_blocks) {
+        fprintf(stderr, "Rendering without the block cache (HTML without limits only).\n");
+    }
+
+    signal(SIGINT, watch_on_signal);
+    signal(SIGTERM, watch_on_signal);
+
+    b8 ok = true;
+    if (w.is_dir) {
+        ok = watch_add_dir(&w, cfg->input_file, true);
+    } else {
+        // Editors often save by writing a new file and renaming it over
+        // the old one, so it's the parent directory that gets watched.
+        char dir[WATCH_PATH_MAX];
+        const char* slash = nullptr;
+        for (const char* c = cfg->input_file; *c; ++c) {
+            if (*c == '/') slash = c;
+        }
+        if (slash) {
+            str_ncpy(dir, cfg->input_file, slash - cfg->input_file + 1);
+            w.file_name = slash + 1;
+        } else {
+            str_cpy(dir, ".");
+            w.file_name = cfg->input_file;
+        }
+
+        ok = watch_add_dir(&w, dir, false);
+        watch_render(&w, cfg->input_file);
+    }
+
+    if (ok) {
+        printf("Watching %s (Ctrl+C to stop)\n", cfg->input_file);
+    }
+
+    while (ok && watch_running) {
+        struct pollfd pfd = { .fd = w.fd, .events = POLLIN };
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Collect the burst, until it goes quiet
+        do {
+            if (!watch_read_events(&w)) {
+                ok = false;
+                break;
+            }
+        } while (watch_running && poll(&pfd, 1, WATCH_COALESCE_MS) > 0);
+
+        for (u64 i = 0; i < w.dirty_count; ++i) {
+            watch_render(&w, w.dirty[i]);
+            free(w.dirty[i]);
+        }
+        w.dirty_count = 0;
+    }
+
+    for (u64 i = 0; i < w.dir_count; ++i) {
+        free(w.dirs[i].path);
+    }
+    for (u64 i = 0; i < w.dirty_count; ++i) {
+        free(w.dirty[i]);
+    }
+    free(w.dirs);
+    free(w.dirty);
+
+    render_context_shutdown(&w.ctx);
+    if (w.use_blocks) block_cache_shutdown(&w.blocks);
+    template_shutdown(&w.template);
+    close(w.fd);
+
+    return ok ? 0 : -1;
+}
+
+static void watch_on_signal(i32 signal) {
+    (void)signal;
+    watch_running = 0;
+}
+
+static b8 watch_add_dir(watch_t* w, const char* path, b8 render) {
+    u32 mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+    if (w->is_dir) mask |= IN_CREATE;
+
+    i32 wd = inotify_add_watch(w->fd, path, mask);
+    if (wd < 0) {
+        fprintf(stderr, "Couldn't watch directory: %s\n", path);
+        return false;
+    }
+
+    if (w->dir_count == w->dir_capacity) {
+        u64 capacity = w->dir_capacity ? w->dir_capacity * 2 : 16;
+        watch_dir_t* dirs = realloc(w->dirs, sizeof(watch_dir_t) * capacity);
+        if (dirs == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for watches.\n");
+            return false;
+        }
+        w->dirs = dirs;
+        w->dir_capacity = capacity;
+    }
+    w->dirs[w->dir_count].wd = wd;
+    w->dirs[w->dir_count].path = str_dup(path);
+    w->dir_count++;
+
+    if (!w->is_dir) {
+        return true;
+    }
+
+    // inotify isn't recursive, so every subdirectory gets its own watch
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return true;
+    }
+
+    struct dirent* entry;
+    char child[WATCH_PATH_MAX];
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] == '.') continue;
+
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+
+        struct stat st;
+        if (stat(child, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            watch_add_dir(w, child, render);
+        } else if (render && is_markdown(entry->d_name)) {
+            watch_render(w, child);
+        }
+    }
+    closedir(dir);
+
+    return true;
+}
+
+static const char* watch_dir_path(watch_t* w, i32 wd) {
+    for (u64 i = 0; i < w->dir_count; ++i) {
+        if (w->dirs[i].wd == wd) return w->dirs[i].path;
+    }
+    return nullptr;
+}
+
+static void watch_mark_dirty(watch_t* w, const char* path) {
+    // Bursts are small, a linear scan is enough to drop duplicates
+    for (u64 i = 0; i < w->dirty_count; ++i) {
+        if (str_cmp(w->dirty[i], path) == 0) return;
+    }
+
+    if (w->dirty_count == w->dirty_capacity) {
+        u64 capacity = w->dirty_capacity ? w->dirty_capacity * 2 : 16;
+        char** dirty = realloc(w->dirty, sizeof(char*) * capacity);
+        if (dirty == nullptr) {
+            fprintf(stderr, "Failed to allocate memory for changed files.\n");
+            return;
+        }
+        w->dirty = dirty;
+        w->dirty_capacity = capacity;
+    }
+
+    w->dirty[w->dirty_count++] = str_dup(path);
+}
+
+static void watch_render(watch_t* w, const char* path) {
+    // A single file goes where -o says, a tree renders next to the sources
+    char out_file[WATCH_PATH_MAX];
+    if (w->is_dir) {
+        if (!batch_output_path(path, w->ctx.renderer->extension, out_file, sizeof(out_file))) return;
+    } else {
+        str_ncpy(out_file, w->cfg->output_file, str_len(w->cfg->output_file));
+    }
+
+    block_cache_stats_t before = { 0 };
+    if (w->use_blocks) before = block_cache_stats(&w->blocks);
+
+    u64 start = platform_time_ns();
+    b8 ok = render_file(&w->ctx, path, out_file, &w->page);
+    u64 end = platform_time_ns();
+
+    if (ok && w->use_blocks) {
+        block_cache_stats_t after = block_cache_stats(&w->blocks);
+        u64 hits = after.hits - before.hits;
+        printf("Rendered %s -> %s (%.3f ms, %llu of %llu blocks cached)\n", path, out_file, (end - start) / 1e6,
+            hits, hits + after.misses - before.misses);
+    } else if (ok) {
+        printf("Rendered %s -> %s (%.3f ms)\n", path, out_file, (end - start) / 1e6);
+    } else {
+        fprintf(stderr, "Failed to render %s\n", path);
+    }
+}
+
+static b8 watch_read_events(watch_t* w) {
+    static _Alignas(struct inotify_event) char buffer[WATCH_EVENT_BUFFER];
+    char path[WATCH_PATH_MAX];
+
+    for (;;) {
+        ssize_t length = read(w->fd, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno == EAGAIN) return true;
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Failed to read inotify events.\n");
+            return false;
+        }
+
+        for (char* c = buffer; c < buffer + length;) {
+            struct inotify_event* event = (struct inotify_event*)c;
+            c += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "Too many changes at once, some were missed.\n");
+                continue;
+            }
+            if (event->len == 0) continue;
+
+            const char* dir = watch_dir_path(w, event->wd);
+            if (dir == nullptr) continue;
+
+            if (w->is_dir) {
+                snprintf(path, sizeof(path), "%s/%s", dir, event->name);
+
+                if (event->mask & IN_ISDIR) {
+                    // New subdirectory, watch it and render what's already in it
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO)) watch_add_dir(w, path, true);
+                } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_markdown(event->name)) {
+                    watch_mark_dirty(w, path);
+                }
+            } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && str_cmp(event->name, w->file_name) == 0) {
+                watch_mark_dirty(w, w->cfg->input_file);
+            }
+        }
+    }
+}
+
+static b8 is_markdown(const char* name) {
+    u64 length = str_len(name);
+    return (length > 3 && str_cmp(name + length - 3, ".md") == 0) ||
+        (length > 6 && str_cmp(name + length - 6, ".md.gz") == 0);
+}
+
+#else
+
+i32 run_watch(config_t* cfg) {
+    (void)cfg;
+    fprintf(stderr, "Watch mode is only supported on Linux.\n");
+    return -1;
+}
+
+#endif
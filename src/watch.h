@@ -0,0 +1,8 @@
+#pragma once
+
+#include "types.h"
+#include "args.h"
+
+// Watches the input file (or every .md file under the input
+// directory) and re-renders whatever changes, until interrupted.
+i32 run_watch(config_t* cfg);